@@ -5,6 +5,7 @@
 #include "osdtext.h"
 
 #include <chrono>
+#include <vector>
 
 #include "GLFW/glfw3.h"
 
@@ -103,6 +104,7 @@ class Viewer {
   static OSDText* osd_text;
   static int line_id_renderer;
   static int line_id_framerate;
+  static std::vector<int> line_id_details;
 
 
 }; // class Viewer
@@ -41,6 +41,7 @@ Renderer* Viewer::renderer;
 OSDText* Viewer::osd_text;
 int Viewer::line_id_renderer;
 int Viewer::line_id_framerate;
+std::vector<int> Viewer::line_id_details;
 
 Viewer::Viewer() {
 
@@ -203,12 +204,22 @@ void Viewer::drawInfo() {
   // TODO: This is done on every update and it shouldn't be!
   // The viewer should only update when the renderer needs to
   // update the info text. 
-  if (renderer) {
-    string renderer_info = renderer->info();
-    osd_text->set_text(line_id_renderer, renderer_info);
-  } else {
-    string renderer_info = "No input renderer";
-    osd_text->set_text(line_id_renderer, renderer_info);
+  // Lines after the first of the renderer info go below it.
+  string renderer_info = renderer ? renderer->info() : "No input renderer";
+  size_t end = renderer_info.find('\n');
+  osd_text->set_text(line_id_renderer, renderer_info.substr(0, end));
+  size_t line = 0;
+  while (end != string::npos) {
+    size_t start = end + 1;
+    end = renderer_info.find('\n', start);
+    if (line == line_id_details.size()) {
+      line_id_details.push_back(osd_text->add_line(-0.95, 0.90 - 0.06 * (line + 1), "",
+                                                   14, Color(0.15, 0.5, 0.15)));
+    }
+    osd_text->set_text(line_id_details[line++], renderer_info.substr(start, end - start));
+  }
+  for (; line < line_id_details.size(); ++line) {
+    osd_text->set_text(line_id_details[line], "");
   }
 
   // render OSD
@@ -0,0 +1,49 @@
+#include "arena.h"
+
+#include <cstdint>
+
+using namespace std;
+
+namespace CMU462 {
+
+void* Arena::allocate( size_t size, size_t align ) {
+
+  // pad the cursor up to the requested alignment
+  size_t padding = (align - (reinterpret_cast<uintptr_t>(cursor) & (align - 1))) & (align - 1);
+
+  if( size + padding > remaining ) {
+
+    // large requests get a dedicated block so that the current
+    // block can keep serving small allocations
+    if( size > block_size / 4 ) {
+      char* block = static_cast<char*>( ::operator new( size + align ) );
+      blocks.push_back( block );
+      used += size;
+      size_t offset = (align - (reinterpret_cast<uintptr_t>(block) & (align - 1))) & (align - 1);
+      return block + offset;
+    }
+
+    // start a new block
+    cursor = static_cast<char*>( ::operator new( block_size ) );
+    remaining = block_size;
+    blocks.push_back( cursor );
+    padding = (align - (reinterpret_cast<uintptr_t>(cursor) & (align - 1))) & (align - 1);
+  }
+
+  char* ptr = cursor + padding;
+  cursor    += padding + size;
+  remaining -= padding + size;
+  used      += size;
+  return ptr;
+}
+
+void Arena::clear() {
+
+  for( size_t i = 0; i < blocks.size(); ++i ) {
+    ::operator delete( blocks[i] );
+  } blocks.clear();
+
+  cursor = NULL; remaining = 0; used = 0;
+}
+
+} // namespace CMU462
@@ -0,0 +1,64 @@
+#ifndef CMU462_ARENA_H
+#define CMU462_ARENA_H
+
+#include <new>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+namespace CMU462 {
+
+/**
+ * A monotonic arena allocator.
+ * Memory is handed out from large blocks by bumping a pointer and is only
+ * ever released all at once, when the arena is cleared or destroyed. The
+ * arena does not track the objects constructed in it: owners that need
+ * destructors to run must call them before clearing the arena.
+ */
+class Arena {
+ public:
+
+  Arena( size_t block_size = 64 * 1024 )
+    : block_size ( block_size ), cursor ( NULL ), remaining ( 0 ), used ( 0 ) { }
+
+  ~Arena() { clear(); }
+
+  // allocate raw storage that stays valid until the arena is cleared
+  void* allocate( size_t size, size_t align = alignof(std::max_align_t) );
+
+  // construct an object in the arena
+  template< typename T, typename... Args >
+  inline T* create( Args&&... args ) {
+    return new ( allocate( sizeof(T), alignof(T) ) )
+             T( std::forward<Args>(args)... );
+  }
+
+  // release all blocks
+  void clear();
+
+  // number of bytes handed out since the last clear
+  inline size_t bytes_used() const { return used; }
+
+ private:
+
+  // arenas own their blocks and can not be copied
+  Arena( const Arena& );
+  Arena& operator=( const Arena& );
+
+  // size of a regular block (larger requests get their own block)
+  size_t block_size;
+
+  // current block fill state
+  char* cursor; size_t remaining;
+
+  // allocated blocks
+  std::vector<char*> blocks;
+
+  // allocation statistics
+  size_t used;
+
+}; // class Arena
+
+} // namespace CMU462
+
+#endif // CMU462_ARENA_H
@@ -0,0 +1,1418 @@
+#include "CMU462.h"
+#include "timer.h"
+#include "svg.h"
+#include "number_parser.h"
+#include "thread_pool.h"
+#include "viewport.h"
+#include "software_renderer.h"
+#include "image_diff.h"
+#include "heatmap.h"
+#include "png.h"
+#include "lodepng.h"
+#include "base64.h"
+
+#include <sys/stat.h>
+#include <dirent.h>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+using namespace std;
+using namespace CMU462;
+
+#define msg(s) cerr << "[DrawSVG] " << s << endl;
+
+// peak resident set size of the process in kilobytes (0 if unknown)
+static size_t peakRSS() {
+#ifndef _WIN32
+  struct rusage usage;
+  getrusage( RUSAGE_SELF, &usage );
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;
+#else
+  return usage.ru_maxrss;
+#endif
+#else
+  return 0;
+#endif
+}
+
+// collect svg files from a path (single file or directory), sorted by name
+static int collectFiles( const char* path, vector<string>& files ) {
+
+  struct stat st;
+  if( stat(path, &st) < 0 ) {
+    msg("File does not exist: " << path);
+    return -1;
+  }
+
+  if( st.st_mode & S_IFREG ) {
+    files.push_back( path );
+    return 0;
+  }
+
+  DIR *dir = opendir (path);
+  if( !dir ) {
+    msg("Could not open directory " << path);
+    return -1;
+  }
+
+  string pathname = path;
+  if (pathname.back() != '/') pathname.push_back('/');
+
+  struct dirent *ent;
+  while ((ent = readdir (dir)) != NULL) {
+    string filename = ent->d_name;
+    string filesufx = filename.substr(filename.find_last_of(".") + 1);
+    if (filesufx == "svg") files.push_back(pathname + filename);
+  }
+  closedir (dir);
+
+  sort(files.begin(), files.end());
+  return files.empty() ? -1 : 0;
+}
+
+// count all elements of a document, including the ones nested in groups
+static size_t countElements( const vector<SVGElement*>& elements ) {
+  size_t n = elements.size();
+  for( size_t i = 0; i < elements.size(); ++i ) {
+    if( elements[i]->type == GROUP ) {
+      n += countElements( static_cast<Group*>(elements[i])->elements );
+    }
+  }
+  return n;
+}
+
+// size of a file in bytes (0 if unknown)
+static size_t fileSize( const string& path ) {
+  struct stat st;
+  return stat( path.c_str(), &st ) < 0 ? 0 : st.st_size;
+}
+
+// load: parse time and throughput, teardown time and peak memory of
+// loading documents
+static int benchLoad( const vector<string>& files, int repetitions ) {
+
+  Timer timer;
+  double total_load = 0, total_free = 0; size_t total_bytes = 0;
+
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    double load = 0, teardown = 0; size_t elements = 0;
+    for( int r = 0; r < repetitions; ++r ) {
+
+      SVG* svg = new SVG();
+
+      timer.start();
+      if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+        msg("Failed to load " << files[i]);
+        delete svg; return -1;
+      }
+      timer.stop(); load += timer.duration();
+
+      elements = countElements( svg->elements );
+
+      timer.start();
+      delete svg;
+      timer.stop(); teardown += timer.duration();
+    }
+
+    load /= repetitions; teardown /= repetitions;
+    total_load += load; total_free += teardown;
+    size_t bytes = fileSize( files[i] ); total_bytes += bytes;
+
+    cout << files[i] << ": " << elements << " elements, "
+         << "load " << load * 1000 << " ms "
+         << "(" << bytes / load / (1 << 20) << " MB/s), "
+         << "teardown " << teardown * 1000 << " ms" << endl;
+  }
+
+  cout << "total: load " << total_load * 1000 << " ms "
+       << "(" << total_bytes / total_load / (1 << 20) << " MB/s), "
+       << "teardown " << total_free * 1000 << " ms, "
+       << "peak RSS " << peakRSS() / 1024.0 << " MB" << endl;
+
+  return 0;
+}
+
+// loadall: wall time of loading all documents concurrently, as the viewer
+// loads a directory, with an increasing number of threads
+static int benchLoadAll( const vector<string>& files, size_t max_threads ) {
+
+  Timer timer;
+  double single = 0;
+
+  // powers of two up to the given number of threads
+  for( size_t threads = 1; ; threads = min( threads * 2, max_threads ) ) {
+
+    ThreadPool pool ( threads );
+    vector<SVG*> svgs ( files.size(), NULL );
+
+    timer.start();
+    pool.parallel_for( files.size(), [&]( size_t i ) {
+      SVG* svg = new SVG();
+      if( SVGParser::load( files[i].c_str(), svg ) < 0 ) delete svg;
+      else svgs[i] = svg;
+    });
+    timer.stop();
+
+    size_t loaded = 0;
+    for( size_t i = 0; i < svgs.size(); ++i ) {
+      if( svgs[i] ) loaded++;
+      delete svgs[i];
+    }
+
+    double load = timer.duration();
+    if( threads == 1 ) single = load;
+    cout << threads << " threads: " << loaded << "/" << files.size() << " files, "
+         << "load " << load * 1000 << " ms, "
+         << "speedup " << single / load << "x" << endl;
+    if( threads == max_threads ) break;
+  }
+
+  return 0;
+}
+
+// copy the points attributes of the children of the current element
+static void collectPoints( XMLReader* xml, vector<string>& lists ) {
+  int depth = xml->Depth();
+  while( xml->NextChild( depth ) ) {
+    XMLValue points = xml->Attribute( "points" );
+    if( points.begin ) lists.push_back( points.str() );
+    collectPoints( xml, lists );
+  }
+}
+
+// points: throughput of parsing the points attributes of documents, with
+// the number parser of the loader and with the string streams it replaced
+static int benchPoints( const vector<string>& files, int repetitions ) {
+
+  vector<string> lists; size_t bytes = 0;
+  for( size_t i = 0; i < files.size(); ++i ) {
+    XMLReader xml;
+    if( !xml.Open( files[i].c_str() ) ) {
+      msg("Failed to open " << files[i]);
+      return -1;
+    }
+    collectPoints( &xml, lists );
+  }
+  for( size_t i = 0; i < lists.size(); ++i ) bytes += lists[i].size();
+
+  Timer timer;
+  vector<Vector2D> points;
+
+  size_t parsed = 0;
+  timer.start();
+  for( int r = 0; r < repetitions; ++r ) {
+    for( size_t i = 0; i < lists.size(); ++i ) {
+      points.clear();
+      const char* p = lists[i].data();
+      parsed += parsePoints( p, p + lists[i].size(), points );
+    }
+  }
+  timer.stop();
+  double parser = timer.duration();
+
+  size_t streamed = 0;
+  timer.start();
+  for( int r = 0; r < repetitions; ++r ) {
+    for( size_t i = 0; i < lists.size(); ++i ) {
+      points.clear();
+      istringstream ss ( lists[i] );
+      float x, y; char c;
+      while( ss >> x >> c >> y ) points.push_back( Vector2D( x, y ) );
+      streamed += points.size();
+    }
+  }
+  timer.stop();
+  double stream = timer.duration();
+
+  cout << lists.size() << " point lists, " << parsed / repetitions << " points, "
+       << bytes / (1 << 20) << " MB" << endl;
+  cout << "parser: " << parsed / parser / 1e6 << " M points/s ("
+       << bytes * repetitions / parser / (1 << 20) << " MB/s)" << endl;
+  cout << "stream: " << streamed / stream / 1e6 << " M points/s ("
+       << bytes * repetitions / stream / (1 << 20) << " MB/s)" << endl;
+
+  return 0;
+}
+
+// copy the png data of the images below the current element
+static void collectImages( XMLReader* xml, vector<string>& images ) {
+  int depth = xml->Depth();
+  while( xml->NextChild( depth ) ) {
+    XMLValue href = xml->Attribute( "xlink:href" );
+    if( href.begin && !strcmp( xml->Value(), "image" ) ) {
+      const char* comma = find( href.begin, href.end, ',' );
+      string encoded;
+      for( const char* p = comma + 1; p < href.end; ++p ) {
+        if( !isspace( (unsigned char) *p ) ) encoded += *p;
+      }
+      if( comma != href.end ) images.push_back( base64_decode( encoded ) );
+    }
+    collectImages( xml, images );
+  }
+}
+
+// decode: throughput of decoding the png images embedded in documents,
+// with the decoder of the loader and with lodepng
+static int benchDecode( const vector<string>& files, int repetitions ) {
+
+  vector<string> images; size_t bytes = 0;
+  for( size_t i = 0; i < files.size(); ++i ) {
+    XMLReader xml;
+    if( !xml.Open( files[i].c_str() ) ) {
+      msg("Failed to open " << files[i]);
+      return -1;
+    }
+    collectImages( &xml, images );
+  }
+  if( images.empty() ) {
+    msg("No embedded images");
+    return -1;
+  }
+
+  // decoded sizes, which both decoders have to agree on
+  size_t pixels = 0;
+  for( size_t i = 0; i < images.size(); ++i ) {
+    PNG png; vector<unsigned char> out; unsigned w, h;
+    const unsigned char* data = (const unsigned char*) images[i].data();
+    int error = PNGParser::load( data, images[i].size(), png );
+    unsigned lode_error = lodepng::decode( out, w, h, data, images[i].size() );
+    if( error || lode_error || (unsigned) png.width != w || (unsigned) png.height != h ) {
+      msg("Image " << i << " does not decode the same way (errors " << error
+          << ", " << lode_error << ")");
+      return -1;
+    }
+    bytes += images[i].size();
+    pixels += (size_t) w * h;
+  }
+
+  Timer timer;
+
+  timer.start();
+  for( int r = 0; r < repetitions; ++r ) {
+    for( size_t i = 0; i < images.size(); ++i ) {
+      PNG png;
+      PNGParser::load( (const unsigned char*) images[i].data(), images[i].size(), png );
+    }
+  }
+  timer.stop();
+  double parser = timer.duration();
+
+  timer.start();
+  for( int r = 0; r < repetitions; ++r ) {
+    for( size_t i = 0; i < images.size(); ++i ) {
+      vector<unsigned char> out; unsigned w, h;
+      lodepng::decode( out, w, h, (const unsigned char*) images[i].data(), images[i].size() );
+    }
+  }
+  timer.stop();
+  double lode = timer.duration();
+
+  double raw = pixels * 4.0 * repetitions / (1 << 20);
+  cout << images.size() << " images, " << bytes / (1 << 20) << " MB png, "
+       << pixels * 4 / (1 << 20) << " MB decoded" << endl;
+  cout << "parser:  " << raw / parser << " MB/s decoded ("
+       << bytes * repetitions / parser / (1 << 20) << " MB/s png)" << endl;
+  cout << "lodepng: " << raw / lode << " MB/s decoded ("
+       << bytes * repetitions / lode / (1 << 20) << " MB/s png)" << endl;
+
+  return 0;
+}
+
+// level of detail statistics of a list of elements drawn at the given scale
+// (screen pixels per svg unit)
+struct LODStats {
+  LODStats() : full ( 0 ), drawn ( 0 ), collapsed ( 0 ), error ( 0 ) { }
+  size_t full, drawn, collapsed;
+  float error; // largest simplification error in pixels
+};
+
+static void lodStats( const vector<SVGElement*>& elements, const Matrix3x3& m,
+                      float scale, float budget, LODStats& stats ) {
+
+  for( size_t i = 0; i < elements.size(); ++i ) {
+
+    SVGElement* element = elements[i];
+    Matrix3x3 transform = m * element->transform;
+
+    const vector<Vector2D>* points = NULL; LODChain* lod = NULL;
+    if( element->type == GROUP ) {
+      lodStats( static_cast<Group*>(element)->elements, transform, scale, budget, stats );
+    } else if( element->type == POLYLINE ) {
+      points = &static_cast<Polyline*>(element)->points;
+      lod    = &static_cast<Polyline*>(element)->lod;
+    } else if( element->type == POLYGON ) {
+      points = &static_cast<Polygon*>(element)->points;
+      lod    = &static_cast<Polygon*>(element)->lod;
+    }
+    if( !points || lod->bounds.empty() ) continue;
+    lod->build_levels( *points );
+
+    float s = scale * sqrt( fabs( transform(0,0) * transform(1,1) -
+                                  transform(0,1) * transform(1,0) ) );
+    stats.full += points->size();
+
+    // sub-pixel elements collapse into a single point
+    if( (lod->bounds.xmax - lod->bounds.xmin) * s < 1 &&
+        (lod->bounds.ymax - lod->bounds.ymin) * s < 1 ) {
+      stats.drawn += 1; stats.collapsed += 1;
+      continue;
+    }
+
+    const vector<Vector2D>* level = lod->select( budget / s );
+    if( !level ) {
+      stats.drawn += points->size();
+      continue;
+    }
+
+    stats.drawn += level->size();
+    for( size_t l = 0; l < lod->levels.size(); ++l ) {
+      if( &lod->levels[l] == level ) stats.error = max( stats.error, lod->errors[l] * s );
+    }
+  }
+}
+
+// report point reduction and error of the level of detail system at
+// decreasing zoom levels of a 600 pixel tall view, and the time the
+// levels take to build when they are first needed
+static int benchLOD( const vector<string>& files, float budget ) {
+
+  static const int zooms[] = { 1, 4, 16, 64 };
+  Timer timer;
+
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    SVG* svg = new SVG();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+
+    float span = 1.2 * max( svg->width, svg->height ) / 2;
+    for( size_t z = 0; z < sizeof(zooms) / sizeof(zooms[0]); ++z ) {
+
+      // the first pass builds the levels
+      LODStats stats;
+      timer.start();
+      lodStats( svg->elements, Matrix3x3::identity(), 300 / span / zooms[z], budget, stats );
+      timer.stop();
+      if( z == 0 ) {
+        cout << files[i] << ": levels built in " << timer.duration() * 1000 << " ms" << endl;
+      }
+
+      cout << "  zoom 1/" << zooms[z] << ": " << stats.full << " -> " << stats.drawn
+           << " points (" << (stats.full ? 100.0 * stats.drawn / stats.full : 100) << "%), "
+           << stats.collapsed << " collapsed, max error " << stats.error << " px" << endl;
+    }
+
+    delete svg;
+  }
+
+  return 0;
+}
+
+// pan: frame time of panning a zoomed in view, drawing every frame from
+// scratch and incrementally, and the pixels where the results differ
+static int benchPan( const vector<string>& files, int frames ) {
+
+  const size_t width = 800, height = 600;
+  vector<unsigned char> framebuffer( 4 * width * height );
+  vector<unsigned char> reference( 4 * width * height );
+
+  // same setup as the viewer
+  SoftwareRendererImp* renderer = new SoftwareRendererImp();
+  Sampler2DImp* sampler = new Sampler2DImp();
+  renderer->set_tex_sampler( sampler );
+  renderer->set_render_target( &framebuffer[0], width, height );
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  Timer timer;
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    SVG* svg = new SVG();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+    double time[2];
+    for( int incremental = 0; incremental < 2; ++incremental ) {
+
+      // zoom in 4x and pan diagonally by a few pixels per frame
+      ViewportImp viewport;
+      viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                            1.2 * max( svg->width, svg->height ) / 8 );
+      viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+      renderer->invalidate();
+
+      timer.start();
+      for( int f = 0; f <= frames; ++f ) {
+        Matrix3x3 m = norm_to_screen * viewport.get_svg_2_norm();
+        if( f ) viewport.update_viewbox( 5 / m(0,0), 3 / m(1,1), 1 );
+        if( !incremental ) renderer->invalidate();
+        renderer->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+        renderer->clear_target();
+        renderer->draw_svg( *svg );
+      }
+      timer.stop();
+      time[incremental] = timer.duration() / (frames + 1);
+
+      if( !incremental ) reference = framebuffer;
+    }
+
+    size_t different = 0;
+    for( size_t p = 0; p < width * height; ++p ) {
+      if( memcmp( &framebuffer[4 * p], &reference[4 * p], 4 ) ) different++;
+    }
+
+    cout << files[i] << ": full " << time[0] * 1000 << " ms/frame, "
+         << "incremental " << time[1] * 1000 << " ms/frame, "
+         << different << " pixels differ" << endl;
+
+    delete svg;
+  }
+
+  return 0;
+}
+
+// paths: points the paths of a document are flattened into, and frame time
+// with and without the flattened paths cached, from zoomed out to zoomed in
+static void pathPoints( const vector<SVGElement*>& elements, const Matrix3x3& m,
+                        float scale, size_t& commands, size_t& points ) {
+  for( size_t i = 0; i < elements.size(); ++i ) {
+    Matrix3x3 transform = m * elements[i]->transform;
+    if( elements[i]->type == GROUP ) {
+      pathPoints( static_cast<Group*>(elements[i])->elements, transform, scale, commands, points );
+    } else if( elements[i]->type == PATH ) {
+      Path* path = static_cast<Path*>(elements[i]);
+      float s = scale * sqrt( fabs( transform(0,0) * transform(1,1) -
+                                    transform(0,1) * transform(1,0) ) );
+      commands += path->data.commands.size();
+      points += path->flattened.get( path->data, s )->points.size();
+    }
+  }
+}
+
+static int benchPaths( const vector<string>& files ) {
+
+  static const float zooms[] = { 1.f / 64, 1.f / 8, 1, 8, 64 };
+
+  const size_t width = 800, height = 600;
+  vector<unsigned char> framebuffer( 4 * width * height );
+
+  SoftwareRendererImp* renderer = new SoftwareRendererImp();
+  Sampler2DImp* sampler = new Sampler2DImp();
+  renderer->set_tex_sampler( sampler );
+  renderer->set_render_target( &framebuffer[0], width, height );
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  Timer timer;
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    SVG* svg = new SVG();
+    timer.start();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+    timer.stop();
+    cout << files[i] << ": load " << timer.duration() * 1000 << " ms" << endl;
+
+    for( size_t z = 0; z < sizeof(zooms) / sizeof(zooms[0]); ++z ) {
+
+      ViewportImp viewport;
+      viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                            1.2 * max( svg->width, svg->height ) / 2 / zooms[z] );
+      viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+      Matrix3x3 svg_2_screen = norm_to_screen * viewport.get_svg_2_norm();
+      renderer->set_svg_2_screen( svg_2_screen );
+
+      // the first frame flattens the paths of its zoom bucket
+      double frame[2];
+      for( int cached = 0; cached < 2; ++cached ) {
+        renderer->invalidate();
+        renderer->clear_target();
+        timer.start();
+        renderer->draw_svg( *svg );
+        timer.stop();
+        frame[cached] = timer.duration();
+      }
+
+      size_t commands = 0, points = 0;
+      float s = sqrt( fabs( svg_2_screen(0,0) * svg_2_screen(1,1) -
+                            svg_2_screen(0,1) * svg_2_screen(1,0) ) );
+      pathPoints( svg->elements, Matrix3x3::identity(), s, commands, points );
+
+      cout << "  zoom " << zooms[z] << ": " << commands << " commands -> "
+           << points << " points, first frame " << frame[0] * 1000 << " ms, "
+           << "cached " << frame[1] * 1000 << " ms" << endl;
+    }
+
+    delete svg;
+  }
+
+  return 0;
+}
+
+// images: load time and decoded image memory of a fitted and of a zoomed
+// in view, against decoding every image with all its mip levels
+static void imageSizes( const vector<SVGElement*>& elements, size_t& count, size_t& bytes ) {
+  for( size_t i = 0; i < elements.size(); ++i ) {
+    if( elements[i]->type == GROUP ) {
+      imageSizes( static_cast<Group*>(elements[i])->elements, count, bytes );
+    } else if( elements[i]->type == IMAGE ) {
+      const Texture& tex = static_cast<Image*>(elements[i])->tex;
+      for( size_t l = 0; l < tex.mipmap.size(); ++l ) {
+        bytes += 4 * tex.mipmap[l].width * tex.mipmap[l].height;
+      }
+      count++;
+    }
+  }
+}
+
+static int benchImages( const vector<string>& files ) {
+
+  const size_t width = 960, height = 540;
+  vector<unsigned char> framebuffer( 4 * width * height );
+
+  SoftwareRendererImp* renderer = new SoftwareRendererImp();
+  Sampler2DImp* sampler = new Sampler2DImp();
+  renderer->set_tex_sampler( sampler );
+  renderer->set_render_target( &framebuffer[0], width, height );
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  ImageCache& cache = ImageCache::shared();
+  Timer timer;
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    cache.clear();
+    SVG* svg = new SVG();
+    timer.start();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+    timer.stop();
+    double load = timer.duration();
+    size_t count = 0, full = 0;
+    imageSizes( svg->elements, count, full );
+
+    // fitted view, then 8x zoomed in on the center
+    double frame[2]; size_t resident[2];
+    for( int zoom = 0; zoom < 2; ++zoom ) {
+      ViewportImp viewport;
+      viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                            1.2 * max( svg->width, svg->height ) / (zoom ? 16 : 2) );
+      viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+      renderer->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+      renderer->invalidate();
+      renderer->clear_target();
+      timer.start();
+      renderer->draw_svg( *svg );
+      timer.stop();
+      frame[zoom] = timer.duration();
+      resident[zoom] = cache.size();
+    }
+
+    cout << files[i] << ": " << count << " images, load " << load * 1000 << " ms, "
+         << "fitted " << frame[0] * 1000 << " ms (" << resident[0] / double(1 << 20) << " MB), "
+         << "zoomed " << frame[1] * 1000 << " ms (" << resident[1] / double(1 << 20) << " MB), "
+         << "all levels " << full / double(1 << 20) << " MB, "
+         << "peak RSS " << peakRSS() / 1024.0 << " MB" << endl;
+
+    delete svg;
+  }
+
+  return 0;
+}
+
+// encode: throughput and size of encoding rendered documents at each png
+// compression level, and with lodepng
+static int benchEncode( const vector<string>& files, int repetitions ) {
+
+  const size_t width = 1920, height = 1080;
+  vector<PNG> frames;
+
+  SoftwareRendererImp* renderer = new SoftwareRendererImp();
+  Sampler2DImp* sampler = new Sampler2DImp();
+  renderer->set_tex_sampler( sampler );
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    SVG* svg = new SVG();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+    frames.push_back( PNG() );
+    PNG& png = frames.back();
+    png.width = width; png.height = height;
+    png.pixels.resize( 4 * width * height );
+
+    ViewportImp viewport;
+    viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                          1.2 * max( svg->width, svg->height ) / 2 );
+    viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+    renderer->set_render_target( &png.pixels[0], width, height );
+    renderer->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+    renderer->clear_target();
+    renderer->draw_svg( *svg );
+
+    delete svg;
+  }
+
+  double raw = 4.0 * width * height * frames.size() * repetitions / (1 << 20);
+  cout << frames.size() << " frames of " << width << "x" << height << ", "
+       << ThreadPool::shared().size() << " threads" << endl;
+
+  Timer timer;
+  for( int level = -1; level <= 9; ++level ) {
+
+    size_t bytes = 0;
+    vector<unsigned char> out;
+    timer.start();
+    for( int r = 0; r < repetitions; ++r ) {
+      for( size_t i = 0; i < frames.size(); ++i ) {
+        if( level < 0 ) {
+          lodepng::encode( out, frames[i].pixels, width, height );
+        } else {
+          PNGParser::encode( frames[i], out, level );
+        }
+        bytes += out.size();
+      }
+    }
+    timer.stop();
+
+    // the output has to decode to the frame
+    for( size_t i = 0; i < frames.size(); ++i ) {
+      vector<unsigned char> png, pixels; unsigned w, h;
+      if( level < 0 ) lodepng::encode( png, frames[i].pixels, width, height );
+      else PNGParser::encode( frames[i], png, level );
+      if( lodepng::decode( pixels, w, h, png ) || pixels != frames[i].pixels ) {
+        msg("Frame " << i << " does not decode at level " << level);
+        return -1;
+      }
+    }
+
+    if( level < 0 ) cout << "lodepng: ";
+    else cout << "level " << level << ": ";
+    cout << raw / timer.duration() << " MB/s, "
+         << 100.0 * bytes / (raw * (1 << 20)) << "% of raw" << endl;
+  }
+
+  return 0;
+}
+
+// refine: time to the 1x preview and to full quality of a supersampled
+// frame refined band by band like the viewer does, against drawing it at
+// full quality at once, and the pixels where the results differ
+static int benchRefine( const vector<string>& files, size_t rate ) {
+
+  const size_t width = 800, height = 600;
+  const int rows = 32; // band height of the viewer
+  vector<unsigned char> framebuffer( 4 * width * height );
+  vector<unsigned char> reference( 4 * width * height );
+
+  SoftwareRendererImp* renderer = new SoftwareRendererImp();
+  Sampler2DImp* sampler = new Sampler2DImp();
+  renderer->set_tex_sampler( sampler );
+  renderer->set_render_target( &framebuffer[0], width, height );
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  Timer timer;
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    SVG* svg = new SVG();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+    ViewportImp viewport;
+    viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                          1.2 * max( svg->width, svg->height ) / 2 );
+    viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+    renderer->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+
+    // full quality at once
+    renderer->invalidate();
+    renderer->set_sample_rate( rate );
+    timer.start();
+    renderer->clear_target();
+    renderer->draw_svg( *svg );
+    timer.stop();
+    double direct = timer.duration();
+    reference = framebuffer;
+
+    // preview, then refinement
+    renderer->invalidate();
+    renderer->set_sample_rate( 1 );
+    timer.start();
+    renderer->clear_target();
+    renderer->draw_svg( *svg );
+    timer.stop();
+    double preview = timer.duration();
+
+    renderer->set_sample_rate( rate );
+    double first = 0;
+    timer.start();
+    for( int y = 0; y < (int) height; y += rows ) {
+      renderer->draw_rows( *svg, y, y + rows );
+      if( !y ) { timer.stop(); first = timer.duration(); timer.start(); }
+    }
+    timer.stop();
+    double refine = first + timer.duration();
+
+    size_t different = 0;
+    for( size_t p = 0; p < width * height; ++p ) {
+      if( memcmp( &framebuffer[4 * p], &reference[4 * p], 4 ) ) different++;
+    }
+
+    cout << files[i] << ": preview " << preview * 1000 << " ms, "
+         << "first band " << (preview + first) * 1000 << " ms, "
+         << "full quality " << (preview + refine) * 1000 << " ms "
+         << "(at once " << direct * 1000 << " ms), "
+         << different << " pixels differ" << endl;
+
+    delete svg;
+  }
+
+  return 0;
+}
+
+// cache: cold load through the scene cache (parse, build and write the
+// cache) against loading the cached scene, which has to render the same
+static int benchCache( const vector<string>& files, int repetitions, const string& cache_dir ) {
+
+  const size_t width = 960, height = 540;
+  Timer timer;
+  double total_cold = 0, total_warm = 0;
+
+  SoftwareRendererImp* renderer = new SoftwareRendererImp();
+  Sampler2DImp* sampler = new Sampler2DImp();
+  renderer->set_tex_sampler( sampler );
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  vector<unsigned char> frames[2];
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    string cache = SVGParser::cachePath( files[i].c_str(), cache_dir );
+    remove( cache.c_str() );
+
+    double cold = 0, warm = 0;
+    for( int r = 0; r <= repetitions; ++r ) {
+
+      SVG* svg = new SVG();
+      timer.start();
+      if( SVGParser::loadCached( files[i].c_str(), svg, cache_dir ) < 0 ) {
+        msg("Failed to load " << files[i]);
+        delete svg; return -1;
+      }
+      timer.stop();
+      if( r ) warm += timer.duration();
+      else cold = timer.duration();
+
+      // first and last load
+      if( !r || r == repetitions ) {
+        vector<unsigned char>& frame = frames[r ? 1 : 0];
+        frame.assign( 4 * width * height, 0 );
+        ViewportImp viewport;
+        viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                              1.2 * max( svg->width, svg->height ) / 2 );
+        viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+        renderer->set_render_target( &frame[0], width, height );
+        renderer->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+        renderer->clear_target();
+        renderer->draw_svg( *svg );
+      }
+
+      delete svg;
+    }
+
+    warm /= repetitions;
+    total_cold += cold; total_warm += warm;
+
+    size_t different = 0;
+    for( size_t p = 0; p < width * height; ++p ) {
+      if( memcmp( &frames[0][4 * p], &frames[1][4 * p], 4 ) ) different++;
+    }
+
+    cout << files[i] << ": cold " << cold * 1000 << " ms, "
+         << "cached " << warm * 1000 << " ms "
+         << "(" << fileSize( cache ) / double(1 << 20) << " MB cache), "
+         << different << " pixels differ" << endl;
+  }
+
+  cout << "total: cold " << total_cold * 1000 << " ms, "
+       << "cached " << total_warm * 1000 << " ms" << endl;
+
+  return 0;
+}
+
+// render: frame time of drawing each document from scratch at a set of
+// resolutions and sample rates, after a warmup frame, and the time spent in
+// each stage of the renderer, with its counters in builds with
+// DRAWSVG_INSTRUMENT. The results are also written to
+// <output>.json and <output>.csv, to track them from commit to commit
+struct RenderResult {
+  string file;
+  size_t width, height, sample_rate;
+  double mean, min; // frame time (s)
+  FrameStats stats; // per frame
+};
+
+static string jsonString( const string& s ) {
+  string out = "\"";
+  for( size_t i = 0; i < s.size(); ++i ) {
+    if( s[i] == '"' || s[i] == '\\' ) out += '\\';
+    out += s[i];
+  }
+  return out + "\"";
+}
+
+static int writeRenderResults( const vector<RenderResult>& results,
+                               int warmup, int repetitions, const string& output ) {
+
+  ofstream json( (output + ".json").c_str() );
+  ofstream csv( (output + ".csv").c_str() );
+  if( !json || !csv ) {
+    msg("Could not write " << output << ".json or " << output << ".csv");
+    return -1;
+  }
+
+  json << "{\n  \"warmup\": " << warmup << ",\n"
+       << "  \"repetitions\": " << repetitions << ",\n"
+       << "  \"runs\": [\n";
+  csv << "file,width,height,sample_rate,mean_ms,min_ms";
+  for( int k = 0; k < FrameStats::NUM_STAGES; ++k ) {
+    csv << "," << FrameStats::stage_name( k ) << "_ms";
+  }
+  csv << ",elements,triangles_emitted,triangles,lines,rects,"
+      << "samples_tested,samples_written,images,culled\n";
+  for( size_t i = 0; i < results.size(); ++i ) {
+    const RenderResult& r = results[i];
+    const FrameStats& t = r.stats;
+    json << "    { \"file\": " << jsonString( r.file )
+         << ", \"width\": " << r.width << ", \"height\": " << r.height
+         << ", \"sample_rate\": " << r.sample_rate
+         << ", \"mean_ms\": " << r.mean * 1000 << ", \"min_ms\": " << r.min * 1000
+         << ", \"stages_ms\": { ";
+    for( int k = 0; k < FrameStats::NUM_STAGES; ++k ) {
+      json << (k ? ", " : "") << "\"" << FrameStats::stage_name( k ) << "\": "
+           << t.time[k] * 1000;
+    }
+    json << " }, \"counters\": { \"elements\": " << t.elements
+         << ", \"triangles_emitted\": " << t.triangles_emitted
+         << ", \"triangles\": " << t.triangles << ", \"lines\": " << t.lines
+         << ", \"rects\": " << t.rects
+         << ", \"samples_tested\": " << t.samples_tested
+         << ", \"samples_written\": " << t.samples_written
+         << ", \"images\": " << t.images << ", \"culled\": " << t.culled << " } }"
+         << (i + 1 < results.size() ? "," : "") << "\n";
+    csv << r.file << "," << r.width << "," << r.height << "," << r.sample_rate << ","
+        << r.mean * 1000 << "," << r.min * 1000;
+    for( int k = 0; k < FrameStats::NUM_STAGES; ++k ) csv << "," << t.time[k] * 1000;
+    csv << "," << t.elements << "," << t.triangles_emitted << "," << t.triangles
+        << "," << t.lines << "," << t.rects << "," << t.samples_tested << "," << t.samples_written
+        << "," << t.images << "," << t.culled << "\n";
+  }
+  json << "  ]\n}\n";
+
+  return 0;
+}
+
+static int benchRender( const vector<string>& files, int repetitions, const string& output ) {
+
+  // the largest size fits the sample buffer at 16 samples per pixel
+  const size_t sizes[][2] = { { 800, 600 }, { 1280, 720 }, { 1600, 900 } };
+  const size_t rates[] = { 1, 2, 4 };
+  const int warmup = 1;
+
+  vector<unsigned char> framebuffer( 4 * 1600 * 900 );
+  SoftwareRendererImp* renderer = new SoftwareRendererImp();
+  Sampler2DImp* sampler = new Sampler2DImp();
+  renderer->set_tex_sampler( sampler );
+  renderer->set_profiling( true );
+
+  vector<RenderResult> results;
+  Timer timer;
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    SVG* svg = new SVG();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+
+    for( size_t s = 0; s < sizeof( sizes ) / sizeof( sizes[0] ); ++s ) {
+
+      size_t width = sizes[s][0], height = sizes[s][1];
+      Matrix3x3 norm_to_screen = Matrix3x3::identity();
+      float scale = min( width, height );
+      norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+      norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+      ViewportImp viewport;
+      viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                            1.2 * max( svg->width, svg->height ) / 2 );
+      viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+      renderer->set_render_target( &framebuffer[0], width, height );
+      renderer->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+
+      for( size_t k = 0; k < sizeof( rates ) / sizeof( rates[0] ); ++k ) {
+
+        RenderResult r;
+        r.file = files[i];
+        r.width = width; r.height = height; r.sample_rate = rates[k];
+        r.mean = 0; r.min = 0;
+        renderer->set_sample_rate( rates[k] );
+
+        for( int f = 0; f < warmup + repetitions; ++f ) {
+          if( f == warmup ) renderer->reset_frame_stats();
+          renderer->invalidate();
+          renderer->clear_target();
+          timer.start();
+          renderer->draw_svg( *svg );
+          timer.stop();
+          if( f < warmup ) continue;
+          r.mean += timer.duration();
+          r.min = f == warmup ? timer.duration() : min( r.min, timer.duration() );
+        }
+        r.mean /= repetitions;
+        r.stats = renderer->get_frame_stats();
+        for( int t = 0; t < FrameStats::NUM_STAGES; ++t ) r.stats.time[t] /= repetitions;
+        r.stats.elements /= repetitions;
+        r.stats.triangles_emitted /= repetitions;
+        r.stats.triangles /= repetitions;
+        r.stats.lines /= repetitions;
+        r.stats.rects /= repetitions;
+        r.stats.samples_tested /= repetitions;
+        r.stats.samples_written /= repetitions;
+        r.stats.images /= repetitions;
+        r.stats.culled /= repetitions;
+        results.push_back( r );
+
+        cout << files[i] << " " << width << "x" << height << " " << rates[k] * rates[k] << "x: "
+             << r.mean * 1000 << " ms/frame (min " << r.min * 1000 << ")";
+        for( int t = 0; t < FrameStats::NUM_STAGES; ++t ) {
+          cout << ", " << FrameStats::stage_name( t ) << " " << r.stats.time[t] * 1000 << " ms";
+        }
+        cout << endl;
+      }
+    }
+
+    delete svg;
+  }
+
+  return writeRenderResults( results, warmup, repetitions, output );
+}
+
+// diff: frames of the reference and the implementation, drawn at the same
+// time and compared. A heatmap of the differences is written next to each
+// file (file.svg.diff.png), and files below the minimum PSNR fail the run
+static int benchDiff( const vector<string>& files, double min_psnr ) {
+
+  const size_t width = 800, height = 600;
+  vector<unsigned char> imp( 4 * width * height ), ref( 4 * width * height );
+
+  SoftwareRendererImp* renderer_imp = new SoftwareRendererImp();
+  SoftwareRendererRef* renderer_ref = new SoftwareRendererRef();
+  renderer_imp->set_tex_sampler( new Sampler2DImp() );
+  renderer_ref->set_tex_sampler( new Sampler2DRef() );
+  renderer_imp->set_render_target( &imp[0], width, height );
+  renderer_ref->set_render_target( &ref[0], width, height );
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  ImageDiff differ;
+  Timer timer;
+  size_t failed = 0;
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    SVG* svg = new SVG();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+
+    // the reference samples textures without asking for their levels
+    ImageCache::shared().pin( *svg );
+
+    ViewportImp viewport;
+    viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                          1.2 * max( svg->width, svg->height ) / 2 );
+    viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+    renderer_imp->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+    renderer_ref->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+    renderer_imp->invalidate(); // the last document may have had this address
+    renderer_imp->clear_target();
+    renderer_ref->clear_target();
+
+    timer.start();
+    ThreadPool::TaskGroup group;
+    ThreadPool::shared().run( group, [&] { renderer_ref->draw_svg( *svg ); } );
+    renderer_imp->draw_svg( *svg );
+    ThreadPool::shared().wait( group );
+    timer.stop();
+    double draw = timer.duration();
+
+    timer.start();
+    DiffStats stats = differ.compare( &ref[0], &imp[0], width, height );
+    timer.stop();
+
+    PNG heatmap;
+    heatmap.width = width; heatmap.height = height;
+    heatmap.pixels = differ.heatmap();
+    PNGParser::save( (files[i] + ".diff.png").c_str(), heatmap, 1 );
+
+    cout << files[i] << ": " << stats.changed << " pixels differ, "
+         << "max error " << stats.max_error << ", "
+         << "PSNR " << stats.psnr << " dB, SSIM " << stats.ssim << " "
+         << "(drawn in " << draw * 1000 << " ms, "
+         << "compared in " << timer.duration() * 1000 << " ms)" << endl;
+    if( stats.psnr < min_psnr ) failed++;
+
+    delete svg;
+  }
+
+  if( failed ) {
+    msg(failed << " of " << files.size() << " files below " << min_psnr << " dB");
+    return -1;
+  }
+  return 0;
+}
+
+// occlusion: frame time of drawing each document with and without
+// occlusion culling, the number of culled elements, and whether the frames
+// are the same (files whose frames differ fail the run)
+static int benchOcclusion( const vector<string>& files, size_t rate ) {
+
+  const size_t width = 800, height = 600;
+  const int repetitions = 5;
+  vector<unsigned char> framebuffer( 4 * width * height ), full( 4 * width * height );
+
+  SoftwareRendererImp* renderer = new SoftwareRendererImp();
+  renderer->set_tex_sampler( new Sampler2DImp() );
+  renderer->set_render_target( &framebuffer[0], width, height );
+  renderer->set_sample_rate( rate );
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  Timer timer;
+  size_t failed = 0;
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    SVG* svg = new SVG();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+
+    ViewportImp viewport;
+    viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                          1.2 * max( svg->width, svg->height ) / 2 );
+    viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+    renderer->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+
+    // best of a few frames from scratch, after a warmup frame
+    double best[2];
+    for( int culling = 0; culling < 2; ++culling ) {
+      renderer->set_occlusion_culling( culling );
+      for( int f = 0; f <= repetitions; ++f ) {
+        renderer->reset_frame_stats();
+        renderer->invalidate();
+        renderer->clear_target();
+        timer.start();
+        renderer->draw_svg( *svg );
+        timer.stop();
+        if( f == 1 || (f > 1 && timer.duration() < best[culling]) ) best[culling] = timer.duration();
+      }
+      if( !culling ) full = framebuffer;
+    }
+    bool same = full == framebuffer;
+
+    cout << files[i] << ": " << renderer->get_frame_stats().culled << " of "
+         << svg->bvh.leaves.size() << " elements culled, "
+         << best[0] * 1000 << " ms without culling, "
+         << best[1] * 1000 << " ms with culling"
+         << (same ? "" : ", FRAMES DIFFER") << endl;
+    if( !same ) failed++;
+
+    delete svg;
+  }
+
+  renderer->set_occlusion_culling( false );
+  if( failed ) {
+    msg(failed << " of " << files.size() << " files are drawn differently with culling");
+    return -1;
+  }
+  return 0;
+}
+
+// heatmap: the samples written to each pixel (overdraw) or the time spent
+// drawing each 32x32 tile (cost) of every file, as a false color image
+// written next to the file (file.svg.overdraw.png or file.svg.cost.png)
+static int benchHeatmap( const vector<string>& files, bool cost, size_t rate ) {
+
+  const size_t width = 800, height = 600;
+  const int tile = 32;
+  vector<unsigned char> framebuffer( 4 * width * height );
+  vector<uint32_t> counts( width * height );
+  vector<double> seconds;
+  vector<float> values( width * height );
+
+  SoftwareRendererImp* renderer = new SoftwareRendererImp();
+  renderer->set_tex_sampler( new Sampler2DImp() );
+  renderer->set_render_target( &framebuffer[0], width, height );
+  renderer->set_sample_rate( rate );
+
+  Matrix3x3 norm_to_screen = Matrix3x3::identity();
+  float scale = min( width, height );
+  norm_to_screen(0,0) = scale; norm_to_screen(0,2) = (width  - scale) / 2;
+  norm_to_screen(1,1) = scale; norm_to_screen(1,2) = (height - scale) / 2;
+
+  string worst; double worst_mean = -1;
+  for( size_t i = 0; i < files.size(); ++i ) {
+
+    SVG* svg = new SVG();
+    if( SVGParser::load( files[i].c_str(), svg ) < 0 ) {
+      msg("Failed to load " << files[i]);
+      delete svg; return -1;
+    }
+
+    ViewportImp viewport;
+    viewport.set_viewbox( svg->width / 2, svg->height / 2,
+                          1.2 * max( svg->width, svg->height ) / 2 );
+    viewport.update_viewbox( 0, 0, 1 ); // settle the translation
+    renderer->set_svg_2_screen( norm_to_screen * viewport.get_svg_2_norm() );
+    renderer->clear_target();
+
+    double mean = 0;
+    if( cost ) {
+      // the fastest of a few frames after a warmup frame that prepares
+      // paths and images, so that a tile that was preempted stands out less
+      vector<double> fastest;
+      renderer->draw_tile_costs( *svg, tile, seconds );
+      for( int f = 0; f < 3; ++f ) {
+        renderer->draw_tile_costs( *svg, tile, seconds );
+        if( !f ) fastest = seconds;
+        for( size_t t = 0; t < seconds.size(); ++t ) fastest[t] = min( fastest[t], seconds[t] );
+      }
+      size_t columns = (width + tile - 1) / tile;
+      for( size_t y = 0; y < height; ++y ) {
+        for( size_t x = 0; x < width; ++x ) {
+          values[x + y * width] = 1000 * fastest[x / tile + y / tile * columns];
+        }
+      }
+      for( size_t t = 0; t < fastest.size(); ++t ) mean += 1000 * fastest[t];
+      mean /= fastest.size();
+    } else {
+      fill( counts.begin(), counts.end(), 0 );
+      renderer->set_overdraw( &counts[0] );
+      renderer->draw_svg( *svg );
+      renderer->set_overdraw( NULL );
+      for( size_t p = 0; p < counts.size(); ++p ) {
+        values[p] = counts[p] / (float) (rate * rate);
+        mean += values[p];
+      }
+      mean /= counts.size();
+    }
+
+    PNG heatmap;
+    heatmap.width = width; heatmap.height = height;
+    heatmap.pixels.resize( 4 * width * height );
+    float max = Heatmap::colorize( &values[0], width, height, 0, &heatmap.pixels[0] );
+    Heatmap::draw_legend( &heatmap.pixels[0], width, height );
+    PNGParser::save( (files[i] + (cost ? ".cost.png" : ".overdraw.png")).c_str(), heatmap, 1 );
+
+    if( cost ) {
+      cout << files[i] << ": " << mean << " ms per tile on average, "
+           << max << " ms at most (red)" << endl;
+    } else {
+      cout << files[i] << ": " << mean << " samples written per sample on average, "
+           << max << " at most (red)" << endl;
+    }
+    if( mean > worst_mean ) { worst_mean = mean; worst = files[i]; }
+
+    delete svg;
+  }
+
+  if( files.size() > 1 ) cout << "Most expensive: " << worst << endl;
+  return 0;
+}
+
+// diff of two png images of the same size, with the heatmap written next
+// to the second one (b.diff.png)
+static int benchDiffImages( const string& a, const string& b, double min_psnr ) {
+
+  PNG images[2];
+  const string* names[2] = { &a, &b };
+  for( int i = 0; i < 2; ++i ) {
+    if( PNGParser::load( names[i]->c_str(), images[i] ) ) {
+      msg("Failed to load " << *names[i]);
+      return -1;
+    }
+  }
+  if( images[0].width != images[1].width || images[0].height != images[1].height ) {
+    msg("Image sizes differ: " << images[0].width << "x" << images[0].height << " and "
+        << images[1].width << "x" << images[1].height);
+    return -1;
+  }
+
+  ImageDiff differ;
+  DiffStats stats = differ.compare( &images[0].pixels[0], &images[1].pixels[0],
+                                    images[0].width, images[0].height );
+
+  PNG heatmap;
+  heatmap.width = images[0].width; heatmap.height = images[0].height;
+  heatmap.pixels = differ.heatmap();
+  string name = b;
+  if( name.size() > 4 && name.substr( name.size() - 4 ) == ".png" ) name.resize( name.size() - 4 );
+  name += ".diff.png";
+  PNGParser::save( name.c_str(), heatmap, 1 );
+
+  cout << a << " vs " << b << ": " << stats.changed << " pixels differ, "
+       << "max error " << stats.max_error << ", "
+       << "PSNR " << stats.psnr << " dB, SSIM " << stats.ssim << endl;
+
+  if( stats.psnr < min_psnr ) {
+    msg("Below " << min_psnr << " dB");
+    return -1;
+  }
+  return 0;
+}
+
+int main( int argc, char** argv ) {
+
+  if( argc < 3 ) {
+    msg("Usage: drawsvg_bench <mode> <path to svg file or directory> [option]");
+    msg("Modes: load [repetitions]");
+    msg("       loadall [threads, default hardware threads]");
+    msg("       points [repetitions]");
+    msg("       decode [repetitions]");
+    msg("       encode [repetitions]");
+    msg("       cache [repetitions] [directory, default drawsvg_scene_cache]");
+    msg("       images");
+    msg("       paths");
+    msg("       lod  [budget in pixels, default 0.25]");
+    msg("       pan  [frames, default 60]");
+    msg("       refine [sample rate, default 4]");
+    msg("       render [repetitions, default 5] [output, default render]");
+    msg("       diff [minimum PSNR in dB, default none]");
+    msg("       diff <other png> [minimum PSNR in dB] (for a png path)");
+    msg("       occlusion [sample rate, default 1]");
+    msg("       overdraw [sample rate, default 1]");
+    msg("       cost [sample rate, default 1]");
+    return 1;
+  }
+
+  string mode = argv[1];
+
+  // pairs of images are compared as they are
+  string path = argv[2];
+  if( mode == "diff" && path.size() > 4 && path.substr( path.size() - 4 ) == ".png" ) {
+    if( argc < 4 ) {
+      msg("Usage: drawsvg_bench diff <png file> <other png file> [minimum PSNR]");
+      return 1;
+    }
+    double min_psnr = argc > 4 ? atof(argv[4]) : 0;
+    return benchDiffImages( path, argv[3], min_psnr ) < 0 ? 1 : 0;
+  }
+  int repetitions = argc > 3 ? max(1, atoi(argv[3])) : 1;
+
+  vector<string> files;
+  if( collectFiles( argv[2], files ) < 0 ) return 1;
+
+  if( mode == "load" ) return benchLoad( files, repetitions ) < 0 ? 1 : 0;
+  if( mode == "loadall" ) {
+    size_t threads = argc > 3 ? max(1, atoi(argv[3])) : max(1u, thread::hardware_concurrency());
+    return benchLoadAll( files, threads ) < 0 ? 1 : 0;
+  }
+  if( mode == "points" ) return benchPoints( files, repetitions ) < 0 ? 1 : 0;
+  if( mode == "decode" ) return benchDecode( files, repetitions ) < 0 ? 1 : 0;
+  if( mode == "encode" ) return benchEncode( files, repetitions ) < 0 ? 1 : 0;
+  if( mode == "images" ) return benchImages( files ) < 0 ? 1 : 0;
+  if( mode == "paths" ) return benchPaths( files ) < 0 ? 1 : 0;
+  if( mode == "cache" ) {
+    string cache_dir = argc > 4 ? argv[4] : "drawsvg_scene_cache";
+    if( SVGParser::makeCacheDir( cache_dir ) < 0 ) {
+      msg("Could not create " << cache_dir);
+      return 1;
+    }
+    return benchCache( files, repetitions, cache_dir ) < 0 ? 1 : 0;
+  }
+  if( mode == "lod" ) {
+    float budget = argc > 3 ? atof(argv[3]) : 0.25f;
+    return benchLOD( files, budget ) < 0 ? 1 : 0;
+  }
+  if( mode == "pan" ) {
+    int frames = argc > 3 ? max(1, atoi(argv[3])) : 60;
+    return benchPan( files, frames ) < 0 ? 1 : 0;
+  }
+  if( mode == "refine" ) {
+    int rate = argc > 3 ? min(4, max(1, atoi(argv[3]))) : 4;
+    return benchRefine( files, rate ) < 0 ? 1 : 0;
+  }
+  if( mode == "render" ) {
+    int frames = argc > 3 ? max(1, atoi(argv[3])) : 5;
+    string output = argc > 4 ? argv[4] : "render";
+    return benchRender( files, frames, output ) < 0 ? 1 : 0;
+  }
+  if( mode == "occlusion" ) {
+    int rate = argc > 3 ? min(4, max(1, atoi(argv[3]))) : 1;
+    return benchOcclusion( files, rate ) < 0 ? 1 : 0;
+  }
+  if( mode == "overdraw" || mode == "cost" ) {
+    int rate = argc > 3 ? min(4, max(1, atoi(argv[3]))) : 1;
+    return benchHeatmap( files, mode == "cost", rate ) < 0 ? 1 : 0;
+  }
+  if( mode == "diff" ) {
+    double min_psnr = argc > 3 ? atof(argv[3]) : 0;
+    return benchDiff( files, min_psnr ) < 0 ? 1 : 0;
+  }
+
+  msg("Unknown mode: " << mode);
+  return 1;
+}
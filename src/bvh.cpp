@@ -0,0 +1,209 @@
+#include "bvh.h"
+#include "svg.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+// maximum number of elements in a leaf node
+static const int kMaxLeafSize = 4;
+
+// expand a box by a point in element space mapped to svg space
+static void expandTransformed( BBox& box, const Matrix3x3& m, const Vector2D& p ) {
+  Vector3D u = m * Vector3D( p.x, p.y, 1.0 );
+  box.expand( u.x / u.z, u.y / u.z );
+}
+
+// expand a box by a rectangle in element space mapped to svg space
+static void expandTransformed( BBox& box, const Matrix3x3& m,
+                               const Vector2D& a, const Vector2D& b ) {
+  expandTransformed( box, m, Vector2D( a.x, a.y ) );
+  expandTransformed( box, m, Vector2D( b.x, a.y ) );
+  expandTransformed( box, m, Vector2D( a.x, b.y ) );
+  expandTransformed( box, m, Vector2D( b.x, b.y ) );
+}
+
+// svg space bounds of a non-group element
+static BBox elementBounds( const SVGElement* element, const Matrix3x3& m ) {
+
+  BBox box;
+  switch( element->type ) {
+    case POINT: {
+      const Point* point = static_cast<const Point*>(element);
+      expandTransformed( box, m, point->position );
+      break;
+    }
+    case LINE: {
+      const Line* line = static_cast<const Line*>(element);
+      expandTransformed( box, m, line->from );
+      expandTransformed( box, m, line->to );
+      break;
+    }
+    case POLYLINE: {
+      const Polyline* polyline = static_cast<const Polyline*>(element);
+      BBox local;
+      for( size_t i = 0; i < polyline->points.size(); ++i ) {
+        local.expand( polyline->points[i].x, polyline->points[i].y );
+      }
+      if( !local.empty() ) {
+        expandTransformed( box, m, Vector2D( local.xmin, local.ymin ),
+                                   Vector2D( local.xmax, local.ymax ) );
+      }
+      break;
+    }
+    case RECT: {
+      const Rect* rect = static_cast<const Rect*>(element);
+      expandTransformed( box, m, rect->position, rect->position + rect->dimension );
+      break;
+    }
+    case POLYGON: {
+      const Polygon* polygon = static_cast<const Polygon*>(element);
+      BBox local;
+      for( size_t i = 0; i < polygon->points.size(); ++i ) {
+        local.expand( polygon->points[i].x, polygon->points[i].y );
+      }
+      if( !local.empty() ) {
+        expandTransformed( box, m, Vector2D( local.xmin, local.ymin ),
+                                   Vector2D( local.xmax, local.ymax ) );
+      }
+      break;
+    }
+    case ELLIPSE: {
+      const Ellipse* ellipse = static_cast<const Ellipse*>(element);
+      expandTransformed( box, m, ellipse->center - ellipse->radius,
+                                 ellipse->center + ellipse->radius );
+      break;
+    }
+    case IMAGE: {
+      const Image* image = static_cast<const Image*>(element);
+      expandTransformed( box, m, image->position, image->position + image->dimension );
+      break;
+    }
+    case PATH: {
+      const Path* path = static_cast<const Path*>(element);
+      if( !path->bounds.empty() ) {
+        expandTransformed( box, m, Vector2D( path->bounds.xmin, path->bounds.ymin ),
+                                   Vector2D( path->bounds.xmax, path->bounds.ymax ) );
+      }
+      break;
+    }
+    default:
+      break;
+  }
+
+  return box;
+}
+
+// flatten a list of elements into leaves and groups
+static void flatten( const vector<SVGElement*>& elements, const Matrix3x3& m, int parent,
+                     vector<BVH::Leaf>& leaves, vector<BVH::GroupEntry>& groups ) {
+
+  for( size_t i = 0; i < elements.size(); ++i ) {
+
+    SVGElement* element = elements[i];
+    Matrix3x3 transform = m * element->transform;
+
+    if( element->type == GROUP ) {
+      BVH::GroupEntry entry;
+      entry.group  = static_cast<Group*>(element);
+      entry.parent = parent;
+      groups.push_back( entry );
+      flatten( entry.group->elements, transform, groups.size() - 1, leaves, groups );
+    } else {
+      BVH::Leaf leaf;
+      leaf.element = element;
+      leaf.parent  = parent;
+      leaf.bounds  = elementBounds( element, transform );
+      leaves.push_back( leaf );
+    }
+  }
+}
+
+void BVH::build( const SVG& svg ) {
+
+  leaves.clear(); groups.clear();
+  nodes.clear(); order.clear();
+
+  flatten( svg.elements, Matrix3x3::identity(), -1, leaves, groups );
+
+  order.resize( leaves.size() );
+  for( size_t i = 0; i < order.size(); ++i ) order[i] = i;
+
+  if( !leaves.empty() ) {
+    nodes.reserve( 2 * leaves.size() / kMaxLeafSize + 1 );
+    build_node( 0, leaves.size() );
+  }
+
+  built = true;
+}
+
+int BVH::build_node( int start, int end ) {
+
+  int index = nodes.size();
+  nodes.push_back( Node() );
+
+  // bounds of the node and of the element centers
+  BBox bounds, centers;
+  for( int i = start; i < end; ++i ) {
+    const BBox& b = leaves[order[i]].bounds;
+    if( b.empty() ) continue;
+    bounds.expand( b );
+    centers.expand( (b.xmin + b.xmax) / 2, (b.ymin + b.ymax) / 2 );
+  }
+  nodes[index].bounds = bounds;
+  nodes[index].start  = start;
+  nodes[index].end    = end;
+  nodes[index].right  = -1;
+
+  if( end - start <= kMaxLeafSize || centers.empty() ) return index;
+
+  // split at the median center along the longest axis
+  bool split_x = centers.xmax - centers.xmin > centers.ymax - centers.ymin;
+  int mid = (start + end) / 2;
+  const vector<Leaf>& l = leaves;
+  nth_element( order.begin() + start, order.begin() + mid, order.begin() + end,
+    [&l, split_x]( int a, int b ) {
+      return split_x ? l[a].bounds.xmin + l[a].bounds.xmax < l[b].bounds.xmin + l[b].bounds.xmax
+                     : l[a].bounds.ymin + l[a].bounds.ymax < l[b].bounds.ymin + l[b].bounds.ymax;
+    });
+
+  build_node( start, mid );
+  int right = build_node( mid, end );
+  nodes[index].right = right;
+
+  return index;
+}
+
+void BVH::query( const BBox& box, vector<int>& result ) const {
+
+  result.clear();
+  if( nodes.empty() ) return;
+
+  int stack[64]; int top = 0;
+  stack[top++] = 0;
+  while( top ) {
+
+    int index = stack[--top];
+    const Node& node = nodes[index];
+    if( !node.bounds.intersects( box ) ) continue;
+
+    // leaves of leaf nodes and of fully covered subtrees are reported
+    // without further tests
+    bool covered = box.contains( node.bounds );
+    if( covered || node.right < 0 ) {
+      for( int i = node.start; i < node.end; ++i ) {
+        if( covered || leaves[order[i]].bounds.intersects( box ) ) {
+          result.push_back( order[i] );
+        }
+      }
+    } else {
+      stack[top++] = node.right;
+      stack[top++] = index + 1;
+    }
+  }
+
+  // restore painter's order
+  sort( result.begin(), result.end() );
+}
+
+} // namespace CMU462
@@ -0,0 +1,118 @@
+#ifndef CMU462_BVH_H
+#define CMU462_BVH_H
+
+#include <vector>
+#include <cfloat>
+#include <algorithm>
+
+namespace CMU462 {
+
+struct SVG;
+struct SVGElement;
+struct Group;
+class SVGParser;
+
+/**
+ * Axis aligned bounding box.
+ */
+struct BBox {
+
+  BBox() : xmin ( FLT_MAX ), ymin ( FLT_MAX ), xmax ( -FLT_MAX ), ymax ( -FLT_MAX ) { }
+
+  BBox( float xmin, float ymin, float xmax, float ymax )
+    : xmin ( xmin ), ymin ( ymin ), xmax ( xmax ), ymax ( ymax ) { }
+
+  inline bool empty() const { return xmin > xmax || ymin > ymax; }
+
+  inline void expand( float x, float y ) {
+    xmin = std::min(xmin, x); xmax = std::max(xmax, x);
+    ymin = std::min(ymin, y); ymax = std::max(ymax, y);
+  }
+
+  inline void expand( const BBox& b ) {
+    xmin = std::min(xmin, b.xmin); xmax = std::max(xmax, b.xmax);
+    ymin = std::min(ymin, b.ymin); ymax = std::max(ymax, b.ymax);
+  }
+
+  inline bool intersects( const BBox& b ) const {
+    return xmin <= b.xmax && b.xmin <= xmax && ymin <= b.ymax && b.ymin <= ymax;
+  }
+
+  inline bool contains( const BBox& b ) const {
+    return xmin <= b.xmin && b.xmax <= xmax && ymin <= b.ymin && b.ymax <= ymax;
+  }
+
+  float xmin, ymin, xmax, ymax;
+
+};
+
+/**
+ * Bounding volume hierarchy over the elements of a svg.
+ * Groups are flattened: the hierarchy stores every non-group element with
+ * its bounds in svg space (all group transformations applied) and a link to
+ * the group it belongs to, so that renderers can rebuild the transformation
+ * stack of an element without visiting the rest of the document.
+ */
+class BVH {
+ public:
+
+  // a non-group element of the document
+  struct Leaf {
+    SVGElement* element;
+    int parent;  // index into groups, -1 for top level elements
+    BBox bounds; // svg space bounds
+  };
+
+  // a group of the document
+  struct GroupEntry {
+    Group* group;
+    int parent;  // index into groups, -1 for top level groups
+  };
+
+  BVH() : built ( false ) { }
+
+  // flatten the document and build the hierarchy
+  void build( const SVG& svg );
+
+  inline bool is_built() const { return built; }
+
+  // svg space bounds of the whole document
+  inline const BBox& bounds() const { return nodes.empty() ? empty_box : nodes[0].bounds; }
+
+  // collect the indices of the leaves intersecting the given box
+  // (in svg space). Indices are returned in document (painter's) order.
+  void query( const BBox& box, std::vector<int>& result ) const;
+
+  // document order leaves and groups
+  std::vector<Leaf> leaves;
+  std::vector<GroupEntry> groups;
+
+ private:
+
+  // restores hierarchies from binary scenes
+  friend class SVGParser;
+
+  struct Node {
+    BBox bounds;
+    int start, end; // range of leaves in order covered by the node
+    int right;      // second child (-1 for leaf nodes, first child is next)
+  };
+
+  // recursively build nodes over order[start, end)
+  int build_node( int start, int end );
+
+  bool built;
+
+  // hierarchy nodes, depth first
+  std::vector<Node> nodes;
+
+  // leaf indices, permuted so that each node covers a contiguous range
+  std::vector<int> order;
+
+  BBox empty_box;
+
+}; // class BVH
+
+} // namespace CMU462
+
+#endif // CMU462_BVH_H
@@ -1,15 +1,41 @@
 #include "drawsvg.h"
+#include "image_cache.h"
 
+#include <cmath>
+#include <cstring>
 #include <sstream>
 #include <iostream>
 #include <cstdlib>
+#include <algorithm>
 
 using namespace std;
 
 namespace CMU462 {
 
+// pixel rows refined at a time
+static const int kRefineRows = 32;
+
+// tabs addressed by the number keys
+static const size_t kTabsPerPage = 10;
+
+// size of the tiles of the cost heatmap
+static const int kCostTile = 32;
+
+// file the trace of the renderer is written to
+static const char* kTraceFile = "drawsvg_trace.json";
+
 DrawSVG::~DrawSVG() {
 
+  // stop the render worker
+  if (render_thread.joinable()) {
+    {
+      lock_guard<mutex> lock(frame_mutex);
+      quit_render = true;
+    }
+    frame_requested.notify_one();
+    render_thread.join();
+  }
+
   tabs.clear();
   viewport_imp.clear();
   viewport_ref.clear();
@@ -27,7 +53,30 @@ string DrawSVG::name() {
 
 string DrawSVG::info() {
 
-  if (show_diff) return osd;
+  lock_guard<mutex> lock(frame_mutex);
+
+  if (show_diff) {
+    stringstream diff;
+    diff << diff_stats.changed << " pixels different"
+         << " ( max error " << diff_stats.max_error
+         << ", PSNR " << diff_stats.psnr << " dB"
+         << ", SSIM " << diff_stats.ssim << ")";
+    osd = diff.str();
+    return osd;
+  }
+
+  if (heatmap != NoHeatmap && method == Software) {
+    stringstream heat; heat << fixed; heat.precision(2);
+    if (heatmap == OverdrawHeatmap) {
+      heat << "Overdraw: " << heat_mean << " samples written per sample"
+           << " ( red is " << heat_max << ")";
+    } else {
+      heat << "Cost: " << heat_mean << " ms per " << kCostTile << "x"
+           << kCostTile << " tile ( red is " << heat_max << " ms)";
+    }
+    osd = heat.str();
+    return osd;
+  }
 
   if (method == Hardware) {
     osd = "Hardware Renderer";
@@ -41,6 +90,59 @@ string DrawSVG::info() {
     if (sample_rate > 1) {
       osd += "( " + to_string(sample_rate * sample_rate) + "x SSAA)";
     }
+    if (software_renderer == software_renderer_imp) {
+      stringstream lod; lod << "( LOD " << lod_budget << " px)";
+      osd += lod_budget > 0 ? lod.str() : "( LOD off)";
+      if (occlusion_culling) osd += "( occlusion culling)";
+      if (use_tiles) {
+        stringstream tiles;
+        tiles << "( tiles: " << tile_hits << " hits, "
+              << tile_misses << " misses, "
+              << (tile_bytes >> 20) << "/"
+              << (tile_cache.get_budget() >> 20) << " MB)";
+        osd += tiles.str();
+      }
+    }
+    size_t image_bytes = ImageCache::shared().size();
+    if (image_bytes) {
+      stringstream images;
+      images << "( images: " << (image_bytes >> 20) << "/"
+             << (ImageCache::shared().get_budget() >> 20) << " MB)";
+      osd += images.str();
+    }
+    stringstream input; input << fixed; input.precision(1);
+    input << "( latency " << latency << " ms";
+    if (sample_rate > 1) input << ", full quality " << full_latency << " ms";
+    input << ")";
+    osd += input.str();
+  }
+
+  if (tabs.size() > 1) {
+    osd += "( tab " + to_string(current_tab + 1) + "/" + to_string(tabs.size()) + ")";
+  }
+
+  if (trace.is_recording()) {
+    osd += "( tracing: " + to_string(trace.size()) + " events)";
+  }
+
+  // counters of the last frame, one line each
+  if (show_stats && method == Software) {
+#ifdef DRAWSVG_INSTRUMENT
+    const FrameStats& s = frame_stats;
+    stringstream stats; stats << fixed; stats.precision(2);
+    stats << "\nelements " << s.elements << ", " << s.culled << " culled, images " << s.images
+          << "\ntriangles " << s.triangles_emitted << " emitted, "
+          << s.triangles << " rasterized, lines " << s.lines << ", rects " << s.rects
+          << "\nsamples " << s.samples_tested << " tested, "
+          << s.samples_written << " written";
+    for (int i = 0; i < FrameStats::NUM_STAGES; ++i) {
+      stats << (i ? ", " : "\n") << FrameStats::stage_name(i)
+            << " " << s.time[i] * 1000 << " ms";
+    }
+    osd += stats.str();
+#else
+    osd += "\nbuilt without DRAWSVG_INSTRUMENT";
+#endif
   }
 
   return osd;
@@ -63,8 +165,9 @@ void DrawSVG::init() {
 
   software_renderer_imp->set_tex_sampler(sampler_imp);
   software_renderer_ref->set_tex_sampler(sampler_ref);
+  software_renderer_imp->set_trace(&trace);
 
-  // generate mipmaps & set initial viewports
+  // set initial viewports
   for (size_t i = 0; i < tabs.size(); ++i) {
 
     viewport_imp.push_back(new ViewportImp());
@@ -75,17 +178,20 @@ void DrawSVG::init() {
 
     // set initial svg_2_norm for imp using ref
     viewport_imp[i]->set_svg_2_norm(viewport_ref[i]->get_svg_2_norm());
-
-    // generate mipmaps
-    regenerate_mipmap(i);
   }
 
+  // images are decoded when they are drawn, with mipmaps built by the
+  // selected sampler
+  ImageCache::shared().set_sampler(sampler);
+
   // set tab and transformation if tabs loaded
   current_tab = 0;
 
   // initial osd
   osd = "Software Renderer";
 
+  // start the render worker
+  render_thread = thread(&DrawSVG::render_loop, this);
 }
 
 void DrawSVG::render() {
@@ -95,7 +201,16 @@ void DrawSVG::render() {
   }
 
   if( method == Software ) {
-    display_pixels( &framebuffer[0] );
+
+    // present the latest finished frame
+    lock_guard<mutex> lock(frame_mutex);
+    if (new_frame) {
+      chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - presented_input_time;
+      if (answered) latency = elapsed.count();
+      if (refined) full_latency = elapsed.count();
+      new_frame = answered = refined = false;
+    }
+    display_pixels( &presented[0] );
   }
 
   if (show_zoom) {
@@ -106,11 +221,20 @@ void DrawSVG::render() {
 
 void DrawSVG::resize( size_t width, size_t height ) {
 
+  // the framebuffer is reallocated, abandon the frame in flight
+  cancel_frame = true;
+  lock_guard<mutex> render_lock(render_mutex);
+
   this->width  = width;
   this->height = height;
 
-  // resize render target
+  // resize render target and front buffer
   framebuffer.resize( 4 * width * height);
+  {
+    lock_guard<mutex> lock(frame_mutex);
+    presented.resize( 4 * width * height, 255);
+  }
+  tile_cache.clear();
   software_renderer_imp->set_render_target(&framebuffer[0], width, height);
   software_renderer_ref->set_render_target(&framebuffer[0], width, height);
 
@@ -144,6 +268,26 @@ void DrawSVG::char_event( unsigned int key ) {
       dec_sample_rate();
       break;
 
+    // toggle occlusion culling
+    case 'c': case 'C':
+      occlusion_culling = !occlusion_culling;
+      redraw();
+      break;
+
+    // toggle tile cache
+    case 't': case 'T':
+      use_tiles = !use_tiles;
+      redraw();
+      break;
+
+    // level of detail controls
+    case ']':
+      inc_lod_budget();
+      break;
+    case '[':
+      dec_lod_budget();
+      break;
+
     // switch between iml and ref renderer
     case 'r': case 'R':
       if (software_renderer == software_renderer_imp) {
@@ -183,40 +327,64 @@ void DrawSVG::char_event( unsigned int key ) {
       show_zoom = !show_zoom;
       break;
 
-    // tab selection
-    case '0':
-      setTab( 9 );
-      break;
-    case '1':
-      setTab( 0 );
-      break;
-    case '2':
-      setTab( 1 );
+    // cycle the heatmaps of overdraw and cost
+    case 'o': case 'O':
+      if (method == Software) {
+        heatmap = heatmap == NoHeatmap ? OverdrawHeatmap :
+                  heatmap == OverdrawHeatmap ? CostHeatmap : NoHeatmap;
+        redraw();
+      }
       break;
-    case '3':
-      setTab( 2 );
+
+    // toggle renderer counters
+    case 'i': case 'I':
+      show_stats = !show_stats;
+      redraw();
       break;
-    case '4':
-      setTab( 3 );
+
+    // start or stop a trace of the renderer
+    case 'p': case 'P':
+      toggle_trace();
       break;
-    case '5':
-      setTab( 4 );
+
+    // tab selection within the current page of ten tabs
+    case '1': case '2': case '3': case '4': case '5':
+    case '6': case '7': case '8': case '9': case '0': {
+      size_t slot = key == '0' ? 9 : key - '1';
+      setTab( current_tab / kTabsPerPage * kTabsPerPage + slot );
       break;
-    case '6':
-      setTab( 5 );
+    }
+
+    default:
+      return;
+  }
+}
+
+void DrawSVG::keyboard_event( int key, int event, unsigned char mods ) {
+
+  if (event != EVENT_PRESS && event != EVENT_REPEAT) return;
+  if (tabs.empty()) return;
+
+  size_t pages = (tabs.size() + kTabsPerPage - 1) / kTabsPerPage;
+  size_t page = current_tab / kTabsPerPage;
+
+  switch( key ) {
+
+    // previous / next tab
+    case KEYBOARD_LEFT:
+      if (current_tab > 0) setTab( current_tab - 1 );
       break;
-    case '7':
-      setTab( 6 );
+    case KEYBOARD_RIGHT:
+      setTab( current_tab + 1 );
       break;
-    case '8':
-      setTab( 7 );
+
+    // previous / next page of tabs, keeping the position in the page
+    case KEYBOARD_PAGE_UP:
+      if (page > 0) setTab( current_tab - kTabsPerPage );
       break;
-    case '9':
-      setTab( 8 );
+    case KEYBOARD_PAGE_DOWN:
+      if (page + 1 < pages) setTab( min(current_tab + kTabsPerPage, tabs.size() - 1) );
       break;
-
-    default:
-      return;
   }
 }
 
@@ -231,9 +399,14 @@ void DrawSVG::mouse_event(int key, int event, unsigned char mods) {
       break;
     case EVENT_RELEASE:
       switch(key) {
-        case MOUSE_LEFT:
+        case MOUSE_LEFT: {
           leftDown = false;
+          // panning frames are drawn incrementally,
+          // settle on a complete one
+          change_renderers(InvalidateSamples);
+          redraw();
           break;
+        }
       }
       break;
   }
@@ -246,11 +419,15 @@ void DrawSVG::cursor_event( float x, float y ) {
   if (leftDown) {
   
     show_diff = false;
-    float dx = (x - cursor_x) / width  * tabs[current_tab]->width;
-    float dy = (y - cursor_y) / height * tabs[current_tab]->height;
+
+    // convert the cursor offset to svg units so that the document follows
+    // the cursor and the software renderer can scroll the previous frame
+    Matrix3x3 m = norm_to_screen * viewport_imp[current_tab]->get_svg_2_norm();
+    float dx = (x - cursor_x) / m(0,0);
+    float dy = (y - cursor_y) / m(1,1);
     viewport_imp[current_tab]->update_viewbox(dx, dy, 1);
     viewport_ref[current_tab]->update_viewbox(dx, dy, 1);
-    redraw();
+    redraw(true);
   }
   
   // register new cursor location
@@ -262,12 +439,16 @@ void DrawSVG::scroll_event( float offset_x, float offset_y ) {
   // diff is disabled when zooming - it's too slow
   if (offset_x || offset_y) {
     show_diff = false;
+    // zoom by whole levels so that the view returns to exactly the
+    // same scales and cached tiles can be reused
+    zoom_offset += offset_x + offset_y;
+    int steps = (int) zoom_offset;
+    if (!steps) return;
+    zoom_offset -= steps;
     // prevent inverting axis when scrolling too fast
-    float scale = 1 + 0.05 * offset_x + 0.05 * offset_y;
-    scale = scale < 0.5 ? 0.5 : (scale > 1.5 ? 1.5 : scale); 
-    viewport_imp[current_tab]->update_viewbox(0, 0, scale);
-    viewport_ref[current_tab]->update_viewbox(0, 0, scale);
-    redraw();
+    steps = steps < -8 ? -8 : (steps > 8 ? 8 : steps);
+    set_zoom_level(current_tab, zoom_level[current_tab] + steps);
+    redraw(true);
   }
 }
 
@@ -283,16 +464,21 @@ void DrawSVG::clear( void ) {
 }
 
 void DrawSVG::newTab( SVG* svg ) {
-  if (tabs.size() < 9) {
-    tabs.push_back(svg);
-  } else {
-    fprintf(stderr, "DrawSVG can only hold up to 9 tabs");
-  }
+  tabs.push_back(svg);
 }
 
 void DrawSVG::delTab( size_t tab_index ) {
   if (tab_index < tabs.size()) {
+    // frames keep the svg they draw, the worker drops the samples and the
+    // tiles (cached by tab index) before its next frame, and unpins the
+    // images of the svg once it draws another one
     tabs.erase(tabs.begin() + tab_index);
+    viewport_imp.erase(viewport_imp.begin() + tab_index);
+    viewport_ref.erase(viewport_ref.begin() + tab_index);
+    if (tab_index < zoom_level.size()) zoom_level.erase(zoom_level.begin() + tab_index);
+    if (current_tab >= tabs.size() && current_tab > 0) current_tab--;
+    change_renderers(InvalidateSamples | ClearTiles);
+    redraw();
   }
 }
 
@@ -308,38 +494,77 @@ void DrawSVG::setTab( size_t tab_index ) {
   }
 }
 
-void DrawSVG::draw_diff() {
+bool DrawSVG::draw_diff( const FrameRequest& request ) {
 
-  // get reference output
-  software_renderer_ref->draw_svg(*tabs[current_tab]);
-  
-  // save reference output
-  vector<unsigned char> reference ( 4 * width * height );
-  memcpy(&reference[0], &framebuffer[0], 4 * width * height );
+  SVG& svg = *request.svg;
+
+  // draw the reference on the pool while the implementation draws here,
+  // band by band so that a stale frame is given up early
+  diff_reference.assign( 4 * width * height, 255 );
   memset(&framebuffer[0], 255, 4 * width * height);
+  software_renderer_ref->set_render_target(&diff_reference[0], width, height);
+  ThreadPool::TaskGroup group;
+  ThreadPool::shared().run(group, [&] { software_renderer_ref->draw_svg(svg); });
+  for (int y = 0; y < (int) height && !cancel_frame; y += kRefineRows) {
+    software_renderer_imp->draw_rows(svg, y, min(y + kRefineRows, (int) height));
+  }
+  ThreadPool::shared().wait(group);
+  software_renderer_ref->set_render_target(&framebuffer[0], width, height);
+  if (cancel_frame) return false;
+
+  // show the difference
+  DiffStats stats = differ.compare(&diff_reference[0], &framebuffer[0], width, height);
+  memcpy(&framebuffer[0], &differ.difference()[0], 4 * width * height);
 
-  // get implementation output
-  software_renderer_imp->draw_svg(*tabs[current_tab]);
+  lock_guard<mutex> lock(frame_mutex);
+  diff_stats = stats;
+  return true;
+}
 
-  // take difference and count errors
-  int errorCount = 0;
-  for( size_t i = 0; i < width * height; i++ ) {
+bool DrawSVG::draw_heatmap( const FrameRequest& request ) {
 
-    framebuffer[i*4 + 0] = abs(reference[i*4 + 0] - framebuffer[i*4 + 0]);
-    framebuffer[i*4 + 1] = abs(reference[i*4 + 1] - framebuffer[i*4 + 1]);
-    framebuffer[i*4 + 2] = abs(reference[i*4 + 2] - framebuffer[i*4 + 2]);
-    framebuffer[i*4 + 3] = 255;
+  SVG& svg = *request.svg;
+  size_t pixels = width * height;
+  heat_values.resize(pixels);
+  double total = 0;
 
-    for( int k = 0; k < 3; k++ ) {
-      if( framebuffer[i*4+k] ) {
-        errorCount++;
-        break;
+  if (request.heatmap == OverdrawHeatmap) {
+    // samples written per sample of each pixel, band by band
+    overdraw_counts.assign(pixels, 0);
+    software_renderer_imp->set_overdraw(&overdraw_counts[0]);
+    for (int y = 0; y < (int) height && !cancel_frame; y += kRefineRows) {
+      software_renderer_imp->draw_rows(svg, y, min(y + kRefineRows, (int) height));
+    }
+    software_renderer_imp->set_overdraw(NULL);
+    if (cancel_frame) return false;
+    float samples = request.sample_rate * request.sample_rate;
+    for (size_t i = 0; i < pixels; ++i) {
+      heat_values[i] = overdraw_counts[i] / samples;
+      total += heat_values[i];
+    }
+    total /= pixels;
+  } else {
+    // milliseconds of the tile of each pixel
+    software_renderer_imp->draw_tile_costs(svg, kCostTile, tile_seconds);
+    if (cancel_frame) return false;
+    size_t columns = (width + kCostTile - 1) / kCostTile;
+    for (size_t y = 0; y < height; ++y) {
+      for (size_t x = 0; x < width; ++x) {
+        heat_values[x + y * width] = 1000 * tile_seconds[x / kCostTile + y / kCostTile * columns];
       }
     }
-  
-    osd = to_string(errorCount) + " pixels different";
+    for (size_t i = 0; i < tile_seconds.size(); ++i) total += 1000 * tile_seconds[i];
+    total /= tile_seconds.size();
   }
 
+  // the scale is drawn over the heatmap
+  float max = Heatmap::colorize(&heat_values[0], width, height, 0, &framebuffer[0]);
+  Heatmap::draw_legend(&framebuffer[0], width, height);
+
+  lock_guard<mutex> lock(frame_mutex);
+  heat_max = max;
+  heat_mean = total;
+  return true;
 }
 
 void DrawSVG::draw_zoom() {
@@ -417,8 +642,6 @@ void DrawSVG::draw_zoom() {
 void DrawSVG::inc_sample_rate() {
   if (method == Software) {
     sample_rate += sample_rate < 4 ? 1 : 0;
-    software_renderer_imp->set_sample_rate(sample_rate);
-    software_renderer_ref->set_sample_rate(sample_rate);
     redraw();
   }
 }
@@ -426,50 +649,299 @@ void DrawSVG::inc_sample_rate() {
 void DrawSVG::dec_sample_rate() {
   if (method == Software) {
     sample_rate -= sample_rate > 1 ? 1 : 0;
-    software_renderer_imp->set_sample_rate(sample_rate);
-    software_renderer_ref->set_sample_rate(sample_rate);
     redraw();
   }
 }
 
-void DrawSVG::redraw() {
+void DrawSVG::inc_lod_budget() {
+  lod_budget = lod_budget > 0 ? min(lod_budget * 2, 4.f) : 0.125f;
+  redraw();
+}
+
+void DrawSVG::dec_lod_budget() {
+  lod_budget = lod_budget > 0.125f ? lod_budget / 2 : 0;
+  redraw();
+}
+
+void DrawSVG::redraw( bool interactive ) {
+
+  // software frames are drawn in the background
+  if (method == Software) {
+    request_frame(interactive);
+    return;
+  }
 
   clear();
 
   // set svg_2_screen transformation
-  Matrix3x3 m_imp = norm_to_screen * viewport_imp[current_tab]->get_svg_2_norm();
   Matrix3x3 m_ref = norm_to_screen * viewport_ref[current_tab]->get_svg_2_norm();
-  software_renderer_imp->set_svg_2_screen( m_imp ); 
-  software_renderer_ref->set_svg_2_screen( m_ref ); 
   hardware_renderer->set_svg_2_screen( m_ref );
+  hardware_renderer->draw_svg(*tabs[current_tab]);
+}
 
-  switch (method) {
+void DrawSVG::request_frame( bool interactive ) {
+
+  if (tabs.empty() || framebuffer.empty()) return;
+
+  lock_guard<mutex> lock(frame_mutex);
+
+  // a request that is still waiting answers all inputs since the first one
+  if (!frame_pending) pending.input_time = chrono::steady_clock::now();
+
+  pending.tab = current_tab;
+  pending.svg = tabs[current_tab];
+  pending.zoom_level = zoom_level[current_tab];
+  pending.show_diff = show_diff;
+  pending.heatmap = heatmap;
+  pending.sample_rate = sample_rate;
+  pending.reference = software_renderer == software_renderer_ref;
+  pending.use_tiles = use_tiles;
+  pending.show_stats = show_stats;
+  pending.lod_budget = lod_budget;
+  pending.occlusion_culling = occlusion_culling;
+  pending.sampler = sampler;
+  pending.changes = (frame_pending ? pending.changes : 0) | renderer_changes;
+  renderer_changes = 0;
+  pending.interactive = interactive;
+  pending.refine = false;
+  pending.svg_2_screen_imp = norm_to_screen * viewport_imp[current_tab]->get_svg_2_norm();
+  pending.svg_2_screen_ref = norm_to_screen * viewport_ref[current_tab]->get_svg_2_norm();
+  frame_pending = true;
+
+  // the frame in flight is stale now
+  cancel_frame = true;
+  frame_requested.notify_one();
+}
 
-    case Hardware:  
-      hardware_renderer->draw_svg(*tabs[current_tab]);
-      break;
-      
-    case Software: 
+void DrawSVG::change_renderers( unsigned changes ) {
+  lock_guard<mutex> lock(frame_mutex);
+  renderer_changes |= changes;
+}
 
-      if (show_diff) { draw_diff(); return; }
-      software_renderer->draw_svg(*tabs[current_tab]);
-      display_pixels( &framebuffer[0] );
-      break;
+void DrawSVG::stop_frames() {
 
+  // the changes of a dropped request go to the next one
+  {
+    lock_guard<mutex> lock(frame_mutex);
+    if (frame_pending) renderer_changes |= pending.changes;
+    frame_pending = refine_pending = false;
+    cancel_frame = true;
   }
+
+  // once the frame in flight is over, drop the refinement it may have
+  // asked for, and skip a request the worker took meanwhile
+  lock_guard<mutex> render_lock(render_mutex);
+  lock_guard<mutex> lock(frame_mutex);
+  refine_pending = false;
+  cancel_frame = true;
 }
 
-void DrawSVG::regenerate_mipmap(size_t tab_index) {
-  if (tab_index < tabs.size()) {
-    SVG* svg = tabs[tab_index];
-    for ( size_t i = 0; i < svg->elements.size(); ++i ) {
-  
-      SVGElement* element = svg->elements[i];
-      if (element->type == IMAGE) {
-          Texture& tex = static_cast<Image*>(element)->tex;
-          sampler->generate_mips(tex, 0);
+void DrawSVG::apply_changes( const FrameRequest& request ) {
+
+  unsigned changes = request.changes;
+  if (changes & ReloadImages) {
+    ImageCache::shared().set_sampler(request.sampler);
+    ImageCache::shared().clear();
+    pinned_svg = NULL;
+    changes |= InvalidateSamples | ClearTiles;
+  }
+
+  // both change what is drawn, the tiles of the old settings are stale
+  if (software_renderer_imp->get_lod_budget() != request.lod_budget) {
+    software_renderer_imp->set_lod_budget(request.lod_budget);
+    changes |= ClearTiles;
+  }
+  if (software_renderer_imp->get_occlusion_culling() != request.occlusion_culling) {
+    software_renderer_imp->set_occlusion_culling(request.occlusion_culling);
+    changes |= ClearTiles;
+  }
+
+  if (changes & InvalidateSamples) software_renderer_imp->invalidate();
+  if (changes & ClearTiles) tile_cache.clear();
+}
+
+void DrawSVG::render_loop() {
+
+  while (true) {
+
+    // take the latest request, or refine the last preview
+    // once input has been idle for long enough
+    FrameRequest request;
+    {
+      unique_lock<mutex> lock(frame_mutex);
+      auto ready = [this] { return frame_pending || quit_render; };
+      if (refine_pending) {
+        frame_requested.wait_until(lock, refine_time, ready);
+      } else {
+        frame_requested.wait(lock, ready);
+      }
+      if (quit_render) return;
+      if (frame_pending) {
+        request = pending;
+        frame_pending = false;
+      } else {
+        request = refine;
+      }
+      refine_pending = false;
+      cancel_frame = false;
+    }
+
+    // supersampled frames are previewed without supersampling first
+    FrameRequest draw = request;
+    bool preview = !request.refine && !request.show_diff && request.heatmap == NoHeatmap &&
+                   request.sample_rate > 1;
+    if (preview) draw.sample_rate = 1;
+
+    lock_guard<mutex> render_lock(render_mutex);
+
+    // a request that went stale while waiting for the renderers is not
+    // drawn, its changes go to the next one
+    if (cancel_frame) {
+      lock_guard<mutex> lock(frame_mutex);
+      if (frame_pending) pending.changes |= request.changes;
+      else renderer_changes |= request.changes;
+      if (!request.refine && request.input_time < pending.input_time) {
+        pending.input_time = request.input_time;
+      }
+      continue;
+    }
+
+    apply_changes(draw);
+    bool tracing = trace.is_recording();
+    software_renderer_imp->reset_frame_stats();
+    software_renderer_imp->set_profiling(draw.show_stats || tracing);
+    bool finished;
+    {
+      TraceSpan span(&trace, draw.refine ? "refine" : "frame");
+      finished = draw_frame(draw);
+    }
+    const FrameStats& stats = software_renderer_imp->get_frame_stats();
+    if (tracing) {
+      trace.counters("samples", {
+        { "tested", (double) stats.samples_tested },
+        { "written", (double) stats.samples_written } });
+      trace.counters("primitives", {
+        { "elements", (double) stats.elements },
+        { "triangles", (double) stats.triangles },
+        { "lines", (double) stats.lines },
+        { "rects", (double) stats.rects },
+        { "images", (double) stats.images },
+        { "culled", (double) stats.culled } });
+    }
+
+    lock_guard<mutex> lock(frame_mutex);
+    frame_stats = stats;
+    if (!finished) {
+      // the inputs of a cancelled frame are answered by the next one
+      if (!request.refine && request.input_time < pending.input_time) {
+        pending.input_time = request.input_time;
       }
+      continue;
+    }
+
+    // refine the preview right away, or once input is idle while
+    // the view is being dragged or zoomed
+    if (preview) {
+      refine = request;
+      refine.refine = true;
+      refine.changes = 0;
+      refine_pending = true;
+      refine_time = chrono::steady_clock::now() +
+                    chrono::milliseconds(request.interactive ? refine_delay : 0);
     }
+
+    // swap in the finished frame
+    memcpy(&presented[0], &framebuffer[0], framebuffer.size());
+    presented_input_time = request.input_time;
+    answered |= !request.refine;
+    refined |= !preview;
+    new_frame = true;
+    tile_hits = tile_cache.get_hits();
+    tile_misses = tile_cache.get_misses();
+    tile_bytes = tile_cache.size();
+  }
+}
+
+void DrawSVG::toggle_trace() {
+
+  if (!trace.is_recording()) {
+    trace.start();
+    cerr << "Tracing the renderer, press P again to stop" << endl;
+    redraw();
+    return;
+  }
+
+  trace.stop();
+  if (trace.write(kTraceFile) < 0) {
+    cerr << "Could not write the trace to " << kTraceFile << endl;
+  } else {
+    cerr << "Wrote " << trace.size() << " trace events to " << kTraceFile << endl;
+  }
+}
+
+void DrawSVG::present_rows( int y0, int y1 ) {
+  lock_guard<mutex> lock(frame_mutex);
+  memcpy(&presented[4 * y0 * width], &framebuffer[4 * y0 * width], 4 * (y1 - y0) * width);
+  new_frame = true;
+}
+
+bool DrawSVG::draw_frame( const FrameRequest& request ) {
+
+  if (render_rate != request.sample_rate) {
+    render_rate = request.sample_rate;
+    software_renderer_imp->set_sample_rate(render_rate);
+    software_renderer_ref->set_sample_rate(render_rate);
+  }
+
+  SoftwareRenderer* renderer = request.reference ? software_renderer_ref : software_renderer_imp;
+
+  // refinement draws over the preview
+  if (!request.refine) renderer->clear_target();
+  software_renderer_imp->set_svg_2_screen( request.svg_2_screen_imp );
+  software_renderer_ref->set_svg_2_screen( request.svg_2_screen_ref );
+
+  // the reference renderer samples textures without asking for their
+  // levels, only the svg it draws is pinned
+  SVG* pin = request.show_diff || request.reference ? request.svg : NULL;
+  if (pin != pinned_svg) {
+    if (pinned_svg) ImageCache::shared().unpin(*pinned_svg);
+    if (pin) ImageCache::shared().pin(*pin);
+    pinned_svg = pin;
+  }
+
+  if (request.show_diff) {
+    return draw_diff(request);
+  }
+
+  if (request.heatmap != NoHeatmap) {
+    return draw_heatmap(request);
+  }
+
+  if (request.use_tiles && !request.reference) {
+    return draw_tiles(request);
+  }
+
+  // refine band by band, showing each band as soon as it is done
+  if (request.refine && !request.reference) {
+    for (int y = 0; y < (int) height; y += kRefineRows) {
+      if (cancel_frame) return false;
+      int y1 = min(y + kRefineRows, (int) height);
+      software_renderer_imp->draw_rows(*request.svg, y, y1);
+      present_rows(y, y1);
+    }
+    return true;
+  }
+
+  // the reference renderer draws whole frames only, a frame that went
+  // stale meanwhile is not shown
+  renderer->draw_svg(*request.svg);
+  return !cancel_frame;
+}
+
+void DrawSVG::regenerate_mipmap(size_t tab_index) {
+  if (tab_index < tabs.size()) {
+    // decoded levels of all tabs are rebuilt by the new sampler as needed
+    change_renderers(ReloadImages);
   }
 }
 
@@ -480,6 +952,89 @@ void DrawSVG::auto_adjust(size_t tab_index) {
   float span = 1.2 * max(w,h) / 2;
   viewport_imp[tab_index]->set_viewbox( w / 2, h / 2, span);
   viewport_ref[tab_index]->set_viewbox( w / 2, h / 2, span);
+
+  if (zoom_level.size() <= tab_index) zoom_level.resize(tab_index + 1);
+  zoom_level[tab_index] = 0;
+}
+
+void DrawSVG::set_zoom_level(size_t tab_index, int level) {
+
+  // each level scales the view by 2^(1/16), starting from the fitted view
+  float w = tabs[tab_index]->width;
+  float h = tabs[tab_index]->height;
+  float span = 1.2 * max(w,h) / 2 * pow(2.0, level / 16.0);
+
+  Viewport* imp = viewport_imp[tab_index];
+  Viewport* ref = viewport_ref[tab_index];
+  imp->set_viewbox(imp->get_center_x(), imp->get_center_y(), span);
+  ref->set_viewbox(ref->get_center_x(), ref->get_center_y(), span);
+  zoom_level[tab_index] = level;
+}
+
+void DrawSVG::setTileBudget( size_t bytes ) {
+  tile_cache.set_budget(bytes);
+}
+
+void DrawSVG::setImageBudget( size_t bytes ) {
+  ImageCache::shared().set_budget(bytes);
+}
+
+bool DrawSVG::draw_tiles( const FrameRequest& request ) {
+
+  SVG& svg = *request.svg;
+  const int size = TileCache::kTileSize;
+
+  // the frame shows the pixel grid of the current zoom level,
+  // shifted by a whole number of pixels
+  const Matrix3x3& m = request.svg_2_screen_imp;
+  int ox = (int) floor(m(0,2) + 0.5);
+  int oy = (int) floor(m(1,2) + 0.5);
+
+  // tiles overlapping the frame
+  int tx0 = (int) floor(-ox / (float) size);
+  int ty0 = (int) floor(-oy / (float) size);
+  int tx1 = (int) floor(((int) width  - 1 - ox) / (float) size);
+  int ty1 = (int) floor(((int) height - 1 - oy) / (float) size);
+
+  for (int ty = ty0; ty <= ty1; ty++) {
+    for (int tx = tx0; tx <= tx1; tx++) {
+
+      TileCache::Key key = { request.tab, request.zoom_level, tx, ty, request.sample_rate };
+      const unsigned char* pixels = tile_cache.find(key);
+
+      // render missing tiles, giving up on stale frames (finished
+      // tiles stay in the cache for the next one)
+      if (!pixels) {
+        if (cancel_frame) {
+          software_renderer_imp->set_render_target(&framebuffer[0], width, height);
+          software_renderer_imp->set_svg_2_screen(m);
+          return false;
+        }
+        unsigned char* tile = tile_cache.insert(key);
+        Matrix3x3 t = m; t(0,2) = -tx * size; t(1,2) = -ty * size;
+        software_renderer_imp->set_render_target(tile, size, size);
+        software_renderer_imp->set_svg_2_screen(t);
+        software_renderer_imp->draw_svg(svg);
+        pixels = tile;
+      }
+
+      // copy the visible part to the framebuffer
+      int x = tx * size + ox, y = ty * size + oy;
+      int x0 = max(x, 0), x1 = min(x + size, (int) width);
+      int y0 = max(y, 0), y1 = min(y + size, (int) height);
+      for (int row = y0; row < y1; row++) {
+        memcpy(&framebuffer[4 * (row * width + x0)],
+               pixels + 4 * ((row - y) * size + x0 - x), 4 * (x1 - x0));
+      }
+
+      // show refined tiles as soon as they are done
+      if (request.refine && y0 < y1) present_rows(y0, y1);
+    }
+  }
+
+  software_renderer_imp->set_render_target(&framebuffer[0], width, height);
+  software_renderer_imp->set_svg_2_screen(m);
+  return true;
 }
 
 
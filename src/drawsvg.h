@@ -2,12 +2,21 @@
 #define CMU462_DRAWSVG_H
 
 #include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <condition_variable>
 
 #include "CMU462.h"
 #include "renderer.h"
 #include "svg.h"
 #include "hardware_renderer.h"
 #include "software_renderer.h"
+#include "tile_cache.h"
+#include "image_diff.h"
+#include "instrument.h"
+#include "heatmap.h"
 
 namespace CMU462 {
 
@@ -21,6 +30,16 @@ enum RenderMethod {
   Software
 };
 
+/**
+ * Costs the software renderer can show instead of the drawing: the
+ * samples written to each pixel, or the time spent drawing each tile.
+ */
+enum HeatmapMode {
+  NoHeatmap,
+  OverdrawHeatmap,
+  CostHeatmap
+};
+
 
 /**
  * The SVG renderer draws SVG files.
@@ -37,10 +56,30 @@ class DrawSVG : public Renderer {
   DrawSVG() : 
     leftDown (false),
     method (Software),
-    sample_rate (1),
     current_tab (0),
     show_diff (false),
     show_zoom (false),
+    zoom_offset (0),
+    heatmap (NoHeatmap),
+    heat_max (0), heat_mean (0),
+    show_stats (false),
+    use_tiles (false),
+    tile_cache (64 << 20),
+    frame_pending (false),
+    quit_render (false),
+    cancel_frame (false),
+    renderer_changes (0),
+    refine_pending (false),
+    refine_delay (150),
+    render_rate (1),
+    pinned_svg (NULL),
+    new_frame (false),
+    answered (false), refined (false),
+    latency (0), full_latency (0),
+    diff_stats (),
+    tile_hits (0), tile_misses (0), tile_bytes (0),
+    sample_rate (1),
+    lod_budget (0), occlusion_culling (false),
     norm_to_screen ( Matrix3x3::identity() )  { }
 
   /**
@@ -62,6 +101,7 @@ class DrawSVG : public Renderer {
   void resize( size_t width, size_t height );
 
   void char_event( unsigned int key );
+  void keyboard_event( int key, int event, unsigned char mods );
   void mouse_event(int key, int event, unsigned char mods);
   void cursor_event( float x, float y );
   void scroll_event( float offset_x, float offset_y );
@@ -78,6 +118,10 @@ class DrawSVG : public Renderer {
    */
   inline void setRenderMethod( RenderMethod method ) {    
     
+    // the hardware renderer draws on this thread and uses the image cache,
+    // the software renderer must be done drawing first
+    if (method == Hardware) stop_frames();
+
     this->method = method; 
     
     switch (method) {
@@ -98,7 +142,7 @@ class DrawSVG : public Renderer {
   void drawIllustration( SVG& svg );
 
   /**
-   * Load a svg into a new tab if there is one available.
+   * Load a svg into a new tab.
    */
   void newTab( SVG* svg );
 
@@ -117,6 +161,22 @@ class DrawSVG : public Renderer {
    */
   int getErrorCount( void ) const;
 
+  /**
+   * Set the memory budget (in bytes) of the tile cache.
+   */
+  void setTileBudget( size_t bytes );
+
+  /**
+   * Set the memory budget (in bytes) of decoded images.
+   */
+  void setImageBudget( size_t bytes );
+
+  /**
+   * Set how long input has to be idle (in milliseconds) before a
+   * supersampled view is refined from its preview.
+   */
+  inline void setRefineDelay( int ms ) { refine_delay = ms; }
+
  private:
 
   /* window size */
@@ -139,7 +199,7 @@ class DrawSVG : public Renderer {
 
   /* software renderer */
   SoftwareRenderer* software_renderer;
-  SoftwareRenderer* software_renderer_imp;
+  SoftwareRendererImp* software_renderer_imp;
   SoftwareRenderer* software_renderer_ref;
 
   /* texture sampler */
@@ -152,19 +212,133 @@ class DrawSVG : public Renderer {
   std::vector<Viewport*> viewport_imp;
   std::vector<Viewport*> viewport_ref;
   
-  /* diff */
+  /* diff, the reference is drawn into its own buffer while the
+   * implementation draws into the framebuffer */
   bool show_diff;
-  void draw_diff();
+  ImageDiff differ;
+  std::vector<unsigned char> diff_reference;
   
   /* zoom */
   bool show_zoom;
   void draw_zoom();
 
+  /* discrete zoom levels of the tabs and scroll offset towards the next */
+  std::vector<int> zoom_level; float zoom_offset;
+  void set_zoom_level(size_t tab_index, int level);
+
+  /* heatmap of costs, drawn by the implementation, and its scale */
+  HeatmapMode heatmap;
+  std::vector<uint32_t> overdraw_counts;
+  std::vector<double> tile_seconds;
+  std::vector<float> heat_values;
+  float heat_max, heat_mean;
+
+  /* renderer counters and stage times of the last frame, and the trace
+   * that frames are recorded into while tracing */
+  bool show_stats;
+  FrameStats frame_stats;
+  TraceRecorder trace;
+  void toggle_trace();
+
+  /* tile cache for the software renderer, off by default so that panning
+     scrolls the previous frame instead */
+  bool use_tiles;
+  TileCache tile_cache;
+
+  /* software frames are drawn by a worker thread. Input only records the
+   * view to draw, requests that pile up while a frame is being drawn are
+   * coalesced into one, and render() presents the latest finished frame.
+   * Supersampled frames are previewed at 1x first and refined band by band
+   * (or tile by tile) once input has been idle for refine_delay ms. Only
+   * the worker touches the software renderers and the tile cache: input
+   * records the settings of the next frame in its request, and the worker
+   * applies them before drawing it */
+  enum RendererChange {
+    InvalidateSamples = 1, // draw the next frame from scratch
+    ClearTiles = 2,        // the cached tiles are stale
+    ReloadImages = 4       // decode images again with the selected sampler
+  };
+  struct FrameRequest {
+    size_t tab; SVG* svg;
+    int zoom_level;
+    bool show_diff;
+    HeatmapMode heatmap;
+    size_t sample_rate;
+    bool reference;   // drawn by the reference renderer
+    bool use_tiles;
+    bool show_stats;
+    float lod_budget;
+    bool occlusion_culling;
+    Sampler2D* sampler;
+    unsigned changes; // RendererChange flags
+    bool interactive; // drag or scroll
+    bool refine;      // refinement of a preview that is on screen
+    Matrix3x3 svg_2_screen_imp;
+    Matrix3x3 svg_2_screen_ref;
+    std::chrono::steady_clock::time_point input_time; // oldest input answered
+  };
+  void request_frame( bool interactive );
+  void render_loop();
+
+  // ask the worker for RendererChange flags before the next frame
+  void change_renderers( unsigned changes );
+
+  // drop the pending request and refinement, and wait for the frame in
+  // flight to be abandoned
+  void stop_frames();
+
+  // apply the settings and changes of a request to the renderers
+  void apply_changes( const FrameRequest& request );
+
+  // copy finished rows of the framebuffer to the front buffer
+  void present_rows( int y0, int y1 );
+
+  // draw a requested frame into the framebuffer, false if it was cancelled
+  bool draw_frame( const FrameRequest& request );
+  bool draw_diff( const FrameRequest& request );
+  bool draw_heatmap( const FrameRequest& request );
+  bool draw_tiles( const FrameRequest& request );
+
+  std::thread render_thread;
+  std::mutex render_mutex; // held by the worker while drawing, and by resize
+                           // and stop_frames
+  std::mutex frame_mutex;  // guards the pending request and presented frame
+  std::condition_variable frame_requested;
+  FrameRequest pending; bool frame_pending; bool quit_render;
+  std::atomic<bool> cancel_frame;
+  unsigned renderer_changes; // for the next request
+
+  /* preview waiting for refinement */
+  FrameRequest refine; bool refine_pending;
+  std::chrono::steady_clock::time_point refine_time;
+  int refine_delay;
+
+  /* sample rate the software renderers are set to */
+  size_t render_rate;
+
+  /* svg whose images are pinned for the reference renderer, by the worker */
+  SVG* pinned_svg;
+
+  /* latest finished frame and its statistics */
+  std::vector<unsigned char> presented; bool new_frame;
+  std::chrono::steady_clock::time_point presented_input_time;
+  bool answered, refined; // first frame and full quality frame of the input
+  double latency;      // input to photon (ms)
+  double full_latency; // input to full quality photon (ms)
+  DiffStats diff_stats;
+  size_t tile_hits, tile_misses, tile_bytes;
+
   /* samples rate (sqrt(s/pix)) */
   size_t sample_rate;
   void inc_sample_rate();
   void dec_sample_rate();
 
+  /* level of detail and occlusion culling of the implementation, as
+   * requested by input */
+  float lod_budget; bool occlusion_culling;
+  void inc_lod_budget();
+  void dec_lod_budget();
+
   /* regenerate mipmap */
   void regenerate_mipmap(size_t tab_index);
 
@@ -178,11 +352,12 @@ class DrawSVG : public Renderer {
   std::vector<Matrix3x3> viewport_save_imp;
   std::vector<Matrix3x3> viewport_save_ref;
 
-  /* framebuffer for software renderer */
+  /* framebuffer for software renderer (back buffer of the worker) */
   std::vector<unsigned char> framebuffer;
 
-  // update framebuffer
-  void redraw();
+  // update framebuffer (interactive redraws are previewed without
+  // supersampling until input is idle)
+  void redraw( bool interactive = false );
 
   /* update framebuffer for software renderer */
   void display_pixels( const unsigned char* pixels ) const;
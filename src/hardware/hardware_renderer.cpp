@@ -104,6 +104,9 @@ void HardwareRenderer::draw_element( SVGElement* element ) {
     case GROUP:
       draw_group(static_cast<Group&>(*element));
       break;
+    case PATH:
+      draw_path(static_cast<Path&>(*element));
+      break;
     default:
       break;
   }
@@ -211,6 +214,46 @@ void HardwareRenderer::draw_polygon( Polygon& polygon ) {
   }
 }
 
+void HardwareRenderer::draw_path( Path& path ) {
+
+  // flattened for the current scale
+  float scale = sqrt( fabs( transformation(0,0) * transformation(1,1) -
+                            transformation(0,1) * transformation(1,0) ) );
+  shared_ptr<const FlatPath> flat = path.flattened.get( path.data, scale );
+  const vector<Vector2D>& points = flat->points;
+
+  size_t first = 0;
+  for( size_t c = 0; c < flat->ends.size(); first = flat->ends[c++] ) {
+
+    vector<Vector2D> contour( points.begin() + first, points.begin() + flat->ends[c] );
+
+    // draw fill, a contour at a time (holes are filled over)
+    Color color = path.style.fillColor;
+    if( color.a != 0 ) {
+      vector<Vector2D> triangles;
+      triangulate( contour, triangles );
+      for (size_t i = 0; i < triangles.size(); i += 3) {
+        Vector2D p0 = transform(triangles[i + 0]);
+        Vector2D p1 = transform(triangles[i + 1]);
+        Vector2D p2 = transform(triangles[i + 2]);
+        rasterize_triangle( p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, color );
+      }
+    }
+
+    // draw outline
+    color = path.style.strokeColor;
+    if( color.a != 0 ) {
+      int nPoints = contour.size();
+      int nLines = flat->closed[c] ? nPoints : nPoints - 1;
+      for( int i = 0; i < nLines; i++ ) {
+        Vector2D p0 = transform(contour[(i+0) % nPoints]);
+        Vector2D p1 = transform(contour[(i+1) % nPoints]);
+        rasterize_line( p0.x, p0.y, p1.x, p1.y, color );
+      }
+    }
+  }
+}
+
 void HardwareRenderer::draw_ellipse( Ellipse& ellipse ) {
 
   // TODO
@@ -222,6 +265,8 @@ void HardwareRenderer::draw_image( Image& image ) {
   Vector2D p0 = transform(image.position);
   Vector2D p1 = transform(image.position + image.dimension);
 
+  // the full resolution image is uploaded
+  ImageCache::shared().require( image, 0, 0 );
   rasterize_image( p0.x, p0.y, p1.x, p1.y, image.tex );
 }
 
@@ -68,6 +68,9 @@ class HardwareRenderer : public SVGRenderer {
   // Draw a group
   void draw_group( Group& group );
 
+  // Draw a path
+  void draw_path( Path& path );
+
   // Rasterization //
 
   // rasterize a point
@@ -0,0 +1,81 @@
+#include "heatmap.h"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+// size of the legend and its margin to the edges of the image
+static const size_t kLegendHeight = 12;
+static const size_t kLegendMargin = 16;
+
+// colors of 256 levels, 0 is black and the others ramp from blue over
+// cyan, green and yellow to red
+struct HeatColors {
+  HeatColors() {
+    static const float stops[5][3] = {
+      { 0, 0, 255 }, { 0, 255, 255 }, { 0, 255, 0 }, { 255, 255, 0 }, { 255, 0, 0 }
+    };
+    memset( colors, 0, sizeof( colors ) );
+    colors[0][3] = 255;
+    for( int l = 1; l < 256; ++l ) {
+      float t = l / 255.f * 4;
+      int i = min( (int) t, 3 ); t -= i;
+      for( int k = 0; k < 3; ++k ) {
+        colors[l][k] = (unsigned char) (stops[i][k] + t * (stops[i + 1][k] - stops[i][k]) + 0.5f);
+      }
+      colors[l][3] = 255;
+    }
+  }
+  unsigned char colors[256][4];
+};
+
+const unsigned char* Heatmap::color( float t ) {
+  static const HeatColors ramp;
+  if( !(t > 0) ) return ramp.colors[0];
+  return ramp.colors[max( 1, min( 255, (int) (t * 255 + 0.5f) ) )];
+}
+
+float Heatmap::colorize( const float* values, size_t width, size_t height,
+                         float max, unsigned char* pixels ) {
+
+  size_t n = width * height;
+  if( max <= 0 ) {
+    for( size_t i = 0; i < n; ++i ) max = std::max( max, values[i] );
+  }
+
+  float scale = max > 0 ? 1 / max : 0;
+  for( size_t i = 0; i < n; ++i ) {
+    memcpy( pixels + 4 * i, color( values[i] * scale ), 4 );
+  }
+  return max;
+}
+
+void Heatmap::draw_legend( unsigned char* pixels, size_t width, size_t height ) {
+
+  if( width < 2 * kLegendMargin + 2 || height < kLegendHeight + kLegendMargin + 6 ) return;
+
+  // the ramp inside a white frame, with ticks at every quarter
+  size_t x0 = kLegendMargin, x1 = width - kLegendMargin;
+  size_t y0 = height - kLegendMargin - kLegendHeight, y1 = height - kLegendMargin;
+  for( size_t y = y0 - 1; y <= y1; ++y ) {
+    for( size_t x = x0 - 1; x <= x1; ++x ) {
+      unsigned char* p = pixels + 4 * (x + y * width);
+      if( y < y0 || y == y1 || x < x0 || x == x1 ) {
+        memset( p, 255, 4 );
+      } else {
+        memcpy( p, color( (x - x0 + 1) / (float) (x1 - x0) ), 4 );
+      }
+    }
+  }
+  for( size_t k = 0; k <= 4; ++k ) {
+    size_t x = x0 - 1 + k * (x1 - x0 + 1) / 4;
+    for( size_t y = y0 - 5; y < y0 - 1; ++y ) {
+      memset( pixels + 4 * (x + y * width), 255, 4 );
+    }
+  }
+}
+
+} // namespace CMU462
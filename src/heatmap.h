@@ -0,0 +1,33 @@
+#ifndef CMU462_HEATMAP_H
+#define CMU462_HEATMAP_H
+
+#include <cstddef>
+
+namespace CMU462 {
+
+/**
+ * False color images of costs, such as the samples written to each pixel
+ * or the time spent drawing each tile. Values are colored from black for
+ * none over blue for small values to red for the largest one, and a
+ * legend of the color scale can be drawn along the bottom edge.
+ */
+class Heatmap {
+ public:
+
+  // RGBA color of a value scaled to [0, 1], black only for 0
+  static const unsigned char* color( float t );
+
+  // color width x height values into RGBA pixels, scaled so that max is
+  // red (0 for the largest value). Returns the value that is red.
+  static float colorize( const float* values, size_t width, size_t height,
+                         float max, unsigned char* pixels );
+
+  // draw the color scale from 0 (left) to the largest value (right)
+  // along the bottom of an RGBA image
+  static void draw_legend( unsigned char* pixels, size_t width, size_t height );
+
+}; // class Heatmap
+
+} // namespace CMU462
+
+#endif // CMU462_HEATMAP_H
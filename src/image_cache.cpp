@@ -0,0 +1,226 @@
+#include "image_cache.h"
+#include "svg.h"
+#include "png.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+void ImageCache::init_texture( Texture& tex, size_t width, size_t height ) {
+
+  tex.width = width;
+  tex.height = height;
+  tex.mipmap.clear();
+  if( !width || !height ) return;
+
+  // the levels Sampler2DImp::generate_mips builds
+  int sublevels = min( (int) log2f( (float) max( width, height ) ), kMaxMipLevels - 1 );
+  tex.mipmap.resize( sublevels + 1 );
+  for( int i = 0; i <= sublevels; ++i ) {
+    tex.mipmap[i].width = width;
+    tex.mipmap[i].height = height;
+    width = max( (size_t) 1, width / 2 );
+    height = max( (size_t) 1, height / 2 );
+  }
+}
+
+void ImageCache::require( Image& image, int first, int last ) {
+
+  // images without compressed data are fully resident
+  if( image.data.empty() ) return;
+
+  first = max( first, 0 );
+  last = min( last, (int) image.tex.mipmap.size() - 1 );
+  if( first > last ) return;
+
+  unique_lock<std::mutex> lock( mutex );
+  load( image, first, last, false, lock );
+  evict( last - first + 1 );
+}
+
+void ImageCache::pin( SVG& svg ) {
+
+  unique_lock<std::mutex> lock( mutex );
+  pin( svg.elements, lock );
+  evict( 0 );
+}
+
+void ImageCache::pin( const vector<SVGElement*>& elements, unique_lock<std::mutex>& lock ) {
+
+  for( size_t i = 0; i < elements.size(); ++i ) {
+    if( elements[i]->type == GROUP ) {
+      pin( static_cast<Group*>(elements[i])->elements, lock );
+    } else if( elements[i]->type == IMAGE ) {
+      Image& image = *static_cast<Image*>(elements[i]);
+      if( !image.data.empty() && !image.tex.mipmap.empty() ) {
+        load( image, 0, image.tex.mipmap.size() - 1, true, lock );
+      }
+    }
+  }
+}
+
+void ImageCache::unpin( SVG& svg ) {
+
+  lock_guard<std::mutex> lock( mutex );
+  unpin( svg.elements );
+  evict( 0 );
+}
+
+void ImageCache::unpin( const vector<SVGElement*>& elements ) {
+
+  for( size_t i = 0; i < elements.size(); ++i ) {
+    if( elements[i]->type == GROUP ) {
+      unpin( static_cast<Group*>(elements[i])->elements );
+    } else if( elements[i]->type == IMAGE ) {
+      Image& image = *static_cast<Image*>(elements[i]);
+      for( size_t l = 0; l < image.tex.mipmap.size(); ++l ) {
+        Key key = { &image, (int) l };
+        unordered_map<Key, list<Level>::iterator, KeyHash>::iterator it = index.find( key );
+        if( it != index.end() ) it->second->pinned = false;
+      }
+    }
+  }
+}
+
+void ImageCache::forget( Image& image ) {
+
+  lock_guard<std::mutex> lock( mutex );
+  for( size_t i = 0; i < image.tex.mipmap.size(); ++i ) {
+    Key key = { &image, (int) i };
+    unordered_map<Key, list<Level>::iterator, KeyHash>::iterator it = index.find( key );
+    if( it != index.end() ) drop( it->second );
+  }
+  broken.erase( &image );
+}
+
+void ImageCache::clear() {
+
+  lock_guard<std::mutex> lock( mutex );
+  ++clears;
+  for( list<Level>::iterator it = levels.begin(); it != levels.end(); ) {
+    it = drop( it );
+  }
+}
+
+void ImageCache::set_sampler( Sampler2D* sampler ) {
+  lock_guard<std::mutex> lock( mutex );
+  this->sampler = sampler;
+}
+
+void ImageCache::set_budget( size_t bytes ) {
+  lock_guard<std::mutex> lock( mutex );
+  budget = bytes;
+  evict( 0 );
+}
+
+ImageCache& ImageCache::shared() {
+  // never destroyed, images may outlive it at exit
+  static ImageCache* cache = new ImageCache( kDefaultBudget );
+  return *cache;
+}
+
+// decode the png of an image into the levels of a texture, building the
+// levels above the first with a sampler if one is given, false if the
+// image can not be decoded
+static bool decode( const Image& image, Sampler2D* sampler, Texture& decoded ) {
+
+  decoded.mipmap.clear();
+  PNG png;
+  if( PNGParser::load( image.data.data(), image.data.size(), png ) ||
+      png.width != (int) image.tex.width || png.height != (int) image.tex.height ) {
+    return false;
+  }
+  decoded.width = image.tex.width;
+  decoded.height = image.tex.height;
+  decoded.mipmap.resize( 1 );
+  decoded.mipmap[0].width = decoded.width;
+  decoded.mipmap[0].height = decoded.height;
+  decoded.mipmap[0].texels.swap( png.pixels );
+  if( sampler ) sampler->generate_mips( decoded, 0 );
+  return true;
+}
+
+bool ImageCache::touch( Image& image, int first, int last, bool pinned ) {
+
+  bool resident = true;
+  for( int i = first; i <= last; ++i ) {
+    Key key = { &image, i };
+    unordered_map<Key, list<Level>::iterator, KeyHash>::iterator it = index.find( key );
+    if( it == index.end() ) {
+      resident = false;
+      continue;
+    }
+    levels.splice( levels.begin(), levels, it->second );
+    it->second->pinned |= pinned;
+  }
+  return resident;
+}
+
+void ImageCache::load( Image& image, int first, int last, bool pinned,
+                       unique_lock<std::mutex>& lock ) {
+
+  if( touch( image, first, last, pinned ) ) return;
+
+  // decode the image and build its levels without the lock (images
+  // that can not be decoded are left blank for good)
+  static Sampler2DImp* fallback = new Sampler2DImp(); // never destroyed
+  Texture decoded;
+  while( !broken.count( &image ) ) {
+    size_t generation = clears;
+    Sampler2D* mips = last > 0 ? (sampler ? sampler : fallback) : NULL;
+    lock.unlock();
+    bool ok = decode( image, mips, decoded );
+    lock.lock();
+    if( !ok ) broken.insert( &image );
+    if( generation == clears ) break;
+  }
+
+  // keep the requested levels, unless another thread decoded them meanwhile
+  Texture& tex = image.tex;
+  for( int i = first; i <= last; ++i ) {
+    MipLevel& level = tex.mipmap[i];
+    Key key = { &image, i };
+    unordered_map<Key, list<Level>::iterator, KeyHash>::iterator it = index.find( key );
+    if( it != index.end() ) {
+      levels.splice( levels.begin(), levels, it->second );
+      it->second->pinned |= pinned;
+      continue;
+    }
+    if( i < (int) decoded.mipmap.size() &&
+        decoded.mipmap[i].texels.size() == 4 * level.width * level.height ) {
+      level.texels.swap( decoded.mipmap[i].texels );
+    } else {
+      level.texels.assign( 4 * level.width * level.height, 0 );
+    }
+
+    Level entry = { key, level.texels.size(), pinned };
+    levels.push_front( entry );
+    index[key] = levels.begin();
+    bytes += entry.bytes;
+  }
+}
+
+void ImageCache::evict( size_t n ) {
+
+  // from the least recently used level, skipping pinned ones
+  list<Level>::iterator it = levels.end();
+  size_t remaining = levels.size();
+  while( bytes > budget && remaining > n ) {
+    --it; --remaining;
+    if( !it->pinned ) it = drop( it );
+  }
+}
+
+list<ImageCache::Level>::iterator ImageCache::drop( list<Level>::iterator level ) {
+
+  MipLevel& mip = level->key.image->tex.mipmap[level->key.level];
+  vector<unsigned char>().swap( mip.texels );
+  bytes -= level->bytes;
+  index.erase( level->key );
+  return levels.erase( level );
+}
+
+} // namespace CMU462
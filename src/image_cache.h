@@ -0,0 +1,134 @@
+#ifndef CMU462_IMAGE_CACHE_H
+#define CMU462_IMAGE_CACHE_H
+
+#include <list>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "texture.h"
+
+namespace CMU462 {
+
+struct SVG;
+struct Image;
+struct SVGElement;
+
+/**
+ * Least recently used cache of decoded images.
+ * Images keep their compressed (png) data, and their textures have a full
+ * chain of mip levels with sizes but without texels. Levels are decoded
+ * when a renderer first samples them, and only the levels that are sampled
+ * are kept: when the cache is over its budget, the levels that have not
+ * been used for the longest time are dropped, to be decoded again when
+ * they are needed. Images are decoded without holding the lock of the
+ * cache, so that decodes run in parallel and do not block other users.
+ */
+class ImageCache {
+ public:
+
+  static const size_t kDefaultBudget = 256 << 20;
+
+  ImageCache( size_t budget ) : budget ( budget ), bytes ( 0 ), sampler ( NULL ),
+                                clears ( 0 ) { }
+
+  // set up the levels of a texture of the given size, without texels
+  static void init_texture( Texture& tex, size_t width, size_t height );
+
+  // make levels [first, last] of an image resident (levels out of range
+  // are ignored). They stay resident at least until the next call.
+  void require( Image& image, int first, int last );
+
+  // make all levels of the images of a svg resident and keep them until
+  // they are unpinned or the cache is cleared, for renderers that sample
+  // textures without asking
+  void pin( SVG& svg );
+
+  // let the levels of the images of a svg be evicted again
+  void unpin( SVG& svg );
+
+  // drop the levels of an image that is destroyed
+  void forget( Image& image );
+
+  // drop all levels (after changes to how they are built)
+  void clear();
+
+  // sampler building the mip levels above the first
+  // (a Sampler2DImp if none is set, the cache does not own it)
+  void set_sampler( Sampler2D* sampler );
+
+  // memory budget in bytes (the levels of the last request are always kept)
+  void set_budget( size_t bytes );
+  inline size_t get_budget() const { return budget; }
+
+  // bytes of resident levels (without waiting for decodes)
+  inline size_t size() const { return bytes; }
+
+  // cache shared by the application
+  static ImageCache& shared();
+
+ private:
+
+  struct Key {
+    Image* image;
+    int level;
+
+    bool operator==( const Key& k ) const {
+      return image == k.image && level == k.level;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()( const Key& k ) const {
+      return std::hash<Image*>()( k.image ) * 31 + k.level;
+    }
+  };
+
+  struct Level {
+    Key key;
+    size_t bytes;
+    bool pinned;
+  };
+
+  // decode the missing levels of [first, last] and mark all of them used,
+  // releasing the lock while decoding
+  void load( Image& image, int first, int last, bool pinned,
+             std::unique_lock<std::mutex>& lock );
+
+  // mark the resident levels of [first, last] used, false if some are missing
+  bool touch( Image& image, int first, int last, bool pinned );
+
+  void pin( const std::vector<SVGElement*>& elements,
+            std::unique_lock<std::mutex>& lock );
+  void unpin( const std::vector<SVGElement*>& elements );
+
+  // drop least recently used levels until the cache is within its budget,
+  // keeping the first n
+  void evict( size_t n );
+
+  // drop a level, returns the next one
+  std::list<Level>::iterator drop( std::list<Level>::iterator level );
+
+  size_t budget;
+  std::atomic<size_t> bytes;
+  Sampler2D* sampler;
+
+  // number of clears, decodes that overlap one are redone
+  size_t clears;
+
+  // images that can not be decoded, their levels are left blank
+  std::unordered_set<Image*> broken;
+
+  // most recently used first
+  std::list<Level> levels;
+  std::unordered_map<Key, std::list<Level>::iterator, KeyHash> index;
+  std::mutex mutex;
+
+}; // class ImageCache
+
+} // namespace CMU462
+
+#endif // CMU462_IMAGE_CACHE_H
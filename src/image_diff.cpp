@@ -0,0 +1,225 @@
+#include "image_diff.h"
+#include "heatmap.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+// rows compared per task, a multiple of the window step
+static const size_t kBandRows = 32;
+
+// SSIM windows and the constants of the metric for 8 bit channels
+static const size_t kWindowSize = 8;
+static const size_t kWindowStep = 4;
+static const double kSSIMC1 = (0.01 * 255) * (0.01 * 255);
+static const double kSSIMC2 = (0.03 * 255) * (0.03 * 255);
+
+// colors of the heatmap by channel error, the error scale is a square root
+// so that off by one pixels are visible
+struct ErrorColors {
+  ErrorColors() {
+    for( int e = 0; e < 256; ++e ) {
+      memcpy( colors[e], Heatmap::color( sqrtf( e / 255.f ) ), 4 );
+    }
+  }
+  unsigned char colors[256][4];
+};
+
+static inline int luma( const unsigned char* p ) {
+  return (77 * p[0] + 150 * p[1] + 29 * p[2] + 128) >> 8;
+}
+
+#ifdef __SSE2__
+
+// luma of 4 pixels, same weights as luma()
+static inline void storeLuma( unsigned char* out, __m128i pixels ) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i weights = _mm_setr_epi16( 77, 150, 29, 0, 77, 150, 29, 0 );
+
+  // r*77 + g*150 and b*29 of each pixel, added up in the even lanes
+  __m128i lo = _mm_madd_epi16( _mm_unpacklo_epi8( pixels, zero ), weights );
+  __m128i hi = _mm_madd_epi16( _mm_unpackhi_epi8( pixels, zero ), weights );
+  lo = _mm_shuffle_epi32( _mm_add_epi32( lo, _mm_srli_epi64( lo, 32 ) ), _MM_SHUFFLE(3,1,2,0) );
+  hi = _mm_shuffle_epi32( _mm_add_epi32( hi, _mm_srli_epi64( hi, 32 ) ), _MM_SHUFFLE(3,1,2,0) );
+  __m128i l = _mm_unpacklo_epi64( lo, hi );
+  l = _mm_srli_epi32( _mm_add_epi32( l, _mm_set1_epi32( 128 ) ), 8 );
+  l = _mm_packs_epi32( l, l );
+  int x = _mm_cvtsi128_si32( _mm_packus_epi16( l, l ) );
+  memcpy( out, &x, 4 );
+}
+
+static inline uint32_t sum32( __m128i v ) {
+  uint32_t s[4];
+  _mm_storeu_si128( (__m128i*) s, v );
+  return s[0] + s[1] + s[2] + s[3];
+}
+
+#endif
+
+const DiffStats& ImageDiff::compare( const unsigned char* a, const unsigned char* b,
+                                     size_t width, size_t height ) {
+
+  this->width = width;
+  this->height = height;
+  diff.resize( 4 * width * height );
+  heat.resize( 4 * width * height );
+  luma_a.resize( width * height );
+  luma_b.resize( width * height );
+
+  // differences first, windows need the luma of the rows below their band
+  size_t n = width ? (height + kBandRows - 1) / kBandRows : 0;
+  bands.assign( n, Band() );
+  pool.parallel_for( n, [&]( size_t i ) {
+    compare_rows( a, b, i * kBandRows, min( height, (i + 1) * kBandRows ), bands[i] );
+  });
+  pool.parallel_for( n, [&]( size_t i ) {
+    compare_windows( i * kBandRows, min( height, (i + 1) * kBandRows ), bands[i] );
+  });
+
+  Band total = Band();
+  for( size_t i = 0; i < n; ++i ) {
+    total.changed += bands[i].changed;
+    total.max_error = max( total.max_error, bands[i].max_error );
+    total.sse += bands[i].sse;
+    total.ssim += bands[i].ssim;
+    total.windows += bands[i].windows;
+  }
+
+  result.changed = total.changed;
+  result.max_error = total.max_error;
+  result.mse = width && height ? total.sse / (3.0 * width * height) : 0;
+  result.psnr = total.sse ? 10 * log10( 255.0 * 255.0 / result.mse ) : INFINITY;
+  result.ssim = total.windows ? total.ssim / total.windows : (total.sse ? 0 : 1);
+  return result;
+}
+
+void ImageDiff::compare_rows( const unsigned char* a, const unsigned char* b,
+                              size_t y0, size_t y1, Band& band ) {
+
+  static const ErrorColors ramp;
+
+  for( size_t y = y0; y < y1; ++y ) {
+
+    const unsigned char* pa = a + 4 * y * width;
+    const unsigned char* pb = b + 4 * y * width;
+    unsigned char* pd = &diff[4 * y * width];
+    unsigned char* la = &luma_a[y * width];
+    unsigned char* lb = &luma_b[y * width];
+    size_t x = 0;
+
+#ifdef __SSE2__
+    // 4 pixels at a time, squared errors are summed in 32 bits for at most
+    // 1024 steps before they are added up
+    static const int kZeroBits[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i color = _mm_set1_epi32( 0x00FFFFFF );
+    const __m128i opaque = _mm_set1_epi32( (int) 0xFF000000 );
+    __m128i largest = zero;
+    size_t simd_end = width & ~(size_t) 3;
+    while( x < simd_end ) {
+      size_t end = min( simd_end, x + 4 * 1024 );
+      __m128i sse = zero;
+      for( ; x < end; x += 4 ) {
+        __m128i va = _mm_loadu_si128( (const __m128i*) (pa + 4 * x) );
+        __m128i vb = _mm_loadu_si128( (const __m128i*) (pb + 4 * x) );
+        __m128i d = _mm_sub_epi8( _mm_max_epu8( va, vb ), _mm_min_epu8( va, vb ) );
+        d = _mm_and_si128( d, color );
+        _mm_storeu_si128( (__m128i*) (pd + 4 * x), _mm_or_si128( d, opaque ) );
+
+        largest = _mm_max_epu8( largest, d );
+        int equal = _mm_movemask_ps( _mm_castsi128_ps( _mm_cmpeq_epi32( d, zero ) ) );
+        band.changed += 4 - kZeroBits[equal];
+        __m128i lo = _mm_unpacklo_epi8( d, zero ), hi = _mm_unpackhi_epi8( d, zero );
+        sse = _mm_add_epi32( sse, _mm_add_epi32( _mm_madd_epi16( lo, lo ),
+                                                 _mm_madd_epi16( hi, hi ) ) );
+        storeLuma( la + x, va );
+        storeLuma( lb + x, vb );
+      }
+      band.sse += sum32( sse );
+    }
+    unsigned char bytes[16];
+    _mm_storeu_si128( (__m128i*) bytes, largest );
+    band.max_error = max( band.max_error, (int) *max_element( bytes, bytes + 16 ) );
+#endif
+
+    for( ; x < width; ++x ) {
+      bool changed = false;
+      for( int k = 0; k < 3; ++k ) {
+        int d = abs( pa[4 * x + k] - pb[4 * x + k] );
+        pd[4 * x + k] = d;
+        band.sse += d * d;
+        band.max_error = max( band.max_error, d );
+        changed |= d != 0;
+      }
+      pd[4 * x + 3] = 255;
+      band.changed += changed;
+      la[x] = luma( pa + 4 * x );
+      lb[x] = luma( pb + 4 * x );
+    }
+
+    // heatmap by the largest channel error
+    unsigned char* ph = &heat[4 * y * width];
+    for( x = 0; x < width; ++x ) {
+      int e = max( pd[4 * x], max( pd[4 * x + 1], pd[4 * x + 2] ) );
+      memcpy( ph + 4 * x, ramp.colors[e], 4 );
+    }
+  }
+}
+
+void ImageDiff::compare_windows( size_t y0, size_t y1, Band& band ) {
+
+  if( width < kWindowSize ) return;
+
+  for( size_t y = y0; y < y1 && y + kWindowSize <= height; y += kWindowStep ) {
+    for( size_t x = 0; x + kWindowSize <= width; x += kWindowStep ) {
+
+      // sums of the window, and of the squares and products
+      uint32_t sa = 0, sb = 0, saa = 0, sbb = 0, sab = 0;
+#ifdef __SSE2__
+      const __m128i zero = _mm_setzero_si128();
+      __m128i va = zero, vb = zero, vaa = zero, vbb = zero, vab = zero;
+      for( size_t r = 0; r < kWindowSize; ++r ) {
+        __m128i ra = _mm_loadl_epi64( (const __m128i*) &luma_a[(y + r) * width + x] );
+        __m128i rb = _mm_loadl_epi64( (const __m128i*) &luma_b[(y + r) * width + x] );
+        va = _mm_add_epi32( va, _mm_sad_epu8( ra, zero ) );
+        vb = _mm_add_epi32( vb, _mm_sad_epu8( rb, zero ) );
+        ra = _mm_unpacklo_epi8( ra, zero );
+        rb = _mm_unpacklo_epi8( rb, zero );
+        vaa = _mm_add_epi32( vaa, _mm_madd_epi16( ra, ra ) );
+        vbb = _mm_add_epi32( vbb, _mm_madd_epi16( rb, rb ) );
+        vab = _mm_add_epi32( vab, _mm_madd_epi16( ra, rb ) );
+      }
+      sa = _mm_cvtsi128_si32( va );
+      sb = _mm_cvtsi128_si32( vb );
+      saa = sum32( vaa ); sbb = sum32( vbb ); sab = sum32( vab );
+#else
+      for( size_t r = 0; r < kWindowSize; ++r ) {
+        const unsigned char* ra = &luma_a[(y + r) * width + x];
+        const unsigned char* rb = &luma_b[(y + r) * width + x];
+        for( size_t c = 0; c < kWindowSize; ++c ) {
+          sa += ra[c]; sb += rb[c];
+          saa += ra[c] * ra[c]; sbb += rb[c] * rb[c]; sab += ra[c] * rb[c];
+        }
+      }
+#endif
+
+      double n = kWindowSize * kWindowSize;
+      double ma = sa / n, mb = sb / n;
+      double var_a = saa / n - ma * ma, var_b = sbb / n - mb * mb;
+      double cov = sab / n - ma * mb;
+      band.ssim += (2 * ma * mb + kSSIMC1) * (2 * cov + kSSIMC2) /
+                   ((ma * ma + mb * mb + kSSIMC1) * (var_a + var_b + kSSIMC2));
+      band.windows++;
+    }
+  }
+}
+
+} // namespace CMU462
@@ -0,0 +1,73 @@
+#ifndef CMU462_IMAGE_DIFF_H
+#define CMU462_IMAGE_DIFF_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#include "thread_pool.h"
+
+namespace CMU462 {
+
+// how far two images are apart
+struct DiffStats {
+  size_t changed;  // pixels with a different color
+  int max_error;   // largest difference of a color channel
+  double mse;      // mean squared error of the color channels
+  double psnr;     // peak signal to noise ratio in dB, infinite when equal
+  double ssim;     // mean structural similarity of the luma
+};
+
+/**
+ * Compares RGBA images of the same size, such as the frames of the
+ * reference and the student renderer.
+ * Rows are compared in bands on a thread pool, 16 bytes at a time where
+ * SSE2 is available. Alpha is ignored. SSIM is the mean over 8x8 windows
+ * of the luma, placed every 4 pixels, and images smaller than a window
+ * score 1 when they are equal and 0 otherwise. The buffers are kept
+ * between calls, so comparing frames of the same size does not allocate.
+ */
+class ImageDiff {
+ public:
+
+  ImageDiff( ThreadPool& pool = ThreadPool::shared() ) : pool ( pool ) { }
+
+  // compare two images of width x height pixels
+  const DiffStats& compare( const unsigned char* a, const unsigned char* b,
+                            size_t width, size_t height );
+
+  // statistics of the last comparison
+  inline const DiffStats& stats() const { return result; }
+
+  // absolute difference of each color channel, opaque
+  inline const std::vector<unsigned char>& difference() const { return diff; }
+
+  // largest channel difference of each pixel, from black (equal) over
+  // blue for small errors to red, opaque
+  inline const std::vector<unsigned char>& heatmap() const { return heat; }
+
+ private:
+
+  // partial sums of a band of rows
+  struct Band {
+    size_t changed; int max_error; uint64_t sse;
+    double ssim; size_t windows;
+  };
+
+  void compare_rows( const unsigned char* a, const unsigned char* b,
+                     size_t y0, size_t y1, Band& band );
+  void compare_windows( size_t y0, size_t y1, Band& band );
+
+  ThreadPool& pool;
+  size_t width, height;
+
+  DiffStats result;
+  std::vector<unsigned char> diff, heat;
+  std::vector<unsigned char> luma_a, luma_b;
+  std::vector<Band> bands;
+
+}; // class ImageDiff
+
+} // namespace CMU462
+
+#endif // CMU462_IMAGE_DIFF_H
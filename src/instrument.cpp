@@ -0,0 +1,101 @@
+#include "instrument.h"
+
+#include <fstream>
+
+using namespace std;
+
+namespace CMU462 {
+
+const char* FrameStats::stage_name( int stage ) {
+  static const char* names[NUM_STAGES] = {
+    "traversal", "triangulation", "rasterization", "resolve"
+  };
+  return stage >= 0 && stage < NUM_STAGES ? names[stage] : "";
+}
+
+void TraceRecorder::start() {
+  lock_guard<std::mutex> lock( mutex );
+  events.clear();
+  origin = chrono::steady_clock::now();
+  recording = true;
+}
+
+void TraceRecorder::stop() {
+  recording = false;
+}
+
+void TraceRecorder::span( const char* name, Time start ) {
+
+  Time end = chrono::steady_clock::now();
+  if( !recording ) return;
+
+  lock_guard<std::mutex> lock( mutex );
+  Event event;
+  event.phase = 'X';
+  event.name = name;
+  event.ts = chrono::duration<double, micro>( start - origin ).count();
+  event.dur = chrono::duration<double, micro>( end - start ).count();
+  event.tid = thread_id();
+  events.push_back( event );
+}
+
+void TraceRecorder::counters( const char* name,
+                              const vector< pair<const char*, double> >& values ) {
+
+  if( !recording ) return;
+
+  lock_guard<std::mutex> lock( mutex );
+  Event event;
+  event.phase = 'C';
+  event.name = name;
+  event.ts = chrono::duration<double, micro>( chrono::steady_clock::now() - origin ).count();
+  event.dur = 0;
+  event.tid = thread_id();
+  event.args = values;
+  events.push_back( event );
+}
+
+int TraceRecorder::write( const char* filename ) {
+
+  lock_guard<std::mutex> lock( mutex );
+  ofstream out( filename );
+  if( !out ) return -1;
+
+  // names are string literals of the renderer, they need no escaping,
+  // times are kept to the nanosecond over long recordings
+  out << fixed;
+  out.precision( 3 );
+  out << "{\"traceEvents\":[\n";
+  for( size_t i = 0; i < events.size(); ++i ) {
+    const Event& e = events[i];
+    out << "{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase << "\","
+        << "\"ts\":" << e.ts << ",\"pid\":1,\"tid\":" << e.tid;
+    if( e.phase == 'X' ) out << ",\"dur\":" << e.dur;
+    if( !e.args.empty() ) {
+      out << ",\"args\":{";
+      for( size_t k = 0; k < e.args.size(); ++k ) {
+        out << (k ? "," : "") << "\"" << e.args[k].first << "\":" << e.args[k].second;
+      }
+      out << "}";
+    }
+    out << "}" << (i + 1 < events.size() ? ",\n" : "\n");
+  }
+  out << "],\"displayTimeUnit\":\"ms\"}\n";
+
+  return out ? 0 : -1;
+}
+
+size_t TraceRecorder::size() {
+  lock_guard<std::mutex> lock( mutex );
+  return events.size();
+}
+
+int TraceRecorder::thread_id() {
+  unordered_map<thread::id, int>::iterator it = threads.find( this_thread::get_id() );
+  if( it != threads.end() ) return it->second;
+  int id = threads.size() + 1;
+  threads[this_thread::get_id()] = id;
+  return id;
+}
+
+} // namespace CMU462
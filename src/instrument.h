@@ -0,0 +1,140 @@
+#ifndef CMU462_INSTRUMENT_H
+#define CMU462_INSTRUMENT_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <utility>
+#include <unordered_map>
+
+// Statements that only exist in builds with DRAWSVG_INSTRUMENT, so that
+// the counters and timers of the renderer cost nothing without it.
+#ifdef DRAWSVG_INSTRUMENT
+#define INSTRUMENT( ... ) __VA_ARGS__
+#else
+#define INSTRUMENT( ... )
+#endif
+
+namespace CMU462 {
+
+/**
+ * What drawing frames took: time per stage and counts of the work done.
+ * Traversal is visiting elements and anything the other stages do not
+ * cover, triangulation includes flattening paths and resolve includes
+ * clearing and scrolling samples.
+ */
+struct FrameStats {
+
+  enum Stage { TRAVERSAL, TRIANGULATION, RASTERIZATION, RESOLVE, NUM_STAGES };
+
+  FrameStats() : elements ( 0 ), triangles_emitted ( 0 ), triangles ( 0 ),
+                 lines ( 0 ), rects ( 0 ), samples_tested ( 0 ),
+                 samples_written ( 0 ), images ( 0 ), culled ( 0 ) {
+    for( int i = 0; i < NUM_STAGES; ++i ) time[i] = 0;
+  }
+
+  double time[NUM_STAGES]; // seconds
+
+  size_t elements;           // elements visited (groups included)
+  size_t triangles_emitted;  // by triangulating polygons
+  size_t triangles;          // rasterized
+  size_t lines;              // rasterized
+  size_t rects;              // axis aligned, filled without triangles
+  size_t samples_tested;     // coverage tests of single samples
+  size_t samples_written;
+  size_t images;             // images sampled
+  size_t culled;             // elements hidden by occlusion culling
+
+  static const char* stage_name( int stage );
+
+}; // struct FrameStats
+
+/**
+ * Records events in the Chrome trace event format, to be viewed in
+ * chrome://tracing or Perfetto. Spans are complete events on the thread
+ * that recorded them, counters are counter events. Events are only kept
+ * while recording, and all methods can be called from any thread.
+ */
+class TraceRecorder {
+ public:
+
+  typedef std::chrono::steady_clock::time_point Time;
+
+  TraceRecorder() : origin ( std::chrono::steady_clock::now() ), recording ( false ) { }
+
+  // start recording, dropping the events of an earlier recording
+  void start();
+  void stop();
+  inline bool is_recording() const { return recording; }
+
+  // a span from start until now
+  void span( const char* name, Time start );
+
+  // named values at the current time
+  void counters( const char* name,
+                 const std::vector< std::pair<const char*, double> >& values );
+
+  // write the recorded events as a json trace, 0 on success
+  int write( const char* filename );
+
+  // number of recorded events
+  size_t size();
+
+ private:
+
+  struct Event {
+    char phase; const char* name;
+    double ts, dur; // microseconds
+    int tid;
+    std::vector< std::pair<const char*, double> > args;
+  };
+
+  // small id of the calling thread, mutex held
+  int thread_id();
+
+  Time origin;
+  std::atomic<bool> recording;
+  std::vector<Event> events;
+  std::unordered_map<std::thread::id, int> threads;
+  std::mutex mutex;
+
+}; // class TraceRecorder
+
+/**
+ * Adds the time of a scope to a stage, while profiling is on.
+ */
+struct StageTimer {
+  StageTimer( bool profiling, double& stage ) : stage ( profiling ? &stage : NULL ) {
+    if( this->stage ) start = std::chrono::steady_clock::now();
+  }
+  ~StageTimer() {
+    if( stage ) {
+      *stage += std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    }
+  }
+  double* stage;
+  std::chrono::steady_clock::time_point start;
+};
+
+/**
+ * Records the scope as a span of a trace, if the trace is recording.
+ */
+struct TraceSpan {
+  TraceSpan( TraceRecorder* trace, const char* name )
+    : trace ( trace && trace->is_recording() ? trace : NULL ), name ( name ) {
+    if( this->trace ) start = std::chrono::steady_clock::now();
+  }
+  ~TraceSpan() {
+    if( trace ) trace->span( name, start );
+  }
+  TraceRecorder* trace; const char* name;
+  TraceRecorder::Time start;
+};
+
+} // namespace CMU462
+
+#endif // CMU462_INSTRUMENT_H
@@ -0,0 +1,167 @@
+#include "lod.h"
+
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+namespace CMU462 {
+
+// point arrays shorter than this are always drawn at full detail
+static const size_t kMinLODPoints = 32;
+
+// levels must drop at least this fraction of the points of the previous one
+static const float kMinLODReduction = 0.75f;
+
+// distance between p and the segment ab
+static double segmentDistance( const Vector2D& p, const Vector2D& a, const Vector2D& b ) {
+  Vector2D ab = b - a; Vector2D ap = p - a;
+  double len2 = dot( ab, ab );
+  double t = len2 > 0 ? dot( ap, ab ) / len2 : 0;
+  t = t < 0 ? 0 : (t > 1 ? 1 : t);
+  return (ap - ab * t).norm();
+}
+
+// Douglas-Peucker over points[first, last] (inclusive), marking kept points
+static double simplifyRange( const vector<Vector2D>& points, size_t first, size_t last,
+                             double tolerance, vector<bool>& keep ) {
+
+  double error = 0;
+  vector< pair<size_t, size_t> > stack;
+  stack.push_back( make_pair( first, last ) );
+
+  while( !stack.empty() ) {
+
+    size_t a = stack.back().first, b = stack.back().second;
+    stack.pop_back();
+
+    // farthest point from the segment
+    double dmax = 0; size_t imax = a;
+    for( size_t i = a + 1; i < b; ++i ) {
+      double d = segmentDistance( points[i], points[a], points[b] );
+      if( d > dmax ) { dmax = d; imax = i; }
+    }
+
+    if( dmax > tolerance ) {
+      keep[imax] = true;
+      stack.push_back( make_pair( a, imax ) );
+      stack.push_back( make_pair( imax, b ) );
+    } else {
+      error = max( error, dmax );
+    }
+  }
+
+  return error;
+}
+
+float simplify( const vector<Vector2D>& points, float tolerance,
+                bool closed, vector<Vector2D>& result ) {
+
+  result.clear();
+  size_t n = points.size();
+  if( n < 3 ) {
+    result = points;
+    return 0;
+  }
+
+  vector<bool> keep( n + 1, false );
+  double error = 0;
+
+  if( !closed ) {
+
+    keep[0] = keep[n - 1] = true;
+    error = simplifyRange( points, 0, n - 1, tolerance, keep );
+
+  } else {
+
+    // split the loop at the point farthest from the first one and
+    // simplify both halves, closing the loop with a copy of the first point
+    size_t split = 0; double dmax = 0;
+    for( size_t i = 1; i < n; ++i ) {
+      double d = (points[i] - points[0]).norm();
+      if( d > dmax ) { dmax = d; split = i; }
+    }
+    if( split == 0 ) {
+      result.push_back( points[0] );
+      return 0;
+    }
+
+    vector<Vector2D> loop( points );
+    loop.push_back( points[0] );
+
+    keep[0] = keep[split] = true;
+    error = max( simplifyRange( loop, 0, split, tolerance, keep ),
+                 simplifyRange( loop, split, n, tolerance, keep ) );
+  }
+
+  for( size_t i = 0; i < n; ++i ) {
+    if( keep[i] ) result.push_back( points[i] );
+  }
+
+  return error;
+}
+
+void LODChain::measure( const vector<Vector2D>& points, bool closed ) {
+
+  levels.clear(); errors.clear();
+  bounds = BBox(); length = 0; area = 0;
+  this->closed = closed;
+  built = false;
+
+  size_t n = points.size();
+  for( size_t i = 0; i < n; ++i ) {
+    bounds.expand( points[i].x, points[i].y );
+  }
+  for( size_t i = 0; i + 1 < n; ++i ) {
+    length += (points[i + 1] - points[i]).norm();
+  }
+  if( closed && n > 2 ) {
+    length += (points[0] - points[n - 1]).norm();
+    double a = 0;
+    for( size_t p = n - 1, q = 0; q < n; p = q++ ) {
+      a += points[p].x * points[q].y - points[q].x * points[p].y;
+    }
+    area = fabs( a ) / 2;
+  }
+}
+
+void LODChain::build_levels( const vector<Vector2D>& points ) {
+
+  if( built ) return;
+  built = true;
+
+  size_t n = points.size();
+  if( n < kMinLODPoints ) return;
+
+  // tolerances double from 1/4096th of the diagonal up to the diagonal,
+  // keeping only the levels that significantly reduce the point count
+  float diagonal = hypot( bounds.xmax - bounds.xmin, bounds.ymax - bounds.ymin );
+  size_t minimum = closed ? 3 : 2;
+  size_t previous = n;
+  vector<Vector2D> simplified;
+  for( float tolerance = diagonal / 4096; tolerance < diagonal; tolerance *= 2 ) {
+
+    float error = simplify( points, tolerance, closed, simplified );
+    if( simplified.size() < minimum ) break;
+    if( simplified.size() > previous * kMinLODReduction ) continue;
+
+    levels.push_back( simplified );
+    errors.push_back( error );
+    previous = simplified.size();
+    if( previous == minimum ) break;
+  }
+}
+
+void LODChain::build( const vector<Vector2D>& points, bool closed ) {
+  measure( points, closed );
+  build_levels( points );
+}
+
+const vector<Vector2D>* LODChain::select( float tolerance ) const {
+  for( size_t i = levels.size(); i > 0; --i ) {
+    if( errors[i - 1] <= tolerance ) return &levels[i - 1];
+  }
+  return NULL;
+}
+
+} // namespace CMU462
@@ -0,0 +1,66 @@
+#ifndef CMU462_LOD_H
+#define CMU462_LOD_H
+
+#include <vector>
+
+#include "vector2D.h"
+#include "bvh.h"
+
+namespace CMU462 {
+
+/**
+ * Simplifies a point array with the Douglas-Peucker algorithm. Closed
+ * arrays (polygons) are simplified as a loop. Returns the largest distance
+ * between a dropped point and the simplified outline, which never exceeds
+ * the given tolerance.
+ */
+float simplify( const std::vector<Vector2D>& points, float tolerance,
+                bool closed, std::vector<Vector2D>& result );
+
+/**
+ * Level of detail chain of a point array.
+ * Holds copies of the point array simplified at geometrically increasing
+ * tolerances, from fine to coarse, along with the measured error of each
+ * level against full detail. All quantities are in element space.
+ * Documents are only measured when they are loaded, the levels are built
+ * when a renderer with a level of detail budget first draws them.
+ */
+struct LODChain {
+
+  LODChain() : length ( 0 ), area ( 0 ), closed ( false ), built ( false ) { }
+
+  // measure the bounds, length and area of a point array, without levels
+  void measure( const std::vector<Vector2D>& points, bool closed );
+
+  // build the levels of the measured point array unless they are built
+  // (arrays that are too short to benefit from simplification get none)
+  void build_levels( const std::vector<Vector2D>& points );
+
+  // measure and build the levels at once
+  void build( const std::vector<Vector2D>& points, bool closed );
+
+  inline bool is_built() const { return built; }
+
+  // coarsest level whose error is within tolerance, NULL if the
+  // full detail array is required
+  const std::vector<Vector2D>* select( float tolerance ) const;
+
+  // simplified levels and their errors
+  std::vector< std::vector<Vector2D> > levels;
+  std::vector<float> errors;
+
+  // bounds, outline length and enclosed area (closed arrays) of
+  // the full detail array
+  BBox bounds;
+  float length;
+  float area;
+
+  // the array is simplified as a loop, and its levels are built
+  bool closed;
+  bool built;
+
+}; // struct LODChain
+
+} // namespace CMU462
+
+#endif // CMU462_LOD_H
@@ -1,21 +1,34 @@
 #include "CMU462.h"
 #include "viewer.h"
 #include "drawsvg.h"
+#include "thread_pool.h"
 
 #include <sys/stat.h>
 #include <dirent.h>
+#include <string>
+#include <vector>
+#include <cstdlib>
 #include <iostream>
+#include <algorithm>
 
 using namespace std;
 using namespace CMU462;
 
 #define msg(s) cerr << "[DrawSVG] " << s << endl;
 
+// directory scenes are cached in, none unless --scene-cache is given
+static string scene_cache;
+
+int loadSVG( const char* path, SVG* svg ) {
+  if( scene_cache.empty() ) return SVGParser::load( path, svg );
+  return SVGParser::loadCached( path, svg, scene_cache );
+}
+
 int loadFile( DrawSVG* drawsvg, const char* path ) {
 
   SVG* svg = new SVG();
 
-  if( SVGParser::load( path, svg ) < 0) {
+  if( loadSVG( path, svg ) < 0) {
     delete svg;
     return -1;
   }
@@ -29,27 +42,43 @@ int loadDirectory( DrawSVG* drawsvg, const char* path ) {
   DIR *dir = opendir (path);
   if(dir) {
     
-    struct dirent *ent; size_t n = 0;
+    struct dirent *ent;
     
-    // load files
+    // collect files, sorted by name
     string pathname = path; 
-    if (pathname[pathname.back()] != '/') pathname.push_back('/');
-    while (((ent = readdir (dir)) != NULL) && (n < 9)) {
+    if (pathname.back() != '/') pathname.push_back('/');
+    vector<string> filenames;
+    while ((ent = readdir (dir)) != NULL) {
 
       string filename = ent->d_name;
       string filesufx = filename.substr(filename.find_last_of(".") + 1);
-      if (filesufx == "svg" ) {
-        cerr << "[DrawSVG] Loading " << filename << "... "; 
-        if (loadFile(drawsvg, (pathname + filename).c_str()) < 0) {
-          cerr << "Failed (Invalid SVG file)" << endl;
-        } else {
-          cerr << "Succeeded" << endl;
-          n++;
-        }
-      }
+      if (filesufx == "svg" ) filenames.push_back(filename);
     }
 
     closedir (dir);
+    sort(filenames.begin(), filenames.end());
+
+    // parse files concurrently
+    vector<SVG*> svgs (filenames.size(), NULL);
+    ThreadPool::shared().parallel_for(filenames.size(), [&](size_t i) {
+      SVG* svg = new SVG();
+      if (loadSVG((pathname + filenames[i]).c_str(), svg) < 0) {
+        delete svg;
+      } else {
+        svgs[i] = svg;
+      }
+    });
+
+    // add tabs in filename order
+    size_t n = 0;
+    for (size_t i = 0; i < filenames.size(); ++i) {
+      if (svgs[i]) {
+        drawsvg->newTab(svgs[i]);
+        n++;
+      } else {
+        msg("Failed to load " << filenames[i] << " (Invalid SVG file)");
+      }
+    }
 
     if (n) {
       msg("Successfully Loaded " << n << " files from " << path);
@@ -99,11 +128,34 @@ int main( int argc, char** argv ) {
   // set drawsvg as renderer
   viewer.set_renderer(drawsvg);
 
+  // options
+  int arg = 1;
+  while( arg + 2 < argc ) {
+    string option = argv[arg];
+    if( option == "--tile-budget" ) {
+      drawsvg->setTileBudget( (size_t) max(0, atoi(argv[arg + 1])) << 20 );
+    } else if( option == "--image-budget" ) {
+      drawsvg->setImageBudget( (size_t) max(0, atoi(argv[arg + 1])) << 20 );
+    } else if( option == "--refine-delay" ) {
+      drawsvg->setRefineDelay( max(0, atoi(argv[arg + 1])) );
+    } else if( option == "--scene-cache" ) {
+      scene_cache = argv[arg + 1];
+      if( SVGParser::makeCacheDir( scene_cache ) < 0 ) {
+        msg("Could not create the scene cache " << scene_cache);
+      }
+    } else {
+      break;
+    }
+    arg += 2;
+  }
+
   // load tests
-  if( argc == 2 ) {
-    if (loadPath(drawsvg, argv[1]) < 0) exit(0);
+  if( argc == arg + 1 ) {
+    if (loadPath(drawsvg, argv[arg]) < 0) exit(0);
   } else {
-    msg("Usage: drawsvg <path to test file or directory>"); exit(0);
+    msg("Usage: drawsvg [--tile-budget <megabytes>] [--image-budget <megabytes>] "
+        "[--refine-delay <milliseconds>] [--scene-cache <directory>] "
+        "<path to test file or directory>"); exit(0);
   }
 
   // init viewer
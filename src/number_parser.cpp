@@ -0,0 +1,129 @@
+#include "number_parser.h"
+
+#include <string>
+#include <algorithm>
+#include <cstdlib>
+#include <stdint.h>
+
+using namespace std;
+
+namespace CMU462 {
+
+// Powers of ten that are exact in single precision. A mantissa below 2^24
+// scaled by one of them takes a single correctly rounded operation, which
+// gives the same result as strtof.
+static const float kPow10[] = {
+  1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f
+};
+static const int kMaxPow10 = 10;
+static const uint64_t kMaxExactMantissa = 1 << 24;
+
+// digits beyond this are not accumulated (the value is read by strtof then)
+static const uint64_t kMaxMantissa = 100000000000000000ULL;
+
+static inline bool isSpace( char c ) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static inline bool isDigit( char c ) {
+  return c >= '0' && c <= '9';
+}
+
+bool parseNumber( const char*& p, const char* end, float& value ) {
+
+  const char* s = p;
+  while( s < end && isSpace( *s ) ) s++;
+  const char* start = s;
+
+  bool negative = false;
+  if( s < end && (*s == '+' || *s == '-') ) negative = *s++ == '-';
+
+  // significant digits and decimal exponent
+  uint64_t mantissa = 0; int exponent = 0; bool digits = false;
+  for( ; s < end && isDigit( *s ); s++ ) {
+    digits = true;
+    if( mantissa < kMaxMantissa ) mantissa = mantissa * 10 + (*s - '0');
+    else exponent++;
+  }
+  if( s < end && *s == '.' ) {
+    for( s++; s < end && isDigit( *s ); s++ ) {
+      digits = true;
+      if( mantissa < kMaxMantissa ) {
+        mantissa = mantissa * 10 + (*s - '0');
+        exponent--;
+      }
+    }
+  }
+  if( !digits ) return false;
+
+  // the exponent is only part of the number if it has digits ("2em")
+  if( s < end && (*s == 'e' || *s == 'E') ) {
+    const char* e = s + 1;
+    bool negative_exponent = false;
+    if( e < end && (*e == '+' || *e == '-') ) negative_exponent = *e++ == '-';
+    if( e < end && isDigit( *e ) ) {
+      int n = 0;
+      for( ; e < end && isDigit( *e ); e++ ) {
+        if( n < 100000 ) n = n * 10 + (*e - '0');
+      }
+      exponent += negative_exponent ? -n : n;
+      s = e;
+    }
+  }
+
+  float v;
+  if( mantissa <= kMaxExactMantissa && exponent >= -kMaxPow10 && exponent <= kMaxPow10 ) {
+    v = exponent < 0 ? (float) mantissa / kPow10[-exponent]
+                     : (float) mantissa * kPow10[exponent];
+    if( negative ) v = -v;
+  } else {
+    // rare: long mantissas and large exponents are left to strtof on a
+    // terminated copy of the number
+    char buffer[64]; string copy;
+    const char* text = buffer;
+    if( s - start < (ptrdiff_t) sizeof(buffer) ) {
+      std::copy( start, s, buffer );
+      buffer[s - start] = '\0';
+    } else {
+      copy.assign( start, s );
+      text = copy.c_str();
+    }
+    v = strtof( text, NULL );
+  }
+
+  value = v;
+  p = s;
+  return true;
+}
+
+void skipSeparator( const char*& p, const char* end ) {
+  while( p < end && isSpace( *p ) ) p++;
+  if( p < end && *p == ',' ) p++;
+  while( p < end && isSpace( *p ) ) p++;
+}
+
+size_t parseNumbers( const char*& p, const char* end, float* values, size_t n ) {
+  size_t count = 0;
+  while( count < n && parseNumber( p, end, values[count] ) ) {
+    count++;
+    skipSeparator( p, end );
+  }
+  return count;
+}
+
+size_t parsePoints( const char* p, const char* end, vector<Vector2D>& points ) {
+
+  size_t count = 0;
+  float x, y;
+  while( parseNumber( p, end, x ) ) {
+    skipSeparator( p, end );
+    if( !parseNumber( p, end, y ) ) break;
+    skipSeparator( p, end );
+    points.push_back( Vector2D( x, y ) );
+    count++;
+  }
+
+  return count;
+}
+
+} // namespace CMU462
@@ -0,0 +1,38 @@
+#ifndef CMU462_NUMBER_PARSER_H
+#define CMU462_NUMBER_PARSER_H
+
+#include <vector>
+#include <cstddef>
+
+#include "vector2D.h"
+
+namespace CMU462 {
+
+/**
+ * Scanners for the numbers in SVG attribute values.
+ * They work on [p, end) ranges that do not need to be null terminated,
+ * never allocate and do not depend on the locale. Numbers follow the SVG
+ * grammar: an optional sign, digits with an optional fraction (either part
+ * may be empty, not both) and an optional exponent. Numbers are separated
+ * by whitespace and at most one comma, or by nothing at all where that is
+ * unambiguous ("10-20" is two numbers, and so is "0.5.5").
+ */
+
+// Read a number after optional whitespace and advance p past it. Returns
+// false (leaving p unchanged) if there is no number at p.
+bool parseNumber( const char*& p, const char* end, float& value );
+
+// skip whitespace with at most one comma in it
+void skipSeparator( const char*& p, const char* end );
+
+// Read up to n numbers separated as above, returns how many were read
+size_t parseNumbers( const char*& p, const char* end, float* values, size_t n );
+
+// Read a list of coordinate pairs (the points attribute of polylines and
+// polygons), appending them to points. A trailing unpaired number is
+// ignored. Returns the number of points read.
+size_t parsePoints( const char* p, const char* end, std::vector<Vector2D>& points );
+
+} // namespace CMU462
+
+#endif // CMU462_NUMBER_PARSER_H
@@ -0,0 +1,288 @@
+#include "path.h"
+#include "CMU462.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+const int kPathCommandPoints[NUM_PATH_COMMANDS] = { 1, 1, 2, 3, 0 };
+
+// segments of a curve are capped, which only loosens the tolerance of
+// curves that span tens of thousands of pixels
+static const int kMaxCurveSegments = 1024;
+
+// zoom buckets span 2^-32 to 2^32 pixels per unit
+static const int kMaxBucket = 32;
+
+// Building //
+
+void PathData::move_to( const Vector2D& p ) {
+
+  // a move right after another one replaces it
+  if( !commands.empty() && commands.back() == PATH_MOVE ) {
+    points.back() = p;
+  } else {
+    commands.push_back( PATH_MOVE );
+    points.push_back( p );
+  }
+  start = p;
+}
+
+// drawing commands after a close (or at the start) begin a new subpath
+// at the current point
+static inline void beginSubpath( PathData& path ) {
+  if( path.commands.empty() || path.commands.back() == PATH_CLOSE ) {
+    path.move_to( path.current() );
+  }
+}
+
+void PathData::line_to( const Vector2D& p ) {
+  beginSubpath( *this );
+  commands.push_back( PATH_LINE );
+  points.push_back( p );
+}
+
+void PathData::quad_to( const Vector2D& c, const Vector2D& p ) {
+  beginSubpath( *this );
+  commands.push_back( PATH_QUAD );
+  points.push_back( c );
+  points.push_back( p );
+}
+
+void PathData::cubic_to( const Vector2D& c1, const Vector2D& c2, const Vector2D& p ) {
+  beginSubpath( *this );
+  commands.push_back( PATH_CUBIC );
+  points.push_back( c1 );
+  points.push_back( c2 );
+  points.push_back( p );
+}
+
+void PathData::arc_to( Vector2D radius, float rotation, bool large_arc, bool sweep,
+                       const Vector2D& p ) {
+
+  // out of range parameters, as the SVG implementation notes (F.6.2) treat them
+  Vector2D p0 = current();
+  if( p0.x == p.x && p0.y == p.y ) return;
+  double rx = fabs( radius.x ), ry = fabs( radius.y );
+  if( rx == 0 || ry == 0 ) {
+    line_to( p );
+    return;
+  }
+
+  // center parameterization (F.6.5), with radii scaled up to reach p (F.6.6)
+  double phi = rotation * PI / 180, c = cos( phi ), s = sin( phi );
+  Vector2D d = (p0 - p) / 2;
+  double x1 = c * d.x + s * d.y, y1 = -s * d.x + c * d.y;
+  double lambda = x1 * x1 / (rx * rx) + y1 * y1 / (ry * ry);
+  if( lambda > 1 ) {
+    rx *= sqrt( lambda ); ry *= sqrt( lambda );
+  }
+  double num = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+  double den = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+  double k = sqrt( max( 0.0, num / den ) );
+  if( large_arc == sweep ) k = -k;
+  double cx1 = k * rx * y1 / ry, cy1 = -k * ry * x1 / rx;
+  Vector2D center ( c * cx1 - s * cy1 + (p0.x + p.x) / 2,
+                    s * cx1 + c * cy1 + (p0.y + p.y) / 2 );
+  double theta = atan2( (y1 - cy1) / ry, (x1 - cx1) / rx );
+  double delta = atan2( (-y1 - cy1) / ry, (-x1 - cx1) / rx ) - theta;
+  if( sweep && delta < 0 ) delta += 2 * PI;
+  if( !sweep && delta > 0 ) delta -= 2 * PI;
+
+  // a cubic per quarter turn at most
+  int n = max( 1, (int) ceil( fabs( delta ) / (PI / 2) - 1e-6 ) );
+  double step = delta / n, t = 4.0 / 3 * tan( step / 4 );
+  for( int i = 0; i < n; ++i ) {
+    double a0 = theta + i * step, a1 = a0 + step;
+    double u[3][2] = {
+      { cos( a0 ) - t * sin( a0 ), sin( a0 ) + t * cos( a0 ) },
+      { cos( a1 ) + t * sin( a1 ), sin( a1 ) - t * cos( a1 ) },
+      { cos( a1 ), sin( a1 ) }
+    };
+    Vector2D q[3];
+    for( int j = 0; j < 3; ++j ) {
+      double x = rx * u[j][0], y = ry * u[j][1];
+      q[j] = Vector2D( center.x + c * x - s * y, center.y + s * x + c * y );
+    }
+    cubic_to( q[0], q[1], i == n - 1 ? p : q[2] );
+  }
+}
+
+void PathData::close() {
+  if( !commands.empty() && commands.back() != PATH_CLOSE ) {
+    commands.push_back( PATH_CLOSE );
+  }
+}
+
+Vector2D PathData::current() const {
+  if( commands.empty() ) return Vector2D( 0, 0 );
+  if( commands.back() == PATH_CLOSE ) return start;
+  return points.back();
+}
+
+BBox PathData::bounds() const {
+  BBox box;
+  for( size_t i = 0; i < points.size(); ++i ) {
+    box.expand( points[i].x, points[i].y );
+  }
+  return box;
+}
+
+int64_t PathData::count_points( const uint8_t* commands, size_t n ) {
+  int64_t count = 0;
+  for( size_t i = 0; i < n; ++i ) {
+    if( commands[i] >= NUM_PATH_COMMANDS ) return -1;
+    count += kPathCommandPoints[commands[i]];
+  }
+  return count;
+}
+
+// Flattening //
+
+// Appends contours to a flat path, merging points within tolerance
+struct Flattener {
+
+  Flattener( FlatPath& result, float tolerance )
+    : result ( result ), tolerance2 ( tolerance * tolerance ),
+      first ( 0 ), open ( false ) { }
+
+  void begin( const Vector2D& p ) {
+    end( false );
+    first = result.points.size();
+    result.points.push_back( p );
+    open = true;
+  }
+
+  void add( const Vector2D& p ) {
+    if( (p - result.points.back()).norm2() >= tolerance2 ) {
+      result.points.push_back( p );
+    }
+  }
+
+  void end( bool closed ) {
+    if( !open ) return;
+    open = false;
+
+    // contours that collapse to a point draw nothing
+    if( result.points.size() - first < 2 ) {
+      result.points.resize( first );
+      return;
+    }
+    result.ends.push_back( result.points.size() );
+    result.closed.push_back( closed );
+  }
+
+  FlatPath& result;
+  double tolerance2;
+  size_t first; bool open;
+};
+
+// segments that keep a curve within tolerance of its polyline (Wang's
+// formula), given the largest second difference of its control points
+static inline int curveSegments( double degree, double difference, float tolerance ) {
+  double n = ceil( sqrt( degree * (degree - 1) / 8 * difference / tolerance ) );
+  return (int) max( 1.0, min( n, (double) kMaxCurveSegments ) );
+}
+
+void flatten( const PathData& path, float tolerance, FlatPath& result ) {
+
+  result.points.clear();
+  result.ends.clear();
+  result.closed.clear();
+
+  Flattener out ( result, tolerance );
+  const vector<Vector2D>& p = path.points;
+  Vector2D current ( 0, 0 );
+  size_t next = 0;
+  for( size_t i = 0; i < path.commands.size(); ++i ) {
+
+    uint8_t command = path.commands[i];
+    if( command != PATH_MOVE && command != PATH_CLOSE && !out.open ) {
+      out.begin( current );
+    }
+
+    switch( command ) {
+      case PATH_MOVE:
+        current = p[next];
+        out.begin( current );
+        break;
+      case PATH_LINE:
+        current = p[next];
+        out.add( current );
+        break;
+      case PATH_QUAD: {
+        const Vector2D& c = p[next], &e = p[next + 1];
+        int n = curveSegments( 2, (current - 2 * c + e).norm(), tolerance );
+        for( int k = 1; k < n; ++k ) {
+          double t = (double) k / n, s = 1 - t;
+          out.add( s * s * current + 2 * s * t * c + t * t * e );
+        }
+        out.add( e );
+        current = e;
+        break;
+      }
+      case PATH_CUBIC: {
+        const Vector2D& c1 = p[next], &c2 = p[next + 1], &e = p[next + 2];
+        double difference = max( (current - 2 * c1 + c2).norm(),
+                                 (c1 - 2 * c2 + e).norm() );
+        int n = curveSegments( 3, difference, tolerance );
+        for( int k = 1; k < n; ++k ) {
+          double t = (double) k / n, s = 1 - t;
+          out.add( s * s * s * current + 3 * s * s * t * c1 +
+                   3 * s * t * t * c2 + t * t * t * e );
+        }
+        out.add( e );
+        current = e;
+        break;
+      }
+      case PATH_CLOSE:
+        if( out.open ) current = result.points[out.first];
+        out.end( true );
+        break;
+      default:
+        break;
+    }
+    if( command < NUM_PATH_COMMANDS ) next += kPathCommandPoints[command];
+  }
+  out.end( false );
+}
+
+// Cache //
+
+const float PathCache::kTolerance = 0.25f;
+
+shared_ptr<const FlatPath> PathCache::get( const PathData& path, float scale ) {
+
+  // smallest power of two at least as large as the scale
+  int bucket = scale > 0 ? (int) ceil( log2( scale ) ) : -kMaxBucket;
+  bucket = max( -kMaxBucket, min( bucket, kMaxBucket ) );
+
+  lock_guard<std::mutex> lock( mutex );
+  stamp++;
+
+  Entry* entry = &entries[0];
+  for( int i = 0; i < kBuckets; ++i ) {
+    if( entries[i].path && entries[i].bucket == bucket ) {
+      entries[i].stamp = stamp;
+      return entries[i].path;
+    }
+    if( entries[i].stamp < entry->stamp ) entry = &entries[i];
+  }
+
+  shared_ptr<FlatPath> flat ( new FlatPath() );
+  flatten( path, ldexp( kTolerance, -bucket ), *flat );
+  entry->bucket = bucket;
+  entry->stamp = stamp;
+  entry->path = flat;
+  return flat;
+}
+
+void PathCache::clear() {
+  lock_guard<std::mutex> lock( mutex );
+  for( int i = 0; i < kBuckets; ++i ) entries[i] = Entry();
+}
+
+} // namespace CMU462
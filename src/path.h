@@ -0,0 +1,125 @@
+#ifndef CMU462_PATH_H
+#define CMU462_PATH_H
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+#include "vector2D.h"
+#include "bvh.h"
+
+namespace CMU462 {
+
+// path commands, stored one byte each
+typedef enum e_PathCommand {
+  PATH_MOVE = 0,  // end point
+  PATH_LINE,      // end point
+  PATH_QUAD,      // control point, end point
+  PATH_CUBIC,     // two control points, end point
+  PATH_CLOSE,     // back to the start of the subpath, no points
+  NUM_PATH_COMMANDS
+} PathCommand;
+
+// number of points of each command
+extern const int kPathCommandPoints[NUM_PATH_COMMANDS];
+
+/**
+ * Path geometry as a compact command buffer.
+ * Commands are stored one byte each, followed by their points in absolute
+ * coordinates. The other SVG path commands are reduced to these while
+ * parsing: horizontal and vertical lines are lines, smooth curves get their
+ * reflected control point and elliptical arcs are split into cubics.
+ */
+struct PathData {
+
+  void move_to( const Vector2D& p );
+  void line_to( const Vector2D& p );
+  void quad_to( const Vector2D& c, const Vector2D& p );
+  void cubic_to( const Vector2D& c1, const Vector2D& c2, const Vector2D& p );
+
+  // elliptical arc from the current point, with the parameters of the SVG
+  // arc command (rotation in degrees)
+  void arc_to( Vector2D radius, float rotation, bool large_arc, bool sweep,
+               const Vector2D& p );
+
+  void close();
+
+  // point the next command starts from
+  Vector2D current() const;
+
+  // bounds of all points (the curves lie within them)
+  BBox bounds() const;
+
+  // number of points a command list takes, -1 if it has unknown commands
+  static int64_t count_points( const uint8_t* commands, size_t n );
+
+  std::vector<uint8_t> commands;
+  std::vector<Vector2D> points;
+
+  // start of the last subpath
+  Vector2D start;
+
+}; // struct PathData
+
+/**
+ * A path flattened into contours, polylines stored back to back.
+ */
+struct FlatPath {
+
+  // points of all contours
+  std::vector<Vector2D> points;
+
+  // end of each contour in points, and whether it is closed
+  std::vector<uint32_t> ends;
+  std::vector<uint8_t> closed;
+
+}; // struct FlatPath
+
+/**
+ * Flattens a path into contours, no farther than tolerance from its curves.
+ * Points closer than tolerance to the previous one are dropped, so that
+ * coarse tolerances also reduce paths made of many small segments.
+ */
+void flatten( const PathData& path, float tolerance, FlatPath& result );
+
+/**
+ * Flattened versions of a path, cached per zoom bucket.
+ * Buckets are the powers of two between the scales (in pixels per unit) a
+ * path is drawn at. A path is flattened for the largest scale of its
+ * bucket, within a quarter of a pixel, so that it is only refined when the
+ * view zooms into a finer bucket. A few buckets are kept per path and the
+ * least recently used one is replaced.
+ */
+class PathCache {
+ public:
+
+  PathCache() : stamp ( 0 ) { }
+
+  // flattened path for drawing at the given scale
+  std::shared_ptr<const FlatPath> get( const PathData& path, float scale );
+
+  // drop all buckets (after the path changes)
+  void clear();
+
+  // tolerance in pixels
+  static const float kTolerance;
+
+ private:
+
+  static const int kBuckets = 3;
+
+  struct Entry {
+    Entry() : bucket ( 0 ), stamp ( 0 ) { }
+    int bucket; size_t stamp;
+    std::shared_ptr<const FlatPath> path;
+  };
+
+  Entry entries[kBuckets]; size_t stamp;
+  std::mutex mutex;
+
+}; // class PathCache
+
+} // namespace CMU462
+
+#endif // CMU462_PATH_H
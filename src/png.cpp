@@ -1,8 +1,17 @@
 #include "png.h"
+#include "thread_pool.h"
 
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 using namespace std;
 
@@ -10,6 +19,412 @@ namespace CMU462 {
 
 // Parser routines //
 
+// Inflate //
+
+// Huffman codes up to this long are decoded with a single table lookup
+static const int kFastBits = 10;
+
+// little endian load that compiles to a single load where possible
+static inline uint64_t load64le( const unsigned char* p ) {
+  return  (uint64_t) p[0]        | ((uint64_t) p[1] <<  8) |
+         ((uint64_t) p[2] << 16) | ((uint64_t) p[3] << 24) |
+         ((uint64_t) p[4] << 32) | ((uint64_t) p[5] << 40) |
+         ((uint64_t) p[6] << 48) | ((uint64_t) p[7] << 56);
+}
+
+// Reads the deflate stream (least significant bit first) a word at a time.
+// Past the end of the input it shifts in zero bytes and counts them, so
+// that consuming them can be reported as truncated input.
+struct BitReader {
+
+  BitReader( const unsigned char* in, size_t size )
+    : p ( in ), end ( in + size ), bits ( 0 ), count ( 0 ), padding ( 0 ) { }
+
+  // make sure that at least 56 bits are buffered
+  inline void refill() {
+    if( end - p >= 8 ) {
+      bits |= load64le( p ) << count;
+      p += (63 - count) >> 3;
+      count |= 56;
+    } else {
+      while( count <= 56 ) {
+        if( p < end ) bits |= (uint64_t) *p++ << count;
+        else padding++;
+        count += 8;
+      }
+    }
+  }
+
+  inline unsigned peek( int n ) const { return bits & ((1ull << n) - 1); }
+  inline void drop( int n ) { bits >>= n; count -= n; }
+  inline unsigned read( int n ) { unsigned v = peek( n ); drop( n ); return v; }
+
+  // true if bits past the end of the input have been consumed
+  inline bool overrun() const { return count < 8 * (int) padding; }
+
+  const unsigned char* p; const unsigned char* end;
+  uint64_t bits; int count;
+  size_t padding;
+};
+
+// Canonical Huffman code. fast[bits] holds symbol << 4 | length for the
+// codes of up to kFastBits bits (indexed by the next bits of the stream,
+// so by the bit reversed code) and 0 for longer codes, which are decoded
+// from the number of codes of each length.
+struct HuffmanTable {
+
+  uint16_t fast[1 << kFastBits];
+  uint16_t count[16];
+  uint16_t symbols[288];
+
+  // returns a picoPNG error code
+  int build( const unsigned char* lengths, int n ) {
+
+    memset( count, 0, sizeof(count) );
+    for( int i = 0; i < n; i++ ) count[lengths[i]]++;
+    count[0] = 0;
+
+    // over-subscribed codes are invalid (incomplete ones are allowed)
+    int left = 1;
+    for( int len = 1; len < 16; len++ ) {
+      left = (left << 1) - count[len];
+      if( left < 0 ) return 55;
+    }
+
+    // symbols sorted by code
+    uint16_t offset[16]; offset[1] = 0;
+    for( int len = 1; len < 15; len++ ) offset[len + 1] = offset[len] + count[len];
+    for( int i = 0; i < n; i++ ) {
+      if( lengths[i] ) symbols[offset[lengths[i]]++] = i;
+    }
+
+    memset( fast, 0, sizeof(fast) );
+    int code = 0, index = 0;
+    for( int len = 1; len <= kFastBits; len++ ) {
+      for( int k = 0; k < count[len]; k++, index++, code++ ) {
+        int reversed = 0;
+        for( int b = 0; b < len; b++ ) reversed |= ((code >> b) & 1) << (len - 1 - b);
+        for( int j = reversed; j < (1 << kFastBits); j += 1 << len ) {
+          fast[j] = symbols[index] << 4 | len;
+        }
+      }
+      code <<= 1;
+    }
+
+    return 0;
+  }
+
+  // decode a symbol from at least 15 buffered bits, -1 for invalid codes
+  inline int decode( BitReader& in ) const {
+
+    unsigned entry = fast[in.peek( kFastBits )];
+    if( entry ) {
+      in.drop( entry & 15 );
+      return entry >> 4;
+    }
+
+    int code = 0, first = 0, index = 0;
+    for( int len = 1; len < 16; len++ ) {
+      code |= (in.bits >> (len - 1)) & 1;
+      int c = count[len];
+      if( code - c < first ) {
+        in.drop( len );
+        return symbols[index + (code - first)];
+      }
+      index += c; first = (first + c) << 1; code <<= 1;
+    }
+    return -1;
+  }
+};
+
+static const unsigned short kLengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+  67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char kLengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4,
+  5, 5, 5, 5, 0
+};
+static const unsigned short kDistBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+  769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char kDistExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+  11, 11, 12, 12, 13, 13
+};
+
+// tables of the blocks compressed with the fixed code
+struct FixedTables {
+  HuffmanTable lengths, distances;
+  FixedTables() {
+    unsigned char l[288], d[30];
+    for( int i = 0; i < 288; i++ ) l[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    for( int i = 0; i < 30; i++ ) d[i] = 5;
+    lengths.build( l, 288 ); distances.build( d, 30 );
+  }
+};
+
+// read the code tables of a block compressed with a dynamic code
+static int readDynamicTables( BitReader& in, HuffmanTable& lengths, HuffmanTable& distances ) {
+
+  static const unsigned char order[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+  };
+
+  in.refill();
+  int nlen = in.read( 5 ) + 257, ndist = in.read( 5 ) + 1, ncode = in.read( 4 ) + 4;
+  if( nlen > 286 || ndist > 30 ) return 16;
+
+  unsigned char code_lengths[19] = { 0 };
+  for( int i = 0; i < ncode; i++ ) {
+    in.refill();
+    code_lengths[order[i]] = in.read( 3 );
+  }
+  HuffmanTable codes;
+  int error = codes.build( code_lengths, 19 );
+  if( error ) return error;
+
+  // literal/length and distance code lengths, in one run
+  unsigned char l[286 + 30];
+  int n = nlen + ndist;
+  for( int i = 0; i < n; ) {
+
+    in.refill();
+    if( in.overrun() ) return 10;
+    int symbol = codes.decode( in );
+    if( symbol < 0 ) return 16;
+
+    if( symbol < 16 ) {
+      l[i++] = symbol;
+      continue;
+    }
+
+    int repeat; unsigned char value = 0;
+    if( symbol == 16 ) {
+      if( i == 0 ) return 54;
+      value = l[i - 1]; repeat = 3 + in.read( 2 );
+    } else if( symbol == 17 ) {
+      repeat = 3 + in.read( 3 );
+    } else {
+      repeat = 11 + in.read( 7 );
+    }
+    if( i + repeat > n ) return 13;
+    memset( l + i, value, repeat ); i += repeat;
+  }
+
+  if( l[256] == 0 ) return 64;
+  error = lengths.build( l, nlen );
+  if( error ) return error;
+  return distances.build( l + nlen, ndist );
+}
+
+// Room inflate needs past the end of the output for the longest match
+// plus the slack of copying in 8 byte steps. Reserving it along with the
+// expected size saves a reallocation.
+static const size_t kInflateSlack = 258 + 8;
+
+// Inflates a raw deflate stream (RFC 1951) into out, which is resized to
+// the decompressed size. Returns a picoPNG error code.
+static int inflate( std::vector<unsigned char>& out, const unsigned char* in, size_t size ) {
+
+  static const FixedTables fixed;
+
+  BitReader bits ( in, size );
+  HuffmanTable dynamic_lengths, dynamic_distances;
+  size_t pos = 0;
+
+  // out is sized for the expected data
+  const size_t kSlack = kInflateSlack;
+  out.resize( out.size() + kSlack );
+
+  bool last = false;
+  while( !last ) {
+
+    bits.refill();
+    if( bits.overrun() ) return 52;
+    last = bits.read( 1 );
+    int type = bits.read( 2 );
+
+    if( type == 3 ) return 20;
+
+    // stored block
+    if( type == 0 ) {
+
+      bits.drop( bits.count & 7 );
+      bits.refill();
+      unsigned len = bits.read( 16 ), nlen = bits.read( 16 );
+      if( len + nlen != 65535 ) return 21;
+      if( pos + len + kSlack > out.size() ) out.resize( (pos + len + kSlack) * 2 );
+
+      // bytes that are already buffered, then straight from the input
+      while( len && bits.count >= 8 ) {
+        out[pos++] = bits.read( 8 );
+        len--;
+      }
+      if( bits.overrun() ) return 23;
+      if( len ) {
+        if( (size_t) (bits.end - bits.p) < len ) return 23;
+        memcpy( &out[pos], bits.p, len );
+        pos += len; bits.p += len;
+        bits.bits = 0; // drop what was read ahead of the copied bytes
+      }
+      continue;
+    }
+
+    const HuffmanTable* lengths = &fixed.lengths;
+    const HuffmanTable* distances = &fixed.distances;
+    if( type == 2 ) {
+      int error = readDynamicTables( bits, dynamic_lengths, dynamic_distances );
+      if( error ) return error;
+      lengths = &dynamic_lengths; distances = &dynamic_distances;
+    }
+
+    unsigned char* o = &out[0];
+    while( true ) {
+
+      // a symbol takes at most 15 + 5 + 15 + 13 bits
+      bits.refill();
+      if( bits.overrun() ) return 10;
+
+      int symbol = lengths->decode( bits );
+      if( symbol < 256 ) {
+        if( symbol < 0 ) return 11;
+        o[pos++] = symbol;
+        if( pos + kSlack > out.size() ) {
+          out.resize( out.size() * 2 ); o = &out[0];
+        }
+        continue;
+      }
+      if( symbol == 256 ) break;
+      if( symbol > 285 ) return 11;
+
+      size_t length = kLengthBase[symbol - 257] + bits.read( kLengthExtra[symbol - 257] );
+      int code = distances->decode( bits );
+      if( code < 0 || code > 29 ) return 18;
+      size_t dist = kDistBase[code] + bits.read( kDistExtra[code] );
+      if( dist > pos ) return 52;
+
+      // overlapping copies repeat the last dist bytes
+      unsigned char* dst = o + pos; const unsigned char* src = dst - dist;
+      if( dist >= 8 ) {
+        for( size_t i = 0; i < length; i += 8 ) memcpy( dst + i, src + i, 8 );
+      } else if( dist == 1 ) {
+        memset( dst, *src, length );
+      } else {
+        for( size_t i = 0; i < length; i++ ) dst[i] = src[i];
+      }
+      pos += length;
+      if( pos + kSlack > out.size() ) {
+        out.resize( out.size() * 2 ); o = &out[0];
+      }
+    }
+  }
+
+  // the adler32 checksum is not checked
+  out.resize( pos );
+  return 0;
+}
+
+// Unfilter //
+
+#ifdef __SSE2__
+
+// Sub, Average and Paeth filters predict each pixel from the one to its
+// left, so pixels are reconstructed one at a time with all of their
+// channels in one register. The pixel size is a template parameter to keep
+// loads and stores to single moves. Up has no such dependency and runs 16
+// bytes at a time.
+
+template<size_t bytewidth>
+static inline __m128i loadPixel( const unsigned char* p ) {
+  int v = 0; memcpy( &v, p, bytewidth );
+  return _mm_cvtsi32_si128( v );
+}
+
+template<size_t bytewidth>
+static inline void storePixel( unsigned char* p, __m128i v ) {
+  int x = _mm_cvtsi128_si32( v ); memcpy( p, &x, bytewidth );
+}
+
+static void unfilterUp( unsigned char* recon, const unsigned char* scanline,
+                        const unsigned char* precon, size_t length ) {
+  size_t i = 0;
+  for( ; i + 16 <= length; i += 16 ) {
+    __m128i s = _mm_loadu_si128( (const __m128i*) (scanline + i) );
+    __m128i b = _mm_loadu_si128( (const __m128i*) (precon + i) );
+    _mm_storeu_si128( (__m128i*) (recon + i), _mm_add_epi8( s, b ) );
+  }
+  for( ; i < length; i++ ) recon[i] = scanline[i] + precon[i];
+}
+
+template<size_t bytewidth>
+static void unfilterSub( unsigned char* recon, const unsigned char* scanline,
+                         size_t length ) {
+  __m128i a = _mm_setzero_si128();
+  for( size_t i = 0; i < length; i += bytewidth ) {
+    a = _mm_add_epi8( loadPixel<bytewidth>( scanline + i ), a );
+    storePixel<bytewidth>( recon + i, a );
+  }
+}
+
+template<size_t bytewidth>
+static void unfilterAverage( unsigned char* recon, const unsigned char* scanline,
+                             const unsigned char* precon, size_t length ) {
+  // _mm_avg_epu8 rounds up, the filter rounds down
+  const __m128i one = _mm_set1_epi8( 1 );
+  __m128i a = _mm_setzero_si128();
+  for( size_t i = 0; i < length; i += bytewidth ) {
+    __m128i b = loadPixel<bytewidth>( precon + i );
+    __m128i average = _mm_avg_epu8( a, b );
+    average = _mm_sub_epi8( average, _mm_and_si128( _mm_xor_si128( a, b ), one ) );
+    a = _mm_add_epi8( loadPixel<bytewidth>( scanline + i ), average );
+    storePixel<bytewidth>( recon + i, a );
+  }
+}
+
+template<size_t bytewidth>
+static void unfilterPaeth( unsigned char* recon, const unsigned char* scanline,
+                           const unsigned char* precon, size_t length ) {
+  // predictor in 16 bits: with p = a + b - c, |p - a| = |b - c|,
+  // |p - b| = |a - c| and |p - c| = |(b - c) + (a - c)|
+  const __m128i zero = _mm_setzero_si128();
+  __m128i a = zero, c = zero;
+  for( size_t i = 0; i < length; i += bytewidth ) {
+    __m128i b = _mm_unpacklo_epi8( loadPixel<bytewidth>( precon + i ), zero );
+    __m128i pa = _mm_sub_epi16( b, c );
+    __m128i pb = _mm_sub_epi16( a, c );
+    __m128i pc = _mm_add_epi16( pa, pb );
+    pa = _mm_max_epi16( pa, _mm_sub_epi16( zero, pa ) );
+    pb = _mm_max_epi16( pb, _mm_sub_epi16( zero, pb ) );
+    pc = _mm_max_epi16( pc, _mm_sub_epi16( zero, pc ) );
+
+    // a if it is closest, then b, then c
+    __m128i smallest = _mm_min_epi16( pc, _mm_min_epi16( pa, pb ) );
+    __m128i use_a = _mm_cmpeq_epi16( smallest, pa );
+    __m128i use_b = _mm_andnot_si128( use_a, _mm_cmpeq_epi16( smallest, pb ) );
+    __m128i use_c = _mm_andnot_si128( _mm_or_si128( use_a, use_b ), _mm_set1_epi16( -1 ) );
+    __m128i prediction = _mm_or_si128( _mm_or_si128( _mm_and_si128( use_a, a ),
+                                                     _mm_and_si128( use_b, b ) ),
+                                       _mm_and_si128( use_c, c ) );
+
+    __m128i x = _mm_add_epi8( loadPixel<bytewidth>( scanline + i ),
+                              _mm_packus_epi16( prediction, zero ) );
+    storePixel<bytewidth>( recon + i, x );
+    a = _mm_unpacklo_epi8( x, zero );
+    c = b;
+  }
+}
+
+// run a filter for pixels of 1 to 4 bytes, false for other sizes
+#define UNFILTER_PIXELS( filter, bytewidth, ... ) \
+  ( (bytewidth) == 4 ? (filter<4>( __VA_ARGS__ ), true) : \
+    (bytewidth) == 3 ? (filter<3>( __VA_ARGS__ ), true) : \
+    (bytewidth) == 2 ? (filter<2>( __VA_ARGS__ ), true) : \
+    (bytewidth) == 1 ? (filter<1>( __VA_ARGS__ ), true) : false )
+
+#endif // __SSE2__
+
 /* picoPNG version 20101224
  * Copyright (c) 2005-2010 Lode Vandevenne
  *
@@ -28,202 +443,22 @@ namespace CMU462 {
  * 2. Altered source versions must be plainly marked as such, and must not be
  *    misrepresented as being the original software.
  * 3. This notice may not be removed or altered from any source distribution.
+ *
+ * Altered: inflate and scanline unfiltering have been replaced with the
+ * table driven and SSE2 versions above.
  */
 int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
     
-  static const unsigned long LENBASE[29] =  {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
-  static const unsigned long LENEXTRA[29] = {0,0,0,0,0,0,0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4,  4,  5,  5,  5,  5,  0};
-  static const unsigned long DISTBASE[30] =  {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,12289,16385,24577};
-  static const unsigned long DISTEXTRA[30] = {0,0,0,0,1,1,2, 2, 3, 3, 4, 4, 5, 5,  6,  6,  7,  7,  8,  8,   9,   9,  10,  10,  11,  11,  12,   12,   13,   13};
-  static const unsigned long CLCL[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15}; //code length code lengths
   struct Zlib //nested functions for zlib decompression
   {
-    static unsigned long readBitFromStream(size_t& bitp, const unsigned char* bits) { unsigned long result = (bits[bitp >> 3] >> (bitp & 0x7)) & 1; bitp++; return result;}
-    static unsigned long readBitsFromStream(size_t& bitp, const unsigned char* bits, size_t nbits)
+    int decompress(std::vector<unsigned char>& out, const unsigned char* in, size_t size) //returns error value
     {
-      unsigned long result = 0;
-      for(size_t i = 0; i < nbits; i++) result += (readBitFromStream(bitp, bits)) << i;
-      return result;
-    }
-    struct HuffmanTree
-    {
-      int makeFromLengths(const std::vector<unsigned long>& bitlen, unsigned long maxbitlen)
-      { //make tree given the lengths
-        unsigned long numcodes = (unsigned long)(bitlen.size()), treepos = 0, nodefilled = 0;
-        std::vector<unsigned long> tree1d(numcodes), blcount(maxbitlen + 1, 0), nextcode(maxbitlen + 1, 0);
-        for(unsigned long bits = 0; bits < numcodes; bits++) blcount[bitlen[bits]]++; //count number of instances of each code length
-        for(unsigned long bits = 1; bits <= maxbitlen; bits++) nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
-        for(unsigned long n = 0; n < numcodes; n++) if(bitlen[n] != 0) tree1d[n] = nextcode[bitlen[n]]++; //generate all the codes
-        tree2d.clear(); tree2d.resize(numcodes * 2, 32767); //32767 here means the tree2d isn't filled there yet
-        for(unsigned long n = 0; n < numcodes; n++) //the codes
-        for(unsigned long i = 0; i < bitlen[n]; i++) //the bits for this code
-        {
-          unsigned long bit = (tree1d[n] >> (bitlen[n] - i - 1)) & 1;
-          if(treepos > numcodes - 2) return 55;
-          if(tree2d[2 * treepos + bit] == 32767) //not yet filled in
-          {
-            if(i + 1 == bitlen[n]) { tree2d[2 * treepos + bit] = n; treepos = 0; } //last bit
-            else { tree2d[2 * treepos + bit] = ++nodefilled + numcodes; treepos = nodefilled; } //addresses are encoded as values > numcodes
-          }
-          else treepos = tree2d[2 * treepos + bit] - numcodes; //subtract numcodes from address to get address value
-        }
-        return 0;
-      }
-      int decode(bool& decoded, unsigned long& result, size_t& treepos, unsigned long bit) const
-      { //Decodes a symbol from the tree
-        unsigned long numcodes = (unsigned long)tree2d.size() / 2;
-        if(treepos >= numcodes) return 11; //error: you appeared outside the codetree
-        result = tree2d[2 * treepos + bit];
-        decoded = (result < numcodes);
-        treepos = decoded ? 0 : result - numcodes;
-        return 0;
-      }
-      std::vector<unsigned long> tree2d; //2D representation of a huffman tree: The one dimension is "0" or "1", the other contains all nodes and leaves of the tree.
-    };
-    struct Inflator
-    {
-      int error;
-      void inflate(std::vector<unsigned char>& out, const std::vector<unsigned char>& in, size_t inpos = 0)
-      {
-        size_t bp = 0, pos = 0; //bit pointer and byte pointer
-        error = 0;
-        unsigned long BFINAL = 0;
-        while(!BFINAL && !error)
-        {
-          if(bp >> 3 >= in.size()) { error = 52; return; } //error, bit pointer will jump past memory
-          BFINAL = readBitFromStream(bp, &in[inpos]);
-          unsigned long BTYPE = readBitFromStream(bp, &in[inpos]); BTYPE += 2 * readBitFromStream(bp, &in[inpos]);
-          if(BTYPE == 3) { error = 20; return; } //error: invalid BTYPE
-          else if(BTYPE == 0) inflateNoCompression(out, &in[inpos], bp, pos, in.size());
-          else inflateHuffmanBlock(out, &in[inpos], bp, pos, in.size(), BTYPE);
-        }
-        if(!error) out.resize(pos); //Only now we know the true size of out, resize it to that
-      }
-      void generateFixedTrees(HuffmanTree& tree, HuffmanTree& treeD) //get the tree of a deflated block with fixed tree
-      {
-        std::vector<unsigned long> bitlen(288, 8), bitlenD(32, 5);;
-        for(size_t i = 144; i <= 255; i++) bitlen[i] = 9;
-        for(size_t i = 256; i <= 279; i++) bitlen[i] = 7;
-        tree.makeFromLengths(bitlen, 15);
-        treeD.makeFromLengths(bitlenD, 15);
-      }
-      HuffmanTree codetree, codetreeD, codelengthcodetree; //the code tree for Huffman codes, dist codes, and code length codes
-      unsigned long huffmanDecodeSymbol(const unsigned char* in, size_t& bp, const HuffmanTree& codetree, size_t inlength)
-      { //decode a single symbol from given list of bits with given code tree. return value is the symbol
-        bool decoded; unsigned long ct;
-        for(size_t treepos = 0;;)
-        {
-          if((bp & 0x07) == 0 && (bp >> 3) > inlength) { error = 10; return 0; } //error: end reached without endcode
-          error = codetree.decode(decoded, ct, treepos, readBitFromStream(bp, in)); if(error) return 0; //stop, an error happened
-          if(decoded) return ct;
-        }
-      }
-      void getTreeInflateDynamic(HuffmanTree& tree, HuffmanTree& treeD, const unsigned char* in, size_t& bp, size_t inlength)
-      { //get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree
-        std::vector<unsigned long> bitlen(288, 0), bitlenD(32, 0);
-        if(bp >> 3 >= inlength - 2) { error = 49; return; } //the bit pointer is or will go past the memory
-        size_t HLIT =  readBitsFromStream(bp, in, 5) + 257; //number of literal/length codes + 257
-        size_t HDIST = readBitsFromStream(bp, in, 5) + 1; //number of dist codes + 1
-        size_t HCLEN = readBitsFromStream(bp, in, 4) + 4; //number of code length codes + 4
-        std::vector<unsigned long> codelengthcode(19); //lengths of tree to decode the lengths of the dynamic tree
-        for(size_t i = 0; i < 19; i++) codelengthcode[CLCL[i]] = (i < HCLEN) ? readBitsFromStream(bp, in, 3) : 0;
-        error = codelengthcodetree.makeFromLengths(codelengthcode, 7); if(error) return;
-        size_t i = 0, replength;
-        while(i < HLIT + HDIST)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codelengthcodetree, inlength); if(error) return;
-          if(code <= 15)  { if(i < HLIT) bitlen[i++] = code; else bitlenD[i++ - HLIT] = code; } //a length code
-          else if(code == 16) //repeat previous
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 2);
-            unsigned long value; //set value to the previous code
-            if((i - 1) < HLIT) value = bitlen[i - 1];
-            else value = bitlenD[i - HLIT - 1];
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 13; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = value; else bitlenD[i++ - HLIT] = value;
-            }
-          }
-          else if(code == 17) //repeat "0" 3-10 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 3 + readBitsFromStream(bp, in, 3);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 14; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else if(code == 18) //repeat "0" 11-138 times
-          {
-            if(bp >> 3 >= inlength) { error = 50; return; } //error, bit pointer jumps past memory
-            replength = 11 + readBitsFromStream(bp, in, 7);
-            for(size_t n = 0; n < replength; n++) //repeat this value in the next lengths
-            {
-              if(i >= HLIT + HDIST) { error = 15; return; } //error: i is larger than the amount of codes
-              if(i < HLIT) bitlen[i++] = 0; else bitlenD[i++ - HLIT] = 0;
-            }
-          }
-          else { error = 16; return; } //error: somehow an unexisting code appeared. This can never happen.
-        }
-        if(bitlen[256] == 0) { error = 64; return; } //the length of the end code 256 must be larger than 0
-        error = tree.makeFromLengths(bitlen, 15); if(error) return; //now we've finally got HLIT and HDIST, so generate the code trees, and the function is done
-        error = treeD.makeFromLengths(bitlenD, 15); if(error) return;
-      }
-      void inflateHuffmanBlock(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength, unsigned long btype) 
-      {
-        if(btype == 1) { generateFixedTrees(codetree, codetreeD); }
-        else if(btype == 2) { getTreeInflateDynamic(codetree, codetreeD, in, bp, inlength); if(error) return; }
-        for(;;)
-        {
-          unsigned long code = huffmanDecodeSymbol(in, bp, codetree, inlength); if(error) return;
-          if(code == 256) return; //end code
-          else if(code <= 255) //literal symbol
-          {
-            if(pos >= out.size()) out.resize((pos + 1) * 2); //reserve more room
-            out[pos++] = (unsigned char)(code);
-          }
-          else if(code >= 257 && code <= 285) //length code
-          {
-            size_t length = LENBASE[code - 257], numextrabits = LENEXTRA[code - 257];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            length += readBitsFromStream(bp, in, numextrabits);
-            unsigned long codeD = huffmanDecodeSymbol(in, bp, codetreeD, inlength); if(error) return;
-            if(codeD > 29) { error = 18; return; } //error: invalid dist code (30-31 are never used)
-            unsigned long dist = DISTBASE[codeD], numextrabitsD = DISTEXTRA[codeD];
-            if((bp >> 3) >= inlength) { error = 51; return; } //error, bit pointer will jump past memory
-            dist += readBitsFromStream(bp, in, numextrabitsD);
-            size_t start = pos, back = start - dist; //backwards
-            if(pos + length >= out.size()) out.resize((pos + length) * 2); //reserve more room
-            for(size_t i = 0; i < length; i++) { out[pos++] = out[back++]; if(back >= start) back = start - dist; }
-          }
-        }
-      }
-      void inflateNoCompression(std::vector<unsigned char>& out, const unsigned char* in, size_t& bp, size_t& pos, size_t inlength)
-      {
-        while((bp & 0x7) != 0) bp++; //go to first boundary of byte
-        size_t p = bp / 8;
-        if(p >= inlength - 4) { error = 52; return; } //error, bit pointer will jump past memory
-        unsigned long LEN = in[p] + 256 * in[p + 1], NLEN = in[p + 2] + 256 * in[p + 3]; p += 4;
-        if(LEN + NLEN != 65535) { error = 21; return; } //error: NLEN is not one's complement of LEN
-        if(pos + LEN >= out.size()) out.resize(pos + LEN);
-        if(p + LEN > inlength) { error = 23; return; } //error: reading outside of in buffer
-        for(unsigned long n = 0; n < LEN; n++) out[pos++] = in[p++]; //read LEN bytes of literal data
-        bp = p * 8;
-      }
-    };
-    int decompress(std::vector<unsigned char>& out, const std::vector<unsigned char>& in) //returns error value
-    {
-      Inflator inflator;
-      if(in.size() < 2) { return 53; } //error, size of zlib data too small
+      if(size < 2) { return 53; } //error, size of zlib data too small
       if((in[0] * 256 + in[1]) % 31 != 0) { return 24; } //error: 256 * in[0] + in[1] must be a multiple of 31, the FCHECK value is supposed to be made that way
       unsigned long CM = in[0] & 15, CINFO = (in[0] >> 4) & 15, FDICT = (in[1] >> 5) & 1;
       if(CM != 8 || CINFO > 7) { return 25; } //error: only compression method 8: inflate with sliding window of 32k is supported by the PNG spec
       if(FDICT != 0) { return 26; } //error: the specification of PNG says about the zlib stream: "The additional flags shall not specify a preset dictionary."
-      inflator.inflate(out, in, 2);
-      return inflator.error; //note: adler32 checksum was skipped and ignored
+      return inflate(out, &in[2], size - 2); //note: adler32 checksum was skipped and ignored
     }
   };
   struct PNGDecoder //nested functions for PNG decoding
@@ -241,7 +476,8 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       if(size == 0 || in == 0) { error = 48; return; } //the given data is empty
       readPngHeader(&in[0], size); if(error) return;
       size_t pos = 33; //first byte of the first chunk after the header
-      std::vector<unsigned char> idat; //the data from idat chunks
+      std::vector<unsigned char> idat; //the data from idat chunks, when there are several
+      const unsigned char* idat_ = 0; size_t idatsize = 0; //the data from idat chunks, read in place when there is one
       bool IEND = false, known_type = true;
       info.key_defined = false;
       while(!IEND) //loop through the chunks, ignoring unknown chunks and stopping at IEND chunk. IDAT data is put at the start of the in buffer
@@ -249,10 +485,13 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
         if(pos + 8 >= size) { error = 30; return; } //error: size of the in buffer too small to contain next chunk
         size_t chunkLength = read32bitInt(&in[pos]); pos += 4;
         if(chunkLength > 2147483647) { error = 63; return; }
-        if(pos + chunkLength >= size) { error = 35; return; } //error: size of the in buffer too small to contain next chunk
+        if(pos + 4 + chunkLength + 4 > size) { error = 35; return; } //error: size of the in buffer too small to contain next chunk (type, data and CRC)
         if(in[pos + 0] == 'I' && in[pos + 1] == 'D' && in[pos + 2] == 'A' && in[pos + 3] == 'T') //IDAT chunk, containing compressed image data
         {
-          idat.insert(idat.end(), &in[pos + 4], &in[pos + 4 + chunkLength]);
+          if(idatsize && idat.empty()) idat.assign(idat_, idat_ + idatsize);
+          if(idatsize) idat.insert(idat.end(), &in[pos + 4], &in[pos + 4 + chunkLength]);
+          else idat_ = &in[pos + 4];
+          idatsize += chunkLength;
           pos += (4 + chunkLength);
         }
         else if(in[pos + 0] == 'I' && in[pos + 1] == 'E' && in[pos + 2] == 'N' && in[pos + 3] == 'D')  { pos += 4; IEND = true; }
@@ -299,9 +538,10 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
         pos += 4; //step over CRC (which is ignored)
       }
       unsigned long bpp = getBpp(info);
-      std::vector<unsigned char> scanlines(((info.width * (info.height * bpp + 7)) / 8) + info.height); //now the out buffer will be filled
+      size_t expected = ((info.width * (info.height * bpp + 7)) / 8) + info.height;
+      std::vector<unsigned char> scanlines; scanlines.reserve(expected + kInflateSlack); scanlines.resize(expected); //now the out buffer will be filled
       Zlib zlib; //decompress with the Zlib decompressor
-      error = zlib.decompress(scanlines, idat); if(error) return; //stop if the zlib decompressor returned an error
+      error = zlib.decompress(scanlines, idat.empty() ? idat_ : &idat[0], idatsize); if(error) return; //stop if the zlib decompressor returned an error
       size_t bytewidth = (bpp + 7) / 8, outlength = (info.height * info.width * bpp + 7) / 8;
       out.resize(outlength); //time to fill the out buffer
       unsigned char* out_ = outlength ? &out[0] : 0; //use a regular pointer to the std::vector for faster code if compiled without optimization
@@ -342,7 +582,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       }
       if(convert_to_rgba32 && (info.colorType != 6 || info.bitDepth != 8)) //conversion needed
       {
-        std::vector<unsigned char> data = out;
+        std::vector<unsigned char> data; data.swap(out); //the unconverted image, out is refilled
         error = convert(out, &data[0], info, info.width, info.height);
       }
     }
@@ -352,6 +592,7 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       if(in[0] != 137 || in[1] != 80 || in[2] != 78 || in[3] != 71 || in[4] != 13 || in[5] != 10 || in[6] != 26 || in[7] != 10) { error = 28; return; } //no PNG signature
       if(in[12] != 'I' || in[13] != 'H' || in[14] != 'D' || in[15] != 'R') { error = 29; return; } //error: it doesn't start with a IHDR chunk!
       info.width = read32bitInt(&in[16]); info.height = read32bitInt(&in[20]);
+      if((unsigned long long)info.width * info.height > (1ULL << 30)) { error = 92; return; } //error: image too large to decode
       info.bitDepth = in[24]; info.colorType = in[25];
       info.compressionMethod = in[26]; if(in[26] != 0) { error = 32; return; } //error: only compression method 0 is allowed in the specification
       info.filterMethod = in[27]; if(in[27] != 0) { error = 33; return; } //error: only filter method 0 is allowed in the specification
@@ -364,14 +605,24 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
       {
         case 0: for(size_t i = 0; i < length; i++) recon[i] = scanline[i]; break;
         case 1:
+#ifdef __SSE2__
+          if(length % bytewidth == 0 && UNFILTER_PIXELS(unfilterSub, bytewidth, recon, scanline, length)) break;
+#endif
           for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i];
           for(size_t i = bytewidth; i <    length; i++) recon[i] = scanline[i] + recon[i - bytewidth];
           break;
         case 2:
+#ifdef __SSE2__
+          if(precon) unfilterUp(recon, scanline, precon, length);
+#else
           if(precon) for(size_t i = 0; i < length; i++) recon[i] = scanline[i] + precon[i];
+#endif
           else       for(size_t i = 0; i < length; i++) recon[i] = scanline[i];
           break;
         case 3:
+#ifdef __SSE2__
+          if(precon && length % bytewidth == 0 && UNFILTER_PIXELS(unfilterAverage, bytewidth, recon, scanline, precon, length)) break;
+#endif
           if(precon)
           {
             for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + precon[i] / 2;
@@ -384,6 +635,9 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
           }
           break;
         case 4:
+#ifdef __SSE2__
+          if(precon && length % bytewidth == 0 && UNFILTER_PIXELS(unfilterPaeth, bytewidth, recon, scanline, precon, length)) break;
+#endif
           if(precon)
           {
             for(size_t i =         0; i < bytewidth; i++) recon[i] = scanline[i] + paethPredictor(0, precon[i], 0);
@@ -516,6 +770,14 @@ int PNGParser::load(const unsigned char *buffer, size_t size, PNG& png) {
   // decode PNG
   PNGDecoder decoder; 
   decoder.decode(png.pixels, buffer, size, convert_to_rgba32);
+
+  // a failed decode may leave a partial image behind
+  if( decoder.error ) {
+    png.width = png.height = 0;
+    png.pixels.clear();
+    return decoder.error;
+  }
+
   png.width = decoder.info.width; 
   png.height = decoder.info.height;
   
@@ -554,10 +816,762 @@ int PNGParser::load(const char* filename, PNG& png) {
 
 }
 
-int PNGParser::save(const char *filename, const PNG& png) {
+int PNGParser::info(const unsigned char* buffer, size_t size, int& width, int& height) {
+
+  // signature and IHDR chunk, as checked by the decoder
+  static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  if(!buffer || size < 29) return 27;
+  if(memcmp(buffer, signature, 8)) return 28;
+  if(memcmp(buffer + 12, "IHDR", 4)) return 29;
+
+  unsigned long w = ((unsigned long) buffer[16] << 24) | (buffer[17] << 16) | (buffer[18] << 8) | buffer[19];
+  unsigned long h = ((unsigned long) buffer[20] << 24) | (buffer[21] << 16) | (buffer[22] << 8) | buffer[23];
+  if(!w || !h || w > 0x7fffffff || h > 0x7fffffff) return 29;
+  width = w; height = h;
+  return 0;
+}
+
+// Encoder routines //
+
+// Deflate //
+
+// Settings of a compression level: match candidates checked per search,
+// whether a match is deferred when the next byte starts a longer one, the
+// match length that ends a search, the longest match whose positions are
+// all hashed, and the filter of every row (-1 picks the best one per row).
+struct DeflateLevel {
+  int chain;
+  bool lazy;
+  int nice;
+  int max_insert;
+  int filter;
+};
+
+static const DeflateLevel kDeflateLevels[10] = {
+  {    0, false,   0,   0,  0 }, // stored
+  {    1, false,  16,   4,  2 }, // fastest: Up filter, one candidate
+  {    4, false,  32, 258, -1 },
+  {    8, false,  64, 258, -1 },
+  {    8, true,   64, 258, -1 },
+  {   16, true,  128, 258, -1 },
+  {   32, true,  128, 258, -1 }, // default
+  {   64, true,  258, 258, -1 },
+  {  256, true,  258, 258, -1 },
+  { 1024, true,  258, 258, -1 },
+};
+
+static const int kWindowSize = 1 << 15;
+static const int kHashBits = 15;
+static const int kMinMatch = 3, kMaxMatch = 258;
+
+// tokens per block, a match is stored as length << 16 | distance
+static const size_t kBlockTokens = 1 << 15;
+
+// filtered bytes per band (whole rows), each band is compressed on its own
+static const size_t kBandSize = 1 << 20;
+
+// length and distance to the index of their deflate symbol
+struct SymbolTables {
+
+  unsigned char length[kMaxMatch + 1];
+  unsigned char distance[512];
+
+  SymbolTables() {
+    for( int code = 0; code < 29; code++ ) {
+      for( int l = kLengthBase[code]; l < kLengthBase[code] + (1 << kLengthExtra[code]) && l <= kMaxMatch; l++ ) {
+        length[l] = code;
+      }
+    }
+    // distances up to 256 directly, longer ones by their top bits (all
+    // codes from 257 on have at least 7 extra bits)
+    for( int code = 0; code < 30; code++ ) {
+      for( int d = kDistBase[code]; d < kDistBase[code] + (1 << kDistExtra[code]); d++ ) {
+        if( d <= 256 ) distance[d - 1] = code;
+        else distance[256 + ((d - 1) >> 7)] = code;
+      }
+    }
+  }
+
+  inline int distanceCode( unsigned d ) const {
+    return d <= 256 ? distance[d - 1] : distance[256 + ((d - 1) >> 7)];
+  }
+};
+
+// Lengths of a Huffman code of at most limit bits for the given symbol
+// frequencies (0 for unused symbols). At least two symbols get a code, so
+// the code is always complete.
+static void buildCodeLengths( const uint32_t* freq, int n, int limit, unsigned char* lengths ) {
+
+  memset( lengths, 0, n );
+
+  // leaves by increasing frequency
+  vector< pair<uint32_t, int> > leaves;
+  for( int i = 0; i < n; i++ ) {
+    if( freq[i] ) leaves.push_back( make_pair( freq[i], i ) );
+  }
+  for( int i = 0; leaves.size() < 2 && i < n; i++ ) {
+    if( !freq[i] ) leaves.push_back( make_pair( 0u, i ) );
+  }
+  sort( leaves.begin(), leaves.end() );
+
+  // Huffman tree with two queues, since the internal nodes are created in
+  // order of increasing weight as well. Parents come after their children.
+  size_t m = leaves.size(), root = 2 * m - 2;
+  vector<uint64_t> weight( 2 * m - 1 );
+  vector<size_t> parent( 2 * m - 1 );
+  for( size_t i = 0; i < m; i++ ) weight[i] = leaves[i].first;
+  size_t leaf = 0, node = m;
+  for( size_t k = m; k <= root; k++ ) {
+    size_t child[2];
+    for( int j = 0; j < 2; j++ ) {
+      if( leaf < m && (node >= k || weight[leaf] <= weight[node]) ) child[j] = leaf++;
+      else child[j] = node++;
+    }
+    weight[k] = weight[child[0]] + weight[child[1]];
+    parent[child[0]] = parent[child[1]] = k;
+  }
+  vector<int> depth( 2 * m - 1 );
+  depth[root] = 0;
+  for( size_t k = root; k-- > 0; ) depth[k] = depth[parent[k]] + 1;
+
+  // Number of codes of each length. Codes longer than the limit are cut
+  // to it, then codes are moved down a level until the lengths fit.
+  int count[16] = { 0 };
+  for( size_t i = 0; i < m; i++ ) count[min( depth[i], limit )]++;
+  uint32_t total = 0;
+  for( int len = 1; len <= limit; len++ ) total += count[len] << (limit - len);
+  while( total > (1u << limit) ) {
+    count[limit]--;
+    for( int len = limit - 1; len > 0; len-- ) {
+      if( count[len] ) {
+        count[len]--;
+        count[len + 1] += 2;
+        break;
+      }
+    }
+    total--;
+  }
+
+  // longest codes for the rarest symbols
+  size_t i = 0;
+  for( int len = limit; len > 0; len-- ) {
+    for( int k = 0; k < count[len]; k++ ) lengths[leaves[i++].second] = len;
+  }
+}
+
+// canonical codes of the given lengths, bit reversed for writing
+static void buildCodes( const unsigned char* lengths, int n, uint16_t* codes ) {
+
+  int count[16] = { 0 };
+  for( int i = 0; i < n; i++ ) count[lengths[i]]++;
+  count[0] = 0;
+
+  int next[16], code = 0;
+  for( int len = 1; len < 16; len++ ) {
+    code = (code + count[len - 1]) << 1;
+    next[len] = code;
+  }
+
+  for( int i = 0; i < n; i++ ) {
+    int len = lengths[i];
+    if( !len ) continue;
+    int c = next[len]++, reversed = 0;
+    for( int b = 0; b < len; b++ ) reversed |= ((c >> b) & 1) << (len - 1 - b);
+    codes[i] = reversed;
+  }
+}
+
+// Writes the deflate stream least significant bit first
+struct BitWriter {
+
+  BitWriter( vector<unsigned char>& out ) : out ( out ), bits ( 0 ), count ( 0 ) { }
+
+  // write the low n bits (at most 32) of value
+  inline void put( uint32_t value, int n ) {
+    bits |= (uint64_t) value << count;
+    count += n;
+    if( count >= 32 ) {
+      unsigned char b[4] = {
+        (unsigned char) bits,         (unsigned char) (bits >> 8),
+        (unsigned char) (bits >> 16), (unsigned char) (bits >> 24)
+      };
+      out.insert( out.end(), b, b + 4 );
+      bits >>= 32; count -= 32;
+    }
+  }
+
+  // pad with zero bits to a byte boundary
+  void align() {
+    for( ; count > 0; count -= 8 ) {
+      out.push_back( (unsigned char) bits );
+      bits >>= 8;
+    }
+    bits = 0; count = 0;
+  }
+
+  vector<unsigned char>& out;
+  uint64_t bits; int count;
+};
+
+static inline uint32_t hash3( const unsigned char* p ) {
+  uint32_t v = p[0] | p[1] << 8 | p[2] << 16;
+  return (v * 2654435761u) >> (32 - kHashBits);
+}
+
+// Compresses data with hash chains over a 32K window into blocks with
+// dynamic codes, or stored blocks where those come out smaller. The
+// stream starts with an empty window and ends on a byte boundary, either
+// with the final block or with an empty stored block, so that streams of
+// consecutive parts of the data can be concatenated.
+struct Deflater {
+
+  Deflater( const DeflateLevel& level, BitWriter& out )
+    : level ( level ), out ( out ) { }
+
+  void compress( const unsigned char* data, size_t size, bool final ) {
+
+    if( !level.chain ) {
+      writeStored( data, size, final );
+      out.align();
+      return;
+    }
+
+    this->data = data; this->size = size;
+    head.assign( 1 << kHashBits, -1 );
+    prev.resize( kWindowSize );
+    tokens.clear(); tokens.reserve( kBlockTokens );
+    memset( lit_freq, 0, sizeof(lit_freq) );
+    memset( dist_freq, 0, sizeof(dist_freq) );
+
+    size_t i = 0, block_start = 0;
+    int pending_length = 0, pending_distance = 0;
+    while( i < size ) {
+
+      if( tokens.size() >= kBlockTokens ) {
+        writeBlock( data + block_start, i - block_start, false );
+        block_start = i;
+      }
+
+      // the match at i may have been found looking ahead
+      int length, distance;
+      if( pending_length ) {
+        length = pending_length; distance = pending_distance;
+        pending_length = 0;
+      } else {
+        findMatch( i, length, distance );
+      }
+      insert( i );
+
+      // emit a literal instead if the next byte starts a longer match
+      if( level.lazy && length >= kMinMatch && length < level.nice ) {
+        int next_length, next_distance;
+        findMatch( i + 1, next_length, next_distance );
+        if( next_length > length ) {
+          literal( data[i++] );
+          pending_length = next_length; pending_distance = next_distance;
+          continue;
+        }
+      }
+
+      if( length >= kMinMatch ) {
+        match( length, distance );
+        size_t end = i + length;
+        if( length <= level.max_insert ) {
+          for( i++; i < end; i++ ) insert( i );
+        }
+        i = end;
+      } else {
+        literal( data[i++] );
+      }
+    }
+    writeBlock( data + block_start, size - block_start, final );
+
+    // byte align with an empty stored block
+    if( !final ) writeStored( NULL, 0, false );
+    out.align();
+  }
+
+ private:
+
+  inline void insert( size_t i ) {
+    if( i + kMinMatch > size ) return;
+    uint32_t h = hash3( data + i );
+    prev[i & (kWindowSize - 1)] = head[h];
+    head[h] = (int) i;
+  }
+
+  // longest match for position i in the window (length 0 if none)
+  inline void findMatch( size_t i, int& length, int& distance ) {
+
+    length = 0; distance = 0;
+    size_t available = size - i;
+    if( available < (size_t) kMinMatch ) return;
+    int max_length = (int) min( available, (size_t) kMaxMatch );
+
+    const unsigned char* p = data + i;
+    long limit = (long) i - kWindowSize;
+    int best = kMinMatch - 1, chain = level.chain;
+    for( long candidate = head[hash3( p )];
+         candidate >= 0 && candidate >= limit && chain-- > 0;
+         candidate = prev[candidate & (kWindowSize - 1)] ) {
+
+      const unsigned char* q = data + candidate;
+      if( q[best] != p[best] || q[0] != p[0] || q[1] != p[1] ) continue;
+
+      int len = 2;
+      while( len + 8 <= max_length && load64le( q + len ) == load64le( p + len ) ) len += 8;
+      while( len < max_length && q[len] == p[len] ) len++;
+
+      if( len > best ) {
+        best = len; length = len; distance = (int) (i - candidate);
+        if( len >= level.nice || len == max_length ) break;
+      }
+    }
+  }
+
+  inline void literal( unsigned char c ) {
+    tokens.push_back( c );
+    lit_freq[c]++;
+  }
+
+  inline void match( int length, int distance ) {
+    tokens.push_back( (uint32_t) length << 16 | distance );
+    lit_freq[257 + symbols.length[length]]++;
+    dist_freq[symbols.distanceCode( distance )]++;
+  }
+
+  void writeStored( const unsigned char* raw, size_t n, bool final ) {
+    do {
+      size_t chunk = min( n, (size_t) 65535 );
+      out.put( final && chunk == n, 1 );
+      out.put( 0, 2 );
+      out.align();
+      out.put( chunk, 16 );
+      out.put( ~chunk & 0xFFFF, 16 );
+      out.out.insert( out.out.end(), raw, raw + chunk );
+      raw += chunk; n -= chunk;
+    } while( n );
+  }
+
+  // write the buffered tokens, which encode raw[0, n)
+  void writeBlock( const unsigned char* raw, size_t n, bool final ) {
+
+    static const unsigned char order[19] = {
+      16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+    };
+    static const unsigned char code_extra[19] = {
+      0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7
+    };
+
+    lit_freq[256] = 1;
+    unsigned char lengths[286 + 30];
+    unsigned char* lit_len = lengths; unsigned char* dist_len = lengths + 286;
+    buildCodeLengths( lit_freq, 286, 15, lit_len );
+    buildCodeLengths( dist_freq, 30, 15, dist_len );
+    int nlen = 286, ndist = 30;
+    while( nlen > 257 && !lit_len[nlen - 1] ) nlen--;
+    while( ndist > 1 && !dist_len[ndist - 1] ) ndist--;
+
+    // run length encoded code lengths of both codes
+    unsigned char all[286 + 30];
+    memcpy( all, lit_len, nlen );
+    memcpy( all + nlen, dist_len, ndist );
+    int n_all = nlen + ndist, n_runs = 0;
+    unsigned char run_symbol[286 + 30], run_extra[286 + 30];
+    uint32_t code_freq[19] = { 0 };
+    for( int i = 0; i < n_all; ) {
+      int v = all[i], run = 1;
+      while( i + run < n_all && all[i + run] == v ) run++;
+      if( v == 0 && run >= 3 ) {
+        int r = min( run, 138 );
+        run_symbol[n_runs] = r >= 11 ? 18 : 17;
+        run_extra[n_runs++] = r >= 11 ? r - 11 : r - 3;
+        i += r;
+      } else if( v != 0 && run >= 4 ) {
+        run_symbol[n_runs] = v; run_extra[n_runs++] = 0;
+        int r = min( run - 1, 6 );
+        run_symbol[n_runs] = 16; run_extra[n_runs++] = r - 3;
+        i += 1 + r;
+      } else {
+        run_symbol[n_runs] = v; run_extra[n_runs++] = 0;
+        i++;
+      }
+    }
+    for( int i = 0; i < n_runs; i++ ) code_freq[run_symbol[i]]++;
+    unsigned char code_len[19];
+    buildCodeLengths( code_freq, 19, 7, code_len );
+    int ncode = 19;
+    while( ncode > 4 && !code_len[order[ncode - 1]] ) ncode--;
+
+    // size of the block with the dynamic code and as stored blocks
+    uint64_t dynamic_bits = 3 + 14 + 3 * ncode;
+    for( int i = 0; i < 19; i++ ) dynamic_bits += code_freq[i] * (code_len[i] + code_extra[i]);
+    for( int i = 0; i < 286; i++ ) {
+      dynamic_bits += (uint64_t) lit_freq[i] * (lit_len[i] + (i > 256 ? kLengthExtra[i - 257] : 0));
+    }
+    for( int i = 0; i < 30; i++ ) {
+      dynamic_bits += (uint64_t) dist_freq[i] * (dist_len[i] + kDistExtra[i]);
+    }
+    uint64_t stored_bits = 8 * (n + 5 * max( (size_t) 1, (n + 65534) / 65535 )) + 7;
+
+    if( stored_bits < dynamic_bits ) {
+      writeStored( raw, n, final );
+    } else {
+
+      // header
+      out.put( final, 1 );
+      out.put( 2, 2 );
+      out.put( nlen - 257, 5 );
+      out.put( ndist - 1, 5 );
+      out.put( ncode - 4, 4 );
+      for( int i = 0; i < ncode; i++ ) out.put( code_len[order[i]], 3 );
+      uint16_t code_codes[19];
+      buildCodes( code_len, 19, code_codes );
+      for( int i = 0; i < n_runs; i++ ) {
+        int s = run_symbol[i];
+        out.put( code_codes[s], code_len[s] );
+        if( code_extra[s] ) out.put( run_extra[i], code_extra[s] );
+      }
+
+      // data
+      uint16_t lit_codes[286], dist_codes[30];
+      buildCodes( lit_len, 286, lit_codes );
+      buildCodes( dist_len, 30, dist_codes );
+      for( size_t i = 0; i < tokens.size(); i++ ) {
+        uint32_t t = tokens[i];
+        if( t < 256 ) {
+          out.put( lit_codes[t], lit_len[t] );
+          continue;
+        }
+        int length = t >> 16, distance = t & 0xFFFF;
+        int l = symbols.length[length], d = symbols.distanceCode( distance );
+        out.put( lit_codes[257 + l], lit_len[257 + l] );
+        if( kLengthExtra[l] ) out.put( length - kLengthBase[l], kLengthExtra[l] );
+        out.put( dist_codes[d], dist_len[d] );
+        if( kDistExtra[d] ) out.put( distance - kDistBase[d], kDistExtra[d] );
+      }
+      out.put( lit_codes[256], lit_len[256] );
+    }
+
+    tokens.clear();
+    memset( lit_freq, 0, sizeof(lit_freq) );
+    memset( dist_freq, 0, sizeof(dist_freq) );
+  }
+
+  static const SymbolTables symbols;
+
+  const DeflateLevel& level;
+  BitWriter& out;
+
+  const unsigned char* data; size_t size;
+  vector<int> head, prev;
+
+  // block being compressed
+  vector<uint32_t> tokens;
+  uint32_t lit_freq[286], dist_freq[30];
+};
+
+const SymbolTables Deflater::symbols;
+
+// Checksums //
+
+// CRC-32 tables for eight bytes at a time: table[k][n] is the checksum of
+// byte n followed by k zero bytes
+struct CRCTable {
+  uint32_t table[8][256];
+  CRCTable() {
+    for( uint32_t n = 0; n < 256; n++ ) {
+      uint32_t c = n;
+      for( int k = 0; k < 8; k++ ) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+      table[0][n] = c;
+    }
+    for( uint32_t n = 0; n < 256; n++ ) {
+      for( int k = 1; k < 8; k++ ) {
+        table[k][n] = table[0][table[k - 1][n] & 0xFF] ^ (table[k - 1][n] >> 8);
+      }
+    }
+  }
+};
+
+static uint32_t crc32( uint32_t crc, const unsigned char* p, size_t n ) {
+  static const CRCTable crc_table;
+  const uint32_t (*t)[256] = crc_table.table;
+  crc = ~crc;
+  for( ; n >= 8; p += 8, n -= 8 ) {
+    uint32_t lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24);
+    crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+          t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+  }
+  for( ; n; p++, n-- ) crc = t[0][(crc ^ *p) & 0xFF] ^ (crc >> 8);
+  return ~crc;
+}
+
+static const uint32_t kAdlerBase = 65521;
+
+static uint32_t adler32( uint32_t adler, const unsigned char* p, size_t n ) {
+  uint32_t a = adler & 0xFFFF, b = adler >> 16;
+  while( n ) {
+    // largest run that can not overflow b
+    size_t run = min( n, (size_t) 5552 );
+    for( size_t i = 0; i < run; i++ ) {
+      a += p[i]; b += a;
+    }
+    a %= kAdlerBase; b %= kAdlerBase;
+    p += run; n -= run;
+  }
+  return b << 16 | a;
+}
+
+// checksum of two parts of the data from their own checksums, n being the
+// size of the second part
+static uint32_t adler32Combine( uint32_t adler1, uint32_t adler2, size_t n ) {
+  uint64_t rem = n % kAdlerBase;
+  uint64_t a1 = adler1 & 0xFFFF, b1 = adler1 >> 16;
+  uint64_t a2 = adler2 & 0xFFFF, b2 = adler2 >> 16;
+  uint64_t a = (a1 + a2 + kAdlerBase - 1) % kAdlerBase;
+  uint64_t b = (b1 + b2 + rem * a1 + kAdlerBase - rem) % kAdlerBase;
+  return (uint32_t) (b << 16 | a);
+}
+
+// Filter //
+
+static void filterRow( int type, unsigned char* out, const unsigned char* row,
+                       const unsigned char* prev, size_t length, size_t bpp ) {
+  switch( type ) {
+    case 0:
+      memcpy( out, row, length );
+      break;
+    case 1:
+      for( size_t i = 0; i < bpp; i++ ) out[i] = row[i];
+      for( size_t i = bpp; i < length; i++ ) out[i] = row[i] - row[i - bpp];
+      break;
+    case 2:
+      for( size_t i = 0; i < length; i++ ) out[i] = row[i] - prev[i];
+      break;
+    case 3:
+      for( size_t i = 0; i < bpp; i++ ) out[i] = row[i] - (prev[i] >> 1);
+      for( size_t i = bpp; i < length; i++ ) out[i] = row[i] - ((row[i - bpp] + prev[i]) >> 1);
+      break;
+    case 4: {
+      for( size_t i = 0; i < bpp; i++ ) out[i] = row[i] - prev[i];
+      size_t i = bpp;
+#ifdef __SSE2__
+      // the whole row is known, so unlike unfiltering this runs 8 bytes
+      // at a time (same predictor as unfilterPaeth)
+      const __m128i zero = _mm_setzero_si128();
+      for( ; i + 8 <= length; i += 8 ) {
+        __m128i a = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) (row + i - bpp) ), zero );
+        __m128i b = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) (prev + i) ), zero );
+        __m128i c = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i*) (prev + i - bpp) ), zero );
+        __m128i pa = _mm_sub_epi16( b, c );
+        __m128i pb = _mm_sub_epi16( a, c );
+        __m128i pc = _mm_add_epi16( pa, pb );
+        pa = _mm_max_epi16( pa, _mm_sub_epi16( zero, pa ) );
+        pb = _mm_max_epi16( pb, _mm_sub_epi16( zero, pb ) );
+        pc = _mm_max_epi16( pc, _mm_sub_epi16( zero, pc ) );
+        __m128i smallest = _mm_min_epi16( pc, _mm_min_epi16( pa, pb ) );
+        __m128i use_a = _mm_cmpeq_epi16( smallest, pa );
+        __m128i use_b = _mm_andnot_si128( use_a, _mm_cmpeq_epi16( smallest, pb ) );
+        __m128i use_c = _mm_andnot_si128( _mm_or_si128( use_a, use_b ), _mm_set1_epi16( -1 ) );
+        __m128i prediction = _mm_or_si128( _mm_or_si128( _mm_and_si128( use_a, a ),
+                                                         _mm_and_si128( use_b, b ) ),
+                                           _mm_and_si128( use_c, c ) );
+        __m128i x = _mm_sub_epi8( _mm_loadl_epi64( (const __m128i*) (row + i) ),
+                                  _mm_packus_epi16( prediction, zero ) );
+        _mm_storel_epi64( (__m128i*) (out + i), x );
+      }
+#endif
+      for( ; i < length; i++ ) {
+        int a = row[i - bpp], b = prev[i], c = prev[i - bpp];
+        int pa = abs( b - c ), pb = abs( a - c ), pc = abs( a + b - 2 * c );
+        out[i] = row[i] - (pa <= pb && pa <= pc ? a : pb <= pc ? b : c);
+      }
+      break;
+    }
+  }
+}
+
+// sum of the filtered bytes taken as signed values, without their signs
+static size_t filterScore( const unsigned char* p, size_t length ) {
+  size_t sum = 0, i = 0;
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  __m128i total = zero;
+  for( ; i + 16 <= length; i += 16 ) {
+    __m128i v = _mm_loadu_si128( (const __m128i*) (p + i) );
+    total = _mm_add_epi64( total, _mm_sad_epu8( _mm_min_epu8( v, _mm_sub_epi8( zero, v ) ), zero ) );
+  }
+  sum = _mm_cvtsi128_si32( total ) + _mm_cvtsi128_si32( _mm_srli_si128( total, 8 ) );
+#endif
+  for( ; i < length; i++ ) sum += p[i] < 128 ? p[i] : 256 - p[i];
+  return sum;
+}
+
+// Filters a row with the filter that gives the smallest sum of absolute
+// (signed) values, the heuristic suggested by the PNG specification.
+static void filterRowAdaptive( unsigned char* out, unsigned char* scratch,
+                               const unsigned char* row, const unsigned char* prev,
+                               size_t length, size_t bpp ) {
+  size_t best_sum = ~(size_t) 0; int best = 0;
+  for( int type = 0; type < 5; type++ ) {
+    unsigned char* candidate = scratch + type * length;
+    filterRow( type, candidate, row, prev, length, bpp );
+    size_t sum = filterScore( candidate, length );
+    if( sum < best_sum ) {
+      best_sum = sum;
+      best = type;
+    }
+  }
+  out[0] = best;
+  memcpy( out + 1, scratch + best * length, length );
+}
+
+// Encoder //
+
+static void put32( vector<unsigned char>& out, uint32_t v ) {
+  unsigned char b[4] = {
+    (unsigned char) (v >> 24), (unsigned char) (v >> 16),
+    (unsigned char) (v >> 8),  (unsigned char) v
+  };
+  out.insert( out.end(), b, b + 4 );
+}
+
+static void writeChunk( vector<unsigned char>& out, const char* type,
+                        const unsigned char* data, size_t size ) {
+  size_t start = out.size();
+  put32( out, size );
+  out.insert( out.end(), type, type + 4 );
+  out.insert( out.end(), data, data + size );
+  put32( out, crc32( 0, &out[start + 4], size + 4 ) );
+}
+
+// row y in the pixel format of the file (rgb or rgba)
+static const unsigned char* imageRow( const PNG& png, int y, size_t bpp, unsigned char* buffer ) {
+  const unsigned char* p = &png.pixels[(size_t) y * png.width * 4];
+  if( bpp == 4 ) return p;
+  for( int x = 0; x < png.width; x++ ) {
+    buffer[3 * x + 0] = p[4 * x + 0];
+    buffer[3 * x + 1] = p[4 * x + 1];
+    buffer[3 * x + 2] = p[4 * x + 2];
+  }
+  return buffer;
+}
+
+int PNGParser::encode( const PNG& png, std::vector<unsigned char>& out, int level ) {
+
+  if( png.width <= 0 || png.height <= 0 ||
+      png.pixels.size() != (size_t) png.width * png.height * 4 ) return -1;
+  const DeflateLevel& settings = kDeflateLevels[max( 0, min( 9, level ) )];
+
+  // opaque images are written without alpha
+  bool opaque = true;
+  for( size_t i = 3; i < png.pixels.size() && opaque; i += 4 ) {
+    opaque = png.pixels[i] == 255;
+  }
+  size_t bpp = opaque ? 3 : 4, length = png.width * bpp;
+
+  // Bands of rows are filtered and compressed in parallel, each into an
+  // IDAT chunk of its own. The zlib header goes in front of the first band
+  // and the checksum into a last chunk.
+  struct Band {
+    int begin, end;
+    size_t size;
+    uint32_t adler;
+    vector<unsigned char> chunk;
+  };
+  int rows = (int) max( (size_t) 1, kBandSize / (length + 1) );
+  vector<Band> bands ( (png.height + rows - 1) / rows );
+  for( size_t b = 0; b < bands.size(); b++ ) {
+    bands[b].begin = b * rows;
+    bands[b].end = min( png.height, (int) (b + 1) * rows );
+  }
+
+  ThreadPool::shared().parallel_for( bands.size(), [&]( size_t b ) {
+
+    Band& band = bands[b];
+    vector<unsigned char> filtered( (band.end - band.begin) * (length + 1) );
+    vector<unsigned char> row_buffer( 2 * length ), zeros( length );
+    vector<unsigned char> scratch( settings.filter < 0 ? 5 * length : 0 );
+
+    unsigned char* out_row = &filtered[0];
+    for( int y = band.begin; y < band.end; y++, out_row += length + 1 ) {
+      const unsigned char* prev = y ? imageRow( png, y - 1, bpp, &row_buffer[0] ) : &zeros[0];
+      const unsigned char* row = imageRow( png, y, bpp, &row_buffer[length] );
+      if( settings.filter < 0 ) {
+        filterRowAdaptive( out_row, &scratch[0], row, prev, length, bpp );
+      } else {
+        out_row[0] = settings.filter;
+        filterRow( settings.filter, out_row + 1, row, prev, length, bpp );
+      }
+    }
+    band.size = filtered.size();
+    band.adler = adler32( 1, &filtered[0], filtered.size() );
+
+    // chunk length and type, filled in below
+    vector<unsigned char>& chunk = band.chunk;
+    chunk.reserve( filtered.size() / 2 + 1024 );
+    chunk.resize( 8 );
+    memcpy( &chunk[4], "IDAT", 4 );
+    if( b == 0 ) {
+      static const unsigned char flags[10] = {
+        0x01, 0x01, 0x5E, 0x5E, 0x5E, 0x5E, 0x9C, 0xDA, 0xDA, 0xDA
+      };
+      chunk.push_back( 0x78 );
+      chunk.push_back( flags[&settings - kDeflateLevels] );
+    }
+
+    BitWriter writer ( chunk );
+    Deflater deflater ( settings, writer );
+    deflater.compress( &filtered[0], filtered.size(), b + 1 == bands.size() );
+
+    uint32_t size = chunk.size() - 8;
+    chunk[0] = size >> 24; chunk[1] = size >> 16; chunk[2] = size >> 8; chunk[3] = size;
+    put32( chunk, crc32( 0, &chunk[4], size + 4 ) );
+  });
+
+  // header
+  static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+  out.assign( signature, signature + 8 );
+  unsigned char header[13] = {
+    (unsigned char) (png.width >> 24),  (unsigned char) (png.width >> 16),
+    (unsigned char) (png.width >> 8),   (unsigned char) png.width,
+    (unsigned char) (png.height >> 24), (unsigned char) (png.height >> 16),
+    (unsigned char) (png.height >> 8),  (unsigned char) png.height,
+    8, (unsigned char) (opaque ? 2 : 6), 0, 0, 0
+  };
+  writeChunk( out, "IHDR", header, 13 );
+
+  // data
+  size_t total = 0;
+  for( size_t b = 0; b < bands.size(); b++ ) total += bands[b].chunk.size();
+  out.reserve( out.size() + total + 64 );
+  uint32_t adler = bands[0].adler;
+  for( size_t b = 0; b < bands.size(); b++ ) {
+    out.insert( out.end(), bands[b].chunk.begin(), bands[b].chunk.end() );
+    if( b ) adler = adler32Combine( adler, bands[b].adler, bands[b].size );
+  }
+  unsigned char checksum[4] = {
+    (unsigned char) (adler >> 24), (unsigned char) (adler >> 16),
+    (unsigned char) (adler >> 8),  (unsigned char) adler
+  };
+  writeChunk( out, "IDAT", checksum, 4 );
+  writeChunk( out, "IEND", NULL, 0 );
+
   return 0;
 }
 
+int PNGParser::save( const char* filename, const PNG& png, int level ) {
+
+  std::vector<unsigned char> buffer;
+  int error = encode( png, buffer, level );
+  if( error ) return error;
+
+  std::ofstream file( filename, std::ios::out | std::ios::binary );
+  file.write( (const char*) &buffer[0], buffer.size() );
+  return file.good() ? 0 : -1;
+}
+
+
 
 } // namespace CMU462
 
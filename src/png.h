@@ -20,7 +20,16 @@ class PNGParser {
  public:
   static int load( const unsigned char* buffer, size_t size, PNG& png );
   static int load( const char* filename, PNG& png );
-  static int save( const char* filename, const PNG& png );
+
+  // read the size of an image from its header, without decoding it.
+  // Returns 0 on success.
+  static int info( const unsigned char* buffer, size_t size, int& width, int& height );
+
+  // Encode at a level from 0 (no compression) to 9 (smallest output).
+  // Level 1 is the fast path for bulk output. Large images are encoded in
+  // parallel. Returns 0 on success, -1 for invalid images or files.
+  static int encode( const PNG& png, std::vector<unsigned char>& out, int level = 6 );
+  static int save( const char* filename, const PNG& png, int level = 6 );
 }; // class PNGParser
 
 } // namespace CMU462
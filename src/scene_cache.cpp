@@ -0,0 +1,899 @@
+#include "svg.h"
+#include "thread_pool.h"
+#include "png.h"
+
+#include <list>
+#include <string>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#include <process.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+/*
+ * Binary scene format
+ *
+ * A loaded document as flat arrays of fixed size records that are mapped
+ * back and copied into place, so loading does no parsing and none of the
+ * work done after parsing (level of detail chains and the BVH are stored).
+ * Images are stored compressed, as they are loaded, and decoded when they
+ * are drawn. The format is a cache for the machine that wrote it:
+ * values are stored in native byte order and the header records the
+ * sizes that the layout depends on.
+ *
+ *   header
+ *   sections, each starting at a multiple of 16 bytes:
+ *     elements      document order, a group followed by its children
+ *     lod levels    simplified point arrays of the elements
+ *     textures      the textures of the images
+ *     mip levels    the levels of textures without compressed images
+ *     leaves        bounds and parent group of the BVH leaves
+ *     groups        parent group of each group
+ *     nodes         BVH nodes
+ *     order         BVH leaf order
+ *     points        all point arrays
+ *     data          compressed images, mip levels and path commands
+ */
+
+static const char kSceneMagic[8] = { 'D', 'R', 'A', 'W', 'S', 'V', 'G', 'B' };
+static const uint32_t kSceneVersion = 3;
+static const uint32_t kByteOrder = 0x01020304;
+static const size_t kSectionAlign = 16;
+
+enum {
+  ELEMENTS = 0, LOD_LEVELS, TEXTURES, MIP_LEVELS,
+  LEAVES, GROUPS, NODES, ORDER, POINTS, DATA,
+  NUM_SECTIONS
+};
+
+struct SceneSection {
+  uint64_t offset, count;
+};
+
+struct SceneHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t point_size;
+  uint32_t top_level;     // number of top level elements
+  float width, height;
+  uint64_t source_size;   // svg file the scene was loaded from
+  uint64_t source_hash;
+  SceneSection sections[NUM_SECTIONS];
+};
+
+struct ElementRecord {
+  uint32_t type;
+  uint32_t children;      // groups: number of direct children
+  float stroke[4], fill[4];
+  float stroke_width, miter_limit;
+  double transform[9];
+  double data[4];         // position and dimension, end points, center and radius
+  uint64_t points, count; // range in the points section
+  uint32_t lod_first, lod_count;
+  float bounds[4], length, area;
+  uint32_t texture;       // images: index into the textures section
+  uint32_t evenodd;       // paths: fill rule
+  uint64_t commands, command_count; // paths: byte range in the data section
+};
+
+struct LODRecord {
+  uint64_t points, count;
+  float error;
+  uint32_t padding;
+};
+
+struct TextureRecord {
+  uint64_t width, height;
+  uint64_t data, size;    // compressed image, byte range in the data section
+  uint32_t mip_first, mip_count;
+};
+
+struct MipRecord {
+  uint64_t width, height;
+  uint64_t texels, size;  // byte range in the data section
+};
+
+struct LeafRecord {
+  float bounds[4];
+  int32_t parent;
+};
+
+struct NodeRecord {
+  float bounds[4];
+  int32_t start, end, right;
+};
+
+static const size_t kRecordSize[NUM_SECTIONS] = {
+  sizeof(ElementRecord), sizeof(LODRecord), sizeof(TextureRecord),
+  sizeof(MipRecord), sizeof(LeafRecord), sizeof(int32_t),
+  sizeof(NodeRecord), sizeof(int32_t), sizeof(Vector2D), 1
+};
+
+// Mapped files //
+
+// Read-only view of a whole file, mapped where possible
+struct MappedFile {
+
+  MappedFile() : data ( NULL ), size ( 0 ) { }
+
+  ~MappedFile() {
+#ifndef _WIN32
+    if( data && size ) munmap( (void*) data, size );
+#endif
+  }
+
+  bool open( const char* filename ) {
+#ifndef _WIN32
+    int fd = ::open( filename, O_RDONLY );
+    if( fd < 0 ) return false;
+    struct stat st;
+    if( fstat( fd, &st ) < 0 || !S_ISREG( st.st_mode ) ) {
+      ::close( fd );
+      return false;
+    }
+    size = st.st_size;
+    if( size ) {
+      void* map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+      if( map == MAP_FAILED ) {
+        ::close( fd );
+        size = 0;
+        return false;
+      }
+      data = (const unsigned char*) map;
+    }
+    ::close( fd );
+#else
+    FILE* file = fopen( filename, "rb" );
+    if( !file ) return false;
+    fseek( file, 0, SEEK_END );
+    contents.resize( max( 0L, ftell( file ) ) );
+    fseek( file, 0, SEEK_SET );
+    contents.resize( fread( contents.data(), 1, contents.size(), file ) );
+    fclose( file );
+    data = contents.data(); size = contents.size();
+#endif
+    return true;
+  }
+
+  const unsigned char* data; size_t size;
+#ifdef _WIN32
+  std::vector<unsigned char> contents;
+#endif
+
+ private:
+  MappedFile( const MappedFile& );
+  MappedFile& operator=( const MappedFile& );
+};
+
+// Content hash //
+
+// 64-bit hash of the source file, built from the xxHash64 round function
+// over four independent lanes so that it runs at memory speed.
+static const uint64_t kPrime1 = 11400714785074694791ULL;
+static const uint64_t kPrime2 = 14029467366897019727ULL;
+static const uint64_t kPrime3 = 1609587929392839161ULL;
+static const uint64_t kPrime4 = 9650029242287828579ULL;
+static const uint64_t kPrime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl( uint64_t x, int r ) {
+  return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t load64( const unsigned char* p ) {
+  uint64_t v; memcpy( &v, p, 8 );
+  return v;
+}
+
+static inline uint64_t round64( uint64_t acc, uint64_t input ) {
+  return rotl( acc + input * kPrime2, 31 ) * kPrime1;
+}
+
+static uint64_t hashContents( const unsigned char* p, size_t size ) {
+
+  const unsigned char* end = p + size;
+  uint64_t h;
+  if( size >= 32 ) {
+    uint64_t v1 = kPrime1 + kPrime2, v2 = kPrime2, v3 = 0, v4 = 0 - kPrime1;
+    for( ; end - p >= 32; p += 32 ) {
+      v1 = round64( v1, load64( p ) );
+      v2 = round64( v2, load64( p + 8 ) );
+      v3 = round64( v3, load64( p + 16 ) );
+      v4 = round64( v4, load64( p + 24 ) );
+    }
+    h = rotl( v1, 1 ) + rotl( v2, 7 ) + rotl( v3, 12 ) + rotl( v4, 18 );
+    uint64_t lanes[4] = { v1, v2, v3, v4 };
+    for( int i = 0; i < 4; i++ ) h = (h ^ round64( 0, lanes[i] )) * kPrime1 + kPrime4;
+  } else {
+    h = kPrime5;
+  }
+  h += size;
+
+  for( ; end - p >= 8; p += 8 ) h = rotl( h ^ round64( 0, load64( p ) ), 27 ) * kPrime1 + kPrime4;
+  for( ; p < end; p++ ) h = rotl( h ^ (*p * kPrime5), 11 ) * kPrime1;
+
+  h ^= h >> 33; h *= kPrime2;
+  h ^= h >> 29; h *= kPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+// Writer //
+
+// Flattens a document into the record arrays of the format. Point arrays
+// and image data are not copied, they are written from the elements.
+struct SceneWriter {
+
+  SceneWriter() : points ( 0 ), bytes ( 0 ) { }
+
+  void add( const vector<SVGElement*>& elements ) {
+
+    for( size_t i = 0; i < elements.size(); ++i ) {
+
+      const SVGElement* element = elements[i];
+      ElementRecord r;
+      memset( &r, 0, sizeof(r) );
+      r.type = element->type;
+
+      const Style& style = element->style;
+      float stroke[4] = { style.strokeColor.r, style.strokeColor.g, style.strokeColor.b, style.strokeColor.a };
+      float fill[4] = { style.fillColor.r, style.fillColor.g, style.fillColor.b, style.fillColor.a };
+      memcpy( r.stroke, stroke, sizeof(stroke) );
+      memcpy( r.fill, fill, sizeof(fill) );
+      r.stroke_width = style.strokeWidth;
+      r.miter_limit = style.miterLimit;
+      for( int k = 0; k < 9; k++ ) r.transform[k] = element->transform( k / 3, k % 3 );
+
+      switch( element->type ) {
+        case POINT:
+          setData( r, static_cast<const Point*>(element)->position, Vector2D() );
+          break;
+        case LINE:
+          setData( r, static_cast<const Line*>(element)->from,
+                      static_cast<const Line*>(element)->to );
+          break;
+        case RECT:
+          setData( r, static_cast<const Rect*>(element)->position,
+                      static_cast<const Rect*>(element)->dimension );
+          break;
+        case ELLIPSE:
+          setData( r, static_cast<const Ellipse*>(element)->center,
+                      static_cast<const Ellipse*>(element)->radius );
+          break;
+        case POLYLINE:
+          addPoints( r, static_cast<const Polyline*>(element)->points,
+                        static_cast<const Polyline*>(element)->lod );
+          break;
+        case POLYGON:
+          addPoints( r, static_cast<const Polygon*>(element)->points,
+                        static_cast<const Polygon*>(element)->lod );
+          break;
+        case IMAGE: {
+          const Image* image = static_cast<const Image*>(element);
+          setData( r, image->position, image->dimension );
+          addImage( r, *image );
+          break;
+        }
+        case PATH:
+          addPath( r, *static_cast<const Path*>(element) );
+          break;
+        case GROUP:
+          r.children = static_cast<const Group*>(element)->elements.size();
+          break;
+        default:
+          break;
+      }
+
+      records.push_back( r );
+      if( element->type == GROUP ) add( static_cast<const Group*>(element)->elements );
+    }
+  }
+
+  static void setData( ElementRecord& r, const Vector2D& a, const Vector2D& b ) {
+    r.data[0] = a.x; r.data[1] = a.y;
+    r.data[2] = b.x; r.data[3] = b.y;
+  }
+
+  uint64_t addRun( const vector<Vector2D>& run ) {
+    uint64_t first = points;
+    if( !run.empty() ) point_runs.push_back( &run );
+    points += run.size();
+    return first;
+  }
+
+  void addPoints( ElementRecord& r, const vector<Vector2D>& p, const LODChain& chain ) {
+
+    // the levels, built if the svg has none yet (kept alive for the write)
+    const LODChain* built = &chain;
+    if( !chain.is_built() ) {
+      chains.push_back( chain );
+      chains.back().build_levels( p );
+      built = &chains.back();
+    }
+    const LODChain& lod = *built;
+
+    r.points = addRun( p );
+    r.count = p.size();
+    r.lod_first = lods.size();
+    r.lod_count = lod.levels.size();
+    for( size_t i = 0; i < lod.levels.size(); ++i ) {
+      LODRecord l;
+      memset( &l, 0, sizeof(l) );
+      l.points = addRun( lod.levels[i] );
+      l.count = lod.levels[i].size();
+      l.error = lod.errors[i];
+      lods.push_back( l );
+    }
+    float bounds[4] = { lod.bounds.xmin, lod.bounds.ymin, lod.bounds.xmax, lod.bounds.ymax };
+    memcpy( r.bounds, bounds, sizeof(bounds) );
+    r.length = lod.length;
+    r.area = lod.area;
+  }
+
+  uint64_t addBytes( const vector<unsigned char>& run ) {
+    uint64_t first = bytes;
+    byte_runs.push_back( &run );
+    bytes += (run.size() + kSectionAlign - 1) / kSectionAlign * kSectionAlign;
+    return first;
+  }
+
+  // the compressed image, or the levels of images that have none
+  void addImage( ElementRecord& r, const Image& image ) {
+    const Texture& tex = image.tex;
+    r.texture = textures.size();
+    TextureRecord t;
+    memset( &t, 0, sizeof(t) );
+    t.width = tex.width; t.height = tex.height;
+    t.mip_first = mips.size();
+    if( !image.data.empty() ) {
+      t.data = addBytes( image.data );
+      t.size = image.data.size();
+    } else {
+      t.mip_count = tex.mipmap.size();
+      for( size_t i = 0; i < tex.mipmap.size(); ++i ) {
+        const MipLevel& level = tex.mipmap[i];
+        MipRecord m;
+        m.width = level.width; m.height = level.height;
+        m.size = level.texels.size();
+        m.texels = addBytes( level.texels );
+        mips.push_back( m );
+      }
+    }
+    textures.push_back( t );
+  }
+
+  void addPath( ElementRecord& r, const Path& path ) {
+    r.points = addRun( path.data.points );
+    r.count = path.data.points.size();
+    r.commands = addBytes( path.data.commands );
+    r.command_count = path.data.commands.size();
+    float bounds[4] = { path.bounds.xmin, path.bounds.ymin, path.bounds.xmax, path.bounds.ymax };
+    memcpy( r.bounds, bounds, sizeof(bounds) );
+    r.evenodd = path.evenodd;
+  }
+
+  vector<ElementRecord> records;
+  vector<LODRecord> lods;
+  vector<TextureRecord> textures;
+  vector<MipRecord> mips;
+
+  vector<const vector<Vector2D>*> point_runs;
+  vector<const vector<unsigned char>*> byte_runs;
+  uint64_t points, bytes;
+
+  // level of detail chains built for the write (their runs are pointed to)
+  list<LODChain> chains;
+};
+
+static bool writePadding( FILE* file, size_t& offset ) {
+  static const char zeros[kSectionAlign] = { 0 };
+  size_t padding = (kSectionAlign - offset % kSectionAlign) % kSectionAlign;
+  offset += padding;
+  return fwrite( zeros, 1, padding, file ) == padding;
+}
+
+static bool writeSection( FILE* file, size_t& offset, const void* data, size_t size ) {
+  offset += size;
+  return !size || fwrite( data, 1, size, file ) == size;
+}
+
+int SVGParser::writeScene( const char* filename, const SVG* svg,
+                           uint64_t source_size, uint64_t source_hash ) {
+
+  SceneWriter writer;
+  writer.add( svg->elements );
+
+  // the hierarchy, built if the svg has none yet
+  BVH built;
+  const BVH* bvh = &svg->bvh;
+  if( !bvh->is_built() ) {
+    built.build( *svg );
+    bvh = &built;
+  }
+  vector<LeafRecord> leaves( bvh->leaves.size() );
+  for( size_t i = 0; i < leaves.size(); ++i ) {
+    const BBox& b = bvh->leaves[i].bounds;
+    float bounds[4] = { b.xmin, b.ymin, b.xmax, b.ymax };
+    memcpy( leaves[i].bounds, bounds, sizeof(bounds) );
+    leaves[i].parent = bvh->leaves[i].parent;
+  }
+  vector<int32_t> groups( bvh->groups.size() );
+  for( size_t i = 0; i < groups.size(); ++i ) groups[i] = bvh->groups[i].parent;
+  vector<NodeRecord> nodes( bvh->nodes.size() );
+  for( size_t i = 0; i < nodes.size(); ++i ) {
+    const BVH::Node& n = bvh->nodes[i];
+    float bounds[4] = { n.bounds.xmin, n.bounds.ymin, n.bounds.xmax, n.bounds.ymax };
+    memcpy( nodes[i].bounds, bounds, sizeof(bounds) );
+    nodes[i].start = n.start; nodes[i].end = n.end; nodes[i].right = n.right;
+  }
+  vector<int32_t> order( bvh->order.begin(), bvh->order.end() );
+
+  SceneHeader header;
+  memset( &header, 0, sizeof(header) );
+  memcpy( header.magic, kSceneMagic, sizeof(kSceneMagic) );
+  header.version = kSceneVersion;
+  header.byte_order = kByteOrder;
+  header.point_size = sizeof(Vector2D);
+  header.top_level = svg->elements.size();
+  header.width = svg->width;
+  header.height = svg->height;
+  header.source_size = source_size;
+  header.source_hash = source_hash;
+
+  const void* data[NUM_SECTIONS] = {
+    writer.records.data(), writer.lods.data(), writer.textures.data(),
+    writer.mips.data(), leaves.data(), groups.data(), nodes.data(),
+    order.data(), NULL, NULL
+  };
+  uint64_t counts[NUM_SECTIONS] = {
+    writer.records.size(), writer.lods.size(), writer.textures.size(),
+    writer.mips.size(), leaves.size(), groups.size(), nodes.size(),
+    order.size(), writer.points, writer.bytes
+  };
+  size_t offset = sizeof(header);
+  for( int s = 0; s < NUM_SECTIONS; ++s ) {
+    offset = (offset + kSectionAlign - 1) / kSectionAlign * kSectionAlign;
+    header.sections[s].offset = offset;
+    header.sections[s].count = counts[s];
+    offset += counts[s] * kRecordSize[s];
+  }
+
+  // written next to the destination and moved into place when complete,
+  // under a name of this process so that concurrent writers do not mix
+#ifndef _WIN32
+  int pid = getpid();
+#else
+  int pid = _getpid();
+#endif
+  string temporary = string( filename ) + "." + to_string( pid ) + ".tmp";
+  FILE* file = fopen( temporary.c_str(), "wb" );
+  if( !file ) return -1;
+
+  offset = 0;
+  bool ok = writeSection( file, offset, &header, sizeof(header) );
+  for( int s = 0; s < POINTS && ok; ++s ) {
+    ok = writePadding( file, offset ) &&
+         writeSection( file, offset, data[s], counts[s] * kRecordSize[s] );
+  }
+  ok = ok && writePadding( file, offset );
+  for( size_t i = 0; i < writer.point_runs.size() && ok; ++i ) {
+    const vector<Vector2D>& run = *writer.point_runs[i];
+    ok = writeSection( file, offset, run.data(), run.size() * sizeof(Vector2D) );
+  }
+  ok = ok && writePadding( file, offset );
+  for( size_t i = 0; i < writer.byte_runs.size() && ok; ++i ) {
+    const vector<unsigned char>& run = *writer.byte_runs[i];
+    ok = writeSection( file, offset, run.data(), run.size() ) &&
+         writePadding( file, offset );
+  }
+  ok = fclose( file ) == 0 && ok;
+
+  if( ok && rename( temporary.c_str(), filename ) ) {
+    // rename does not replace files everywhere
+    remove( filename );
+    ok = !rename( temporary.c_str(), filename );
+  }
+  if( !ok ) {
+    remove( temporary.c_str() );
+    return -1;
+  }
+
+  return 0;
+}
+
+int SVGParser::save( const char* filename, const SVG* svg ) {
+  return writeScene( filename, svg, 0, 0 );
+}
+
+// Reader //
+
+// section s of a validated scene as an array of records
+template< typename T >
+static inline const T* section( const MappedFile& file, const SceneHeader& header, int s ) {
+  return (const T*) (file.data + header.sections[s].offset);
+}
+
+// bound on level sizes, so that their byte sizes can not overflow
+static const uint64_t kMaxLevelSize = 1 << 30;
+
+static inline bool inRange( uint64_t first, uint64_t count, uint64_t size ) {
+  return first <= size && count <= size - first;
+}
+
+// Checks that a scene is complete and that all its references are in range,
+// so that building the document can not fail.
+static bool validScene( const MappedFile& file ) {
+
+  if( file.size < sizeof(SceneHeader) ) return false;
+  const SceneHeader& header = *(const SceneHeader*) file.data;
+  if( memcmp( header.magic, kSceneMagic, sizeof(kSceneMagic) ) ||
+      header.version != kSceneVersion || header.byte_order != kByteOrder ||
+      header.point_size != sizeof(Vector2D) ) return false;
+
+  for( int s = 0; s < NUM_SECTIONS; ++s ) {
+    const SceneSection& section = header.sections[s];
+    if( section.offset % kSectionAlign ||
+        section.count > file.size / kRecordSize[s] ||
+        !inRange( section.offset, section.count * kRecordSize[s], file.size ) ) return false;
+  }
+  const SceneSection* sections = header.sections;
+
+  const ElementRecord* records = section<ElementRecord>( file, header, ELEMENTS );
+  const LODRecord* lods = section<LODRecord>( file, header, LOD_LEVELS );
+  const TextureRecord* textures = section<TextureRecord>( file, header, TEXTURES );
+  const MipRecord* mips = section<MipRecord>( file, header, MIP_LEVELS );
+  const unsigned char* data = section<unsigned char>( file, header, DATA );
+
+  // the elements form the tree announced by the header, with counts that
+  // match the hierarchy
+  vector<uint64_t> open ( 1, header.top_level );
+  uint64_t leaves = 0, groups = 0;
+  for( uint64_t i = 0; i < sections[ELEMENTS].count; ++i ) {
+
+    while( !open.empty() && !open.back() ) open.pop_back();
+    if( open.empty() ) return false;
+    open.back()--;
+
+    const ElementRecord& r = records[i];
+    if( r.type < POINT || r.type > PATH ) return false;
+    if( r.type == GROUP ) {
+      groups++;
+      open.push_back( r.children );
+      continue;
+    }
+    leaves++;
+
+    if( r.type == POLYLINE || r.type == POLYGON ) {
+      if( !inRange( r.points, r.count, sections[POINTS].count ) ||
+          !inRange( r.lod_first, r.lod_count, sections[LOD_LEVELS].count ) ) return false;
+      for( uint32_t l = r.lod_first; l < r.lod_first + r.lod_count; ++l ) {
+        if( !inRange( lods[l].points, lods[l].count, sections[POINTS].count ) ) return false;
+      }
+    }
+
+    // commands must take exactly the points of the path
+    if( r.type == PATH ) {
+      if( !inRange( r.points, r.count, sections[POINTS].count ) ||
+          !inRange( r.commands, r.command_count, sections[DATA].count ) ||
+          PathData::count_points( data + r.commands, r.command_count ) != (int64_t) r.count ) return false;
+    }
+
+    if( r.type == IMAGE ) {
+      if( r.texture >= sections[TEXTURES].count ) return false;
+      const TextureRecord& t = textures[r.texture];
+      if( !inRange( t.data, t.size, sections[DATA].count ) ||
+          !inRange( t.mip_first, t.mip_count, sections[MIP_LEVELS].count ) ) return false;
+      if( t.size ) {
+        // images are decoded later, their headers must agree with the record
+        int width, height;
+        if( PNGParser::info( data + t.data, t.size, width, height ) ||
+            (uint64_t) width != t.width || (uint64_t) height != t.height ||
+            t.width > kMaxLevelSize || t.height > kMaxLevelSize ) return false;
+      }
+      for( uint32_t m = t.mip_first; m < t.mip_first + t.mip_count; ++m ) {
+        if( !inRange( mips[m].texels, mips[m].size, sections[DATA].count ) ||
+            mips[m].width > kMaxLevelSize || mips[m].height > kMaxLevelSize ||
+            mips[m].size != 4 * mips[m].width * mips[m].height ) return false;
+      }
+    }
+  }
+  for( size_t i = 0; i < open.size(); ++i ) {
+    if( open[i] ) return false;
+  }
+
+  // hierarchy
+  if( sections[LEAVES].count != leaves || sections[GROUPS].count != groups ||
+      sections[ORDER].count != leaves ) return false;
+  const LeafRecord* leaf_records = section<LeafRecord>( file, header, LEAVES );
+  const int32_t* group_parents = section<int32_t>( file, header, GROUPS );
+  for( uint64_t i = 0; i < leaves; ++i ) {
+    if( leaf_records[i].parent < -1 || leaf_records[i].parent >= (int64_t) groups ) return false;
+  }
+  for( uint64_t i = 0; i < groups; ++i ) {
+    if( group_parents[i] < -1 || group_parents[i] >= (int64_t) i ) return false;
+  }
+  const int32_t* order = section<int32_t>( file, header, ORDER );
+  for( uint64_t i = 0; i < leaves; ++i ) {
+    if( order[i] < 0 || order[i] >= (int64_t) leaves ) return false;
+  }
+
+  // nodes form a depth first tree with the first child next, with a depth
+  // that fits the query stack
+  const NodeRecord* nodes = section<NodeRecord>( file, header, NODES );
+  uint64_t n = sections[NODES].count;
+  if( !n != !leaves ) return false;
+  vector<int> depth ( n, -1 );
+  if( n ) depth[0] = 0;
+  for( uint64_t i = 0; i < n; ++i ) {
+    const NodeRecord& node = nodes[i];
+    if( depth[i] < 0 ) return false;
+    if( node.start < 0 || node.start > node.end || node.end > (int64_t) leaves ) return false;
+    if( node.right < 0 ) continue;
+    if( node.right <= (int64_t) i + 1 || node.right >= (int64_t) n ) return false;
+    if( depth[i] >= 32 || depth[i + 1] >= 0 || depth[node.right] >= 0 ) return false;
+    depth[i + 1] = depth[node.right] = depth[i] + 1;
+  }
+
+  return true;
+}
+
+// Builds the document from a validated scene, returns the next record
+static uint64_t buildElements( const MappedFile& file, const SceneHeader& header,
+                               uint64_t index, uint64_t count, SVG* svg,
+                               vector<SVGElement*>& elements,
+                               vector<SVGElement*>& leaves, vector<Group*>& groups,
+                               vector<Image*>& images ) {
+
+  const ElementRecord* records = section<ElementRecord>( file, header, ELEMENTS );
+  const LODRecord* lods = section<LODRecord>( file, header, LOD_LEVELS );
+  const Vector2D* points = section<Vector2D>( file, header, POINTS );
+  const unsigned char* data = section<unsigned char>( file, header, DATA );
+
+  elements.reserve( count );
+  for( uint64_t i = 0; i < count; ++i ) {
+
+    const ElementRecord& r = records[index++];
+    Vector2D a ( r.data[0], r.data[1] ), b ( r.data[2], r.data[3] );
+
+    SVGElement* element = NULL;
+    switch( r.type ) {
+      case POINT: {
+        Point* point = svg->arena.create<Point>();
+        point->position = a;
+        element = point;
+        break;
+      }
+      case LINE: {
+        Line* line = svg->arena.create<Line>();
+        line->from = a; line->to = b;
+        element = line;
+        break;
+      }
+      case RECT: {
+        Rect* rect = svg->arena.create<Rect>();
+        rect->position = a; rect->dimension = b;
+        element = rect;
+        break;
+      }
+      case ELLIPSE: {
+        Ellipse* ellipse = svg->arena.create<Ellipse>();
+        ellipse->center = a; ellipse->radius = b;
+        element = ellipse;
+        break;
+      }
+      case POLYLINE:
+      case POLYGON: {
+        vector<Vector2D>* p; LODChain* lod;
+        if( r.type == POLYLINE ) {
+          Polyline* polyline = svg->arena.create<Polyline>();
+          p = &polyline->points; lod = &polyline->lod;
+          element = polyline;
+        } else {
+          Polygon* polygon = svg->arena.create<Polygon>();
+          p = &polygon->points; lod = &polygon->lod;
+          element = polygon;
+        }
+        p->assign( points + r.points, points + r.points + r.count );
+        lod->levels.resize( r.lod_count );
+        lod->errors.resize( r.lod_count );
+        for( uint32_t l = 0; l < r.lod_count; ++l ) {
+          const LODRecord& level = lods[r.lod_first + l];
+          lod->levels[l].assign( points + level.points, points + level.points + level.count );
+          lod->errors[l] = level.error;
+        }
+        lod->bounds = BBox( r.bounds[0], r.bounds[1], r.bounds[2], r.bounds[3] );
+        lod->length = r.length;
+        lod->area = r.area;
+        lod->closed = r.type == POLYGON;
+        lod->built = true;
+        break;
+      }
+      case IMAGE: {
+        Image* image = svg->arena.create<Image>();
+        image->position = a; image->dimension = b;
+        images.push_back( image );
+        element = image;
+        break;
+      }
+      case PATH: {
+        Path* path = svg->arena.create<Path>();
+        path->data.commands.assign( data + r.commands, data + r.commands + r.command_count );
+        path->data.points.assign( points + r.points, points + r.points + r.count );
+        path->bounds = BBox( r.bounds[0], r.bounds[1], r.bounds[2], r.bounds[3] );
+        path->evenodd = r.evenodd != 0;
+        element = path;
+        break;
+      }
+      case GROUP: {
+        Group* group = svg->arena.create<Group>();
+        element = group;
+        break;
+      }
+    }
+
+    element->style.strokeColor = Color( r.stroke[0], r.stroke[1], r.stroke[2], r.stroke[3] );
+    element->style.fillColor = Color( r.fill[0], r.fill[1], r.fill[2], r.fill[3] );
+    element->style.strokeWidth = r.stroke_width;
+    element->style.miterLimit = r.miter_limit;
+    for( int k = 0; k < 9; k++ ) element->transform( k / 3, k % 3 ) = r.transform[k];
+    elements.push_back( element );
+
+    // groups are listed before their children, leaves in document order
+    if( r.type == GROUP ) {
+      Group* group = static_cast<Group*>(element);
+      groups.push_back( group );
+      index = buildElements( file, header, index, r.children, svg,
+                             group->elements, leaves, groups, images );
+    } else {
+      leaves.push_back( element );
+    }
+  }
+
+  return index;
+}
+
+bool SVGParser::isScene( const char* filename ) {
+
+  char magic[sizeof(kSceneMagic)];
+  FILE* file = fopen( filename, "rb" );
+  if( !file ) return false;
+  bool scene = fread( magic, 1, sizeof(magic), file ) == sizeof(magic) &&
+               !memcmp( magic, kSceneMagic, sizeof(magic) );
+  fclose( file );
+  return scene;
+}
+
+int SVGParser::readScene( const char* filename, SVG* svg, bool check_source,
+                          uint64_t source_size, uint64_t source_hash ) {
+
+  MappedFile file;
+  if( !file.open( filename ) || !validScene( file ) ) return -1;
+
+  const SceneHeader& header = *(const SceneHeader*) file.data;
+  if( check_source && (source_size != header.source_size ||
+                       source_hash != header.source_hash) ) return -1;
+
+  svg->width = header.width;
+  svg->height = header.height;
+
+  vector<SVGElement*> leaves; vector<Group*> groups; vector<Image*> images;
+  buildElements( file, header, 0, header.top_level, svg, svg->elements,
+                 leaves, groups, images );
+
+  // image data is the bulk of image heavy scenes, it is copied in parallel
+  const MipRecord* mips = section<MipRecord>( file, header, MIP_LEVELS );
+  const unsigned char* data = section<unsigned char>( file, header, DATA );
+  ThreadPool::shared().parallel_for( images.size(), [&]( size_t i ) {
+    const TextureRecord& t = section<TextureRecord>( file, header, TEXTURES )[i];
+    Image& image = *images[i];
+    if( t.size ) {
+      image.data.assign( data + t.data, data + t.data + t.size );
+      ImageCache::init_texture( image.tex, t.width, t.height );
+      return;
+    }
+    image.tex.width = t.width;
+    image.tex.height = t.height;
+    image.tex.mipmap.resize( t.mip_count );
+    for( uint32_t m = 0; m < t.mip_count; ++m ) {
+      const MipRecord& mip = mips[t.mip_first + m];
+      MipLevel& level = image.tex.mipmap[m];
+      level.width = mip.width;
+      level.height = mip.height;
+      level.texels.assign( data + mip.texels, data + mip.texels + mip.size );
+    }
+  });
+
+  // hierarchy
+  BVH& bvh = svg->bvh;
+  const LeafRecord* leaf_records = section<LeafRecord>( file, header, LEAVES );
+  bvh.leaves.resize( leaves.size() );
+  for( size_t i = 0; i < leaves.size(); ++i ) {
+    const LeafRecord& l = leaf_records[i];
+    bvh.leaves[i].element = leaves[i];
+    bvh.leaves[i].parent = l.parent;
+    bvh.leaves[i].bounds = BBox( l.bounds[0], l.bounds[1], l.bounds[2], l.bounds[3] );
+  }
+  const int32_t* group_parents = section<int32_t>( file, header, GROUPS );
+  bvh.groups.resize( groups.size() );
+  for( size_t i = 0; i < groups.size(); ++i ) {
+    bvh.groups[i].group = groups[i];
+    bvh.groups[i].parent = group_parents[i];
+  }
+  const NodeRecord* nodes = section<NodeRecord>( file, header, NODES );
+  bvh.nodes.resize( header.sections[NODES].count );
+  for( size_t i = 0; i < bvh.nodes.size(); ++i ) {
+    const NodeRecord& n = nodes[i];
+    bvh.nodes[i].bounds = BBox( n.bounds[0], n.bounds[1], n.bounds[2], n.bounds[3] );
+    bvh.nodes[i].start = n.start; bvh.nodes[i].end = n.end; bvh.nodes[i].right = n.right;
+  }
+  const int32_t* order = section<int32_t>( file, header, ORDER );
+  bvh.order.assign( order, order + header.sections[ORDER].count );
+  bvh.built = true;
+
+  return 0;
+}
+
+string SVGParser::cachePath( const char* filename, const string& cache_dir ) {
+
+#ifndef _WIN32
+  char resolved[PATH_MAX];
+  string path = realpath( filename, resolved ) ? resolved : filename;
+  const char* separators = "/";
+#else
+  char resolved[_MAX_PATH];
+  string path = _fullpath( resolved, filename, _MAX_PATH ) ? resolved : filename;
+  const char* separators = "/\\";
+#endif
+  uint64_t hash = hashContents( (const unsigned char*) path.data(), path.size() );
+
+  char suffix[32];
+  snprintf( suffix, sizeof(suffix), ".%016llx.cache", (unsigned long long) hash );
+  string dir = cache_dir;
+  if( !dir.empty() && dir[dir.size() - 1] != '/' ) dir.push_back( '/' );
+  return dir + path.substr( path.find_last_of( separators ) + 1 ) + suffix;
+}
+
+int SVGParser::makeCacheDir( const string& cache_dir ) {
+#ifndef _WIN32
+  int error = mkdir( cache_dir.c_str(), 0755 );
+#else
+  int error = _mkdir( cache_dir.c_str() );
+#endif
+  return error && errno != EEXIST ? -1 : 0;
+}
+
+int SVGParser::loadCached( const char* filename, SVG* svg, const string& cache_dir ) {
+
+  MappedFile source;
+  if( !source.open( filename ) ) return -1;
+  uint64_t hash = hashContents( source.data, source.size );
+
+  string cache = cachePath( filename, cache_dir );
+  if( !readScene( cache.c_str(), svg, true, source.size, hash ) ) return 0;
+
+  // missing or stale
+  if( load( filename, svg ) < 0 ) return -1;
+  if( writeScene( cache.c_str(), svg, source.size, hash ) < 0 ) {
+    cerr << "Warning: could not write " << cache << endl;
+  }
+
+  return 0;
+}
+
+} // namespace CMU462
@@ -7,8 +7,6 @@
 #include <chrono>
 #include <thread>
 
-#define RasterDetectStep 0.2
-#define Fzero 1e-2
 #include "triangulation.h"
 
 using namespace std;
@@ -17,18 +15,151 @@ using namespace std;
 namespace CMU462
 {
 
+	// size (in pixels) of the tiles occlusion is tracked in
+	static const int kOcclusionTile = 16;
+
+	// half the width of lines drawn as quads, in pixels
+	static const float kLineHalfWidth = 0.6f;
+
+	// Triangles are rasterized in sample space, with their vertices snapped
+	// to 1/256 of a sample. Triangles reaching further out than the guard
+	// band (in samples) are clipped to it first, which keeps the edge
+	// functions within 64 bits.
+	static const int64_t kSubpixels = 1 << 8;
+	static const double kGuardBand = 1 << 21;
+
+	// division rounding down and up, for positive divisors
+	static inline int64_t floor_div(int64_t a, int64_t b)
+	{
+		return a >= 0 ? a / b : -((-a + b - 1) / b);
+	}
+
+	static inline int64_t ceil_div(int64_t a, int64_t b)
+	{
+		return floor_div(a + b - 1, b);
+	}
+
+	static inline double seconds_since(chrono::steady_clock::time_point start)
+	{
+		return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+
 	// Implements SoftwareRenderer //
 
 	void SoftwareRendererImp::draw_svg(SVG& svg)
 	{
-		clear_sample();
+		int dx, dy;
+		bool scrolled;
+		{
+			INSTRUMENT(StageTimer timer(profiling, frame_stats.time[FrameStats::RESOLVE]));
+			INSTRUMENT(TraceSpan span(trace, "scroll"));
+			scrolled = !overdraw && scroll_samples(svg, dx, dy);
+		}
+		if (scrolled)
+		{
+			// only draw the strips uncovered by the shift
+			int width = target_w, height = target_h;
+			if (dy > 0)
+				draw_region(svg, 0, 0, width, dy);
+			if (dy < 0)
+				draw_region(svg, 0, height + dy, width, height);
+			if (dx > 0)
+				draw_region(svg, 0, max(dy, 0), dx, height + min(dy, 0));
+			if (dx < 0)
+				draw_region(svg, width + dx, max(dy, 0), width, height + min(dy, 0));
+		}
+		else
+		{
+			draw_region(svg, 0, 0, target_w, target_h);
+		}
+
+		last_svg = &svg;
+		last_svg_2_screen = svg_2_screen;
+		last_w = target_w;
+		last_h = target_h;
+		last_rate = sample_rate;
+
+		// resolve and send to render target
+		resolve(0, target_h);
+	}
+
+	void SoftwareRendererImp::draw_rows(SVG& svg, int y0, int y1)
+	{
+		y0 = max(y0, 0);
+		y1 = min(y1, (int)target_h);
+		if (y0 >= y1)
+			return;
+
+		// the other rows may hold samples of another view or rate
+		last_svg = NULL;
+
+		draw_region(svg, 0, y0, target_w, y1);
+		resolve(y0, y1);
+	}
+
+	void SoftwareRendererImp::draw_tile_costs(SVG& svg, int tile_size, vector<double>& seconds)
+	{
+		int columns = (target_w + tile_size - 1) / tile_size;
+		int rows = (target_h + tile_size - 1) / tile_size;
+		seconds.assign(columns * rows, 0);
+		last_svg = NULL;
+
+		for (int ty = 0; ty < rows; ty++)
+			for (int tx = 0; tx < columns; tx++)
+			{
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				draw_region(svg, tx * tile_size, ty * tile_size,
+					min((tx + 1) * tile_size, (int)target_w), min((ty + 1) * tile_size, (int)target_h));
+				seconds[tx + ty * columns] = seconds_since(start);
+			}
+		resolve(0, target_h);
+	}
+
+	void SoftwareRendererImp::draw_region(SVG& svg, int x0, int y0, int x1, int y1)
+	{
+		// the time not spent in the other stages is traversal
+		INSTRUMENT(TraceSpan span(trace, "draw region"));
+		INSTRUMENT(chrono::steady_clock::time_point start);
+		INSTRUMENT(double stages = 0);
+		INSTRUMENT(if (profiling)
+		{
+			start = chrono::steady_clock::now();
+			stages = frame_stats.time[FrameStats::TRIANGULATION] + frame_stats.time[FrameStats::RASTERIZATION] + frame_stats.time[FrameStats::RESOLVE];
+		});
+
+		clip_x0 = x0;
+		clip_y0 = y0;
+		clip_x1 = x1;
+		clip_y1 = y1;
+		clear_sample(x0, y0, x1, y1);
+
 		// set top level transformation
 		transformation = svg_2_screen;
 
-		// draw all elements
-		for (size_t i = 0; i < svg.elements.size(); ++i)
+		// region bounds in svg space, padded to cover strokes and points
+		// drawn around the edges
+		Matrix3x3 screen_2_svg = svg_2_screen.inv();
+		BBox view;
+		for (int i = 0; i < 4; i++)
+		{
+			float x = (i & 1) ? x1 + 2.f : x0 - 2.f;
+			float y = (i & 2) ? y1 + 2.f : y0 - 2.f;
+			Vector3D p = screen_2_svg * Vector3D(x, y, 1);
+			view.expand(p.x / p.z, p.y / p.z);
+		}
+
+		// draw all elements, only visiting the visible ones when the svg
+		// does not fit in the region or hidden ones are culled
+		if (svg.bvh.is_built() && (occlusion_culling || !view.contains(svg.bvh.bounds())))
+		{
+			draw_visible(svg, view);
+		}
+		else
 		{
-			draw_element(svg.elements[i]);
+			for (size_t i = 0; i < svg.elements.size(); ++i)
+			{
+				draw_element(svg.elements[i]);
+			}
 		}
 
 		// draw canvas outline
@@ -45,13 +176,19 @@ namespace CMU462
 		d.x++;
 		d.y++;
 
-		rasterize_line(a.x, a.y, b.x, b.y, Color::Black);
-		rasterize_line(a.x, a.y, c.x, c.y, Color::Black);
-		rasterize_line(d.x, d.y, b.x, b.y, Color::Black);
-		rasterize_line(d.x, d.y, c.x, c.y, Color::Black);
+		{
+			INSTRUMENT(StageTimer timer(profiling, frame_stats.time[FrameStats::RASTERIZATION]));
+			rasterize_line(a.x, a.y, b.x, b.y, Color::Black);
+			rasterize_line(a.x, a.y, c.x, c.y, Color::Black);
+			rasterize_line(d.x, d.y, b.x, b.y, Color::Black);
+			rasterize_line(d.x, d.y, c.x, c.y, Color::Black);
+		}
 
-		// resolve and send to render target
-		resolve();
+		INSTRUMENT(if (profiling)
+		{
+			stages = frame_stats.time[FrameStats::TRIANGULATION] + frame_stats.time[FrameStats::RASTERIZATION] + frame_stats.time[FrameStats::RESOLVE] - stages;
+			frame_stats.time[FrameStats::TRAVERSAL] += seconds_since(start) - stages;
+		});
 	}
 
 	void SoftwareRendererImp::set_sample_rate(size_t sample_rate)
@@ -81,6 +218,15 @@ namespace CMU462
 		// Modify this to implement the transformation stackS
 		Matrix3x3 Temp = transformation;
 		transformation = transformation * element->transform;
+
+		// drawing a leaf is rasterization, apart from its triangulation
+		INSTRUMENT(frame_stats.elements++);
+		INSTRUMENT(bool timed = profiling && element->type != GROUP);
+		INSTRUMENT(chrono::steady_clock::time_point start);
+		INSTRUMENT(double triangulation = frame_stats.time[FrameStats::TRIANGULATION]);
+		INSTRUMENT(if (timed)
+			start = chrono::steady_clock::now());
+
 		switch (element->type)
 		{
 		case POINT:
@@ -107,9 +253,15 @@ namespace CMU462
 		case GROUP:
 			draw_group(static_cast<Group&>(*element));
 			break;
+		case PATH:
+			draw_path(static_cast<Path&>(*element));
+			break;
 		default:
 			break;
 		}
+
+		INSTRUMENT(if (timed)
+			frame_stats.time[FrameStats::RASTERIZATION] += seconds_since(start) - (frame_stats.time[FrameStats::TRIANGULATION] - triangulation));
 		transformation = Temp;
 	}
 
@@ -135,13 +287,14 @@ namespace CMU462
 
 		Color c = polyline.style.strokeColor;
 
-		if (c.a != 0)
+		if (c.a != 0 && !draw_subpixel(polyline.lod, false, c))
 		{
-			int nPoints = polyline.points.size();
+			const vector<Vector2D>& points = lod_points(polyline.points, polyline.lod);
+			int nPoints = points.size();
 			for (int i = 0; i < nPoints - 1; i++)
 			{
-				Vector2D p0 = transform(polyline.points[(i + 0) % nPoints]);
-				Vector2D p1 = transform(polyline.points[(i + 1) % nPoints]);
+				Vector2D p0 = transform(points[(i + 0) % nPoints]);
+				Vector2D p1 = transform(points[(i + 1) % nPoints]);
 				rasterize_line(p0.x, p0.y, p1.x, p1.y, c);
 			}
 		}
@@ -163,17 +316,49 @@ namespace CMU462
 		Vector2D p2 = transform(Vector2D(x, y + h));
 		Vector2D p3 = transform(Vector2D(x + w, y + h));
 
+		// under scales and translations the rectangle stays axis aligned
+		const Matrix3x3& m = transformation;
+		bool axis_aligned = m(0, 1) == 0 && m(1, 0) == 0 &&
+			m(2, 0) == 0 && m(2, 1) == 0 && m(2, 2) == 1;
+
 		// draw fill
 		c = rect.style.fillColor;
 		if (c.a != 0)
 		{
-			rasterize_triangle(p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, c);
-			rasterize_triangle(p2.x, p2.y, p1.x, p1.y, p3.x, p3.y, c);
+			if (axis_aligned)
+			{
+				rasterize_rect(p0.x, p0.y, p3.x, p3.y, c);
+			}
+			else
+			{
+				rasterize_triangle(p0.x, p0.y, p1.x, p1.y, p2.x, p2.y, c);
+				rasterize_triangle(p2.x, p2.y, p1.x, p1.y, p3.x, p3.y, c);
+			}
 		}
 
 		// draw outline
 		c = rect.style.strokeColor;
-		if (c.a != 0)
+		if (c.a != 0 && axis_aligned && sample_rate > 1)
+		{
+			// four rectangles as wide as rasterize_line draws lines, the
+			// horizontal ones cover the corners so that no sample is blended
+			// twice, and outlines thinner than the lines are one rectangle
+			float left = min(p0.x, p3.x), right = max(p0.x, p3.x);
+			float top = min(p0.y, p3.y), bottom = max(p0.y, p3.y);
+			float w = kLineHalfWidth;
+			if (right - left > 2 * w && bottom - top > 2 * w)
+			{
+				rasterize_rect(left - w, top - w, right + w, top + w, c);
+				rasterize_rect(left - w, bottom - w, right + w, bottom + w, c);
+				rasterize_rect(left - w, top + w, left + w, bottom - w, c);
+				rasterize_rect(right - w, top + w, right + w, bottom - w, c);
+			}
+			else
+			{
+				rasterize_rect(left - w, top - w, right + w, bottom + w, c);
+			}
+		}
+		else if (c.a != 0)
 		{
 			rasterize_line(p0.x, p0.y, p1.x, p1.y, c);
 			rasterize_line(p1.x, p1.y, p3.x, p3.y, c);
@@ -187,14 +372,21 @@ namespace CMU462
 
 		Color c;
 
+		// simplified outline for zoomed out views
+		const vector<Vector2D>& points = lod_points(polygon.points, polygon.lod);
+
 		// draw fill
 		c = polygon.style.fillColor;
-		if (c.a != 0)
+		if (c.a != 0 && !draw_subpixel(polygon.lod, true, c))
 		{
 
 			// triangulate
 			vector<Vector2D> triangles;
-			triangulate(polygon, triangles);
+			{
+				INSTRUMENT(StageTimer timer(profiling, frame_stats.time[FrameStats::TRIANGULATION]));
+				triangulate(points, triangles);
+			}
+			INSTRUMENT(frame_stats.triangles_emitted += triangles.size() / 3);
 
 			// draw as triangles
 			for (size_t i = 0; i < triangles.size(); i += 3)
@@ -208,13 +400,13 @@ namespace CMU462
 
 		// draw outline
 		c = polygon.style.strokeColor;
-		if (c.a != 0)
+		if (c.a != 0 && !draw_subpixel(polygon.lod, false, c))
 		{
-			int nPoints = polygon.points.size();
+			int nPoints = points.size();
 			for (int i = 0; i < nPoints; i++)
 			{
-				Vector2D p0 = transform(polygon.points[(i + 0) % nPoints]);
-				Vector2D p1 = transform(polygon.points[(i + 1) % nPoints]);
+				Vector2D p0 = transform(points[(i + 0) % nPoints]);
+				Vector2D p1 = transform(points[(i + 1) % nPoints]);
 				rasterize_line(p0.x, p0.y, p1.x, p1.y, c);
 			}
 		}
@@ -232,7 +424,21 @@ namespace CMU462
 		Vector2D p0 = transform(image.position);
 		Vector2D p1 = transform(image.position + image.dimension);
 
-		rasterize_image(p0.x, p0.y, p1.x, p1.y, image.tex);
+		// images outside the region are not decoded
+		if (max(p0.x, p1.x) < clip_x0 || min(p0.x, p1.x) >= clip_x1 ||
+			max(p0.y, p1.y) < clip_y0 || min(p0.y, p1.y) >= clip_y1)
+			return;
+
+		// decode the levels rasterize_image samples at this size (computed
+		// as it does, in float)
+		Texture& tex = image.tex;
+		float x0 = p0.x, y0 = p0.y, x1 = p1.x, y1 = p1.y;
+		float L = sqrt(tex.width * tex.height / (x1 - x0) / (y1 - y0));
+		float r = log(L) / log(2);
+		int level = L > 1 ? (int)floor(r) : 0;
+		ImageCache::shared().require(image, level, L > 1 ? level + 1 : 0);
+
+		rasterize_image(x0, y0, x1, y1, tex);
 	}
 
 	void SoftwareRendererImp::draw_group(Group& group)
@@ -244,6 +450,267 @@ namespace CMU462
 		}
 	}
 
+	void SoftwareRendererImp::draw_path(Path& path)
+	{
+
+		Color fill = path.style.fillColor;
+		Color stroke = path.style.strokeColor;
+		if ((fill.a == 0 && stroke.a == 0) || path.bounds.empty())
+			return;
+
+		// paths outside the region are not flattened
+		BBox box;
+		for (int i = 0; i < 4; i++)
+		{
+			Vector2D p = transform(Vector2D((i & 1) ? path.bounds.xmax : path.bounds.xmin,
+			                                (i & 2) ? path.bounds.ymax : path.bounds.ymin));
+			box.expand(p.x, p.y);
+		}
+		if (box.xmax < clip_x0 || box.xmin >= clip_x1 || box.ymax < clip_y0 || box.ymin >= clip_y1)
+			return;
+
+		// flattened for the zoom bucket of the current scale
+		shared_ptr<const FlatPath> flat;
+		{
+			INSTRUMENT(StageTimer timer(profiling, frame_stats.time[FrameStats::TRIANGULATION]));
+			flat = path.flattened.get(path.data, transform_scale());
+		}
+		const vector<uint32_t>& ends = flat->ends;
+		path_points.resize(flat->points.size());
+		for (size_t i = 0; i < path_points.size(); i++)
+			path_points[i] = transform(flat->points[i]);
+
+		// draw fill
+		if (fill.a != 0)
+			rasterize_contours(path_points, ends, path.evenodd, fill);
+
+		// draw outline
+		if (stroke.a != 0)
+		{
+			size_t first = 0;
+			for (size_t c = 0; c < ends.size(); first = ends[c++])
+			{
+				size_t last = ends[c] - 1;
+				for (size_t i = first; i <= last; i++)
+				{
+					if (i == last && !flat->closed[c])
+						break;
+					const Vector2D& p0 = path_points[i];
+					const Vector2D& p1 = path_points[i < last ? i + 1 : first];
+					rasterize_line(p0.x, p0.y, p1.x, p1.y, stroke);
+				}
+			}
+		}
+	}
+
+	// Level of Detail //
+
+	float SoftwareRendererImp::transform_scale()
+	{
+		return sqrt(fabs(transformation(0, 0) * transformation(1, 1) -
+		                 transformation(0, 1) * transformation(1, 0)));
+	}
+
+	const vector<Vector2D>& SoftwareRendererImp::lod_points(const vector<Vector2D>& points,
+		LODChain& lod)
+	{
+		if (lod_budget <= 0)
+			return points;
+
+		lod.build_levels(points);
+		if (lod.levels.empty())
+			return points;
+
+		// convert the pixel budget to element space
+		const vector<Vector2D>* level = lod.select(lod_budget / transform_scale());
+		return level ? *level : points;
+	}
+
+	bool SoftwareRendererImp::draw_subpixel(const LODChain& lod, bool fill, Color color)
+	{
+		if (lod_budget <= 0 || lod.bounds.empty())
+			return false;
+
+		// screen space bounds
+		BBox box;
+		for (int i = 0; i < 4; i++)
+		{
+			Vector2D p = transform(Vector2D((i & 1) ? lod.bounds.xmax : lod.bounds.xmin,
+			                                (i & 2) ? lod.bounds.ymax : lod.bounds.ymin));
+			box.expand(p.x, p.y);
+		}
+		if (box.xmax - box.xmin >= 1 || box.ymax - box.ymin >= 1)
+			return false;
+
+		// weight by the covered fraction of the pixel (outlines are one pixel wide)
+		float scale = transform_scale();
+		float coverage = fill ? lod.area * scale * scale : lod.length * scale;
+		color.a *= min(coverage, 1.f);
+
+		rasterize_point((box.xmin + box.xmax) / 2, (box.ymin + box.ymax) / 2, color);
+		return true;
+	}
+
+	// Incremental Repaint //
+
+	bool SoftwareRendererImp::scroll_samples(const SVG& svg, int& dx, int& dy)
+	{
+		if (last_svg != &svg || last_w != target_w || last_h != target_h || last_rate != sample_rate)
+			return false;
+
+		// the views must only differ by a translation
+		const Matrix3x3& a = last_svg_2_screen;
+		const Matrix3x3& b = svg_2_screen;
+		if (a(0, 0) != b(0, 0) || a(0, 1) != b(0, 1) || a(1, 0) != b(1, 0) || a(1, 1) != b(1, 1) ||
+			a(2, 0) != b(2, 0) || a(2, 1) != b(2, 1) || a(2, 2) != b(2, 2))
+			return false;
+
+		// of a whole number of pixels, up to rounding errors of the viewport
+		double tx = b(0, 2) - a(0, 2), ty = b(1, 2) - a(1, 2);
+		dx = (int)floor(tx + 0.5);
+		dy = (int)floor(ty + 0.5);
+		if (fabs(tx - dx) > 1e-3 || fabs(ty - dy) > 1e-3)
+			return false;
+		if (abs(dx) >= (int)target_w || abs(dy) >= (int)target_h)
+			return false;
+
+		// snap to the exact offset so that kept and redrawn pixels line up
+		svg_2_screen(0, 2) = a(0, 2) + dx;
+		svg_2_screen(1, 2) = a(1, 2) + dy;
+
+		// move the sample rows, walking against the shift so that
+		// rows are read before they are overwritten
+		size_t stride = 4 * target_w * sample_rate;
+		int rows = target_h * sample_rate;
+		int sx = dx * sample_rate, sy = dy * sample_rate;
+		size_t length = stride - 4 * abs(sx);
+		size_t to = 4 * max(sx, 0), from = 4 * max(-sx, 0);
+		if (sy >= 0)
+		{
+			for (int y = rows - 1; y >= sy; y--)
+				memmove(sample_buffer + y * stride + to, sample_buffer + (y - sy) * stride + from, length);
+		}
+		else
+		{
+			for (int y = 0; y < rows + sy; y++)
+				memmove(sample_buffer + y * stride + to, sample_buffer + (y - sy) * stride + from, length);
+		}
+
+		return true;
+	}
+
+	// Culling //
+
+	void SoftwareRendererImp::draw_visible(SVG& svg, const BBox& view)
+	{
+		const BVH& bvh = svg.bvh;
+		bvh.query(view, visible);
+
+		// group transformations are resolved lazily, once per frame
+		frame_stamp++;
+		if (group_stamps.size() < bvh.groups.size())
+		{
+			group_stamps.resize(bvh.groups.size(), 0);
+			group_transforms.resize(bvh.groups.size());
+		}
+
+		if (occlusion_culling)
+			cull_occluded(bvh);
+
+		// draw in painter's order with the transformation stack
+		// the element would have in a full traversal
+		for (size_t i = 0; i < visible.size(); ++i)
+		{
+			if (occlusion_culling && occluded[i])
+				continue;
+			const BVH::Leaf& leaf = bvh.leaves[visible[i]];
+			transformation = leaf.parent < 0 ? svg_2_screen : group_transform(bvh, leaf.parent);
+			draw_element(leaf.element);
+		}
+
+		transformation = svg_2_screen;
+	}
+
+	const Matrix3x3& SoftwareRendererImp::group_transform(const BVH& bvh, int group)
+	{
+		if (group_stamps[group] != frame_stamp)
+		{
+			const BVH::GroupEntry& entry = bvh.groups[group];
+			Matrix3x3 parent = entry.parent < 0 ? svg_2_screen : group_transform(bvh, entry.parent);
+			group_transforms[group] = parent * entry.group->transform;
+			group_stamps[group] = frame_stamp;
+		}
+		return group_transforms[group];
+	}
+
+	void SoftwareRendererImp::cull_occluded(const BVH& bvh)
+	{
+		int columns = (clip_x1 - clip_x0 + kOcclusionTile - 1) / kOcclusionTile;
+		int rows = (clip_y1 - clip_y0 + kOcclusionTile - 1) / kOcclusionTile;
+		covered_tiles.assign(columns * rows, 0);
+		occluded.assign(visible.size(), 0);
+
+		// front to back, so that occluders are seen before what they hide
+		for (size_t i = visible.size(); i-- > 0;)
+		{
+			const BVH::Leaf& leaf = bvh.leaves[visible[i]];
+			if (leaf.bounds.empty())
+				continue;
+
+			// tiles of the screen bounds, padded for strokes and points
+			// drawn around them (as the view is in draw_region)
+			BBox box;
+			for (int k = 0; k < 4; k++)
+			{
+				Vector3D p = svg_2_screen * Vector3D((k & 1) ? leaf.bounds.xmax : leaf.bounds.xmin,
+					(k & 2) ? leaf.bounds.ymax : leaf.bounds.ymin, 1);
+				box.expand(p.x / p.z, p.y / p.z);
+			}
+			if (!(box.xmin > -1e6f && box.xmax < 1e6f && box.ymin > -1e6f && box.ymax < 1e6f))
+				continue;
+			int tx0 = max((int)floor((box.xmin - 2 - clip_x0) / kOcclusionTile), 0);
+			int ty0 = max((int)floor((box.ymin - 2 - clip_y0) / kOcclusionTile), 0);
+			int tx1 = min((int)floor((box.xmax + 2 - clip_x0) / kOcclusionTile), columns - 1);
+			int ty1 = min((int)floor((box.ymax + 2 - clip_y0) / kOcclusionTile), rows - 1);
+
+			// hidden when every tile it can touch is covered
+			bool hidden = true;
+			for (int ty = ty0; ty <= ty1 && hidden; ty++)
+				for (int tx = tx0; tx <= tx1 && hidden; tx++)
+					hidden = covered_tiles[tx + ty * columns];
+			if (hidden)
+			{
+				occluded[i] = 1;
+				INSTRUMENT(frame_stats.culled++);
+				continue;
+			}
+
+			// opaque fills of axis aligned rectangles overwrite every sample
+			// they contain, tiles within them (with a pixel to spare) are covered
+			if (leaf.element->type != RECT)
+				continue;
+			const Rect& rect = static_cast<const Rect&>(*leaf.element);
+			if (rect.style.fillColor.a != 1)
+				continue;
+			Matrix3x3 m = (leaf.parent < 0 ? svg_2_screen : group_transform(bvh, leaf.parent)) * rect.transform;
+			if (m(0, 1) != 0 || m(1, 0) != 0 || m(2, 0) != 0 || m(2, 1) != 0 || m(2, 2) != 1)
+				continue;
+			float x0 = m(0, 0) * rect.position.x + m(0, 2);
+			float y0 = m(1, 1) * rect.position.y + m(1, 2);
+			float x1 = m(0, 0) * (rect.position.x + rect.dimension.x) + m(0, 2);
+			float y1 = m(1, 1) * (rect.position.y + rect.dimension.y) + m(1, 2);
+			float cx0 = ceil((min(x0, x1) + 1 - clip_x0) / kOcclusionTile);
+			float cy0 = ceil((min(y0, y1) + 1 - clip_y0) / kOcclusionTile);
+			float cx1 = floor((max(x0, x1) - 1 - clip_x0) / kOcclusionTile);
+			float cy1 = floor((max(y0, y1) - 1 - clip_y0) / kOcclusionTile);
+			if (!(cx0 < cx1 && cy0 < cy1))
+				continue;
+			for (int ty = (int)max(cy0, 0.f); ty < (int)min(cy1, (float)rows); ty++)
+				for (int tx = (int)max(cx0, 0.f); tx < (int)min(cx1, (float)columns); tx++)
+					covered_tiles[tx + ty * columns] = 1;
+		}
+	}
+
 	// Rasterization //
 
 	// The input arguments in the rasterization functions
@@ -252,14 +719,17 @@ namespace CMU462
 	void SoftwareRendererImp::set_sample_buffer(int x, int y, Color color)
 	{
 		// check bounds
-		if (x < 0 || x >= target_w * sample_rate)
+		if (x < clip_x0 * (int)sample_rate || x >= clip_x1 * (int)sample_rate)
 		{
 			return;
 		}
-		if (y < 0 || y >= target_h * sample_rate)
+		if (y < clip_y0 * (int)sample_rate || y >= clip_y1 * (int)sample_rate)
 		{
 			return;
 		}
+		INSTRUMENT(frame_stats.samples_written++);
+		if (overdraw)
+			overdraw[x / sample_rate + y / sample_rate * target_w]++;
 		// fill sample - NOT doing alpha blending!
 		sample_buffer[4 * (x + y * target_w * sample_rate)] =
 			color.a * (color.r * 255) +
@@ -283,10 +753,13 @@ namespace CMU462
 		int sy = (int)floor(y);
 
 		// check bounds
-		if (sx < 0 || sx >= target_w)
+		if (sx < clip_x0 || sx >= clip_x1)
 			return;
-		if (sy < 0 || sy >= target_h)
+		if (sy < clip_y0 || sy >= clip_y1)
 			return;
+		INSTRUMENT(frame_stats.samples_written += sample_rate * sample_rate);
+		if (overdraw)
+			overdraw[sx + sy * target_w] += sample_rate * sample_rate;
 
 		// fill sample - NOT doing alpha blending!
 		for (int i = 0; i < sample_rate; i++)
@@ -311,11 +784,11 @@ namespace CMU462
 		float x1, float y1,
 		Color color)
 	{
-
+		INSTRUMENT(frame_stats.lines++);
 
 		bool antialising = false;
-		float swidth = 0.6;
-		float ewidth = 0.6;
+		float swidth = kLineHalfWidth;
+		float ewidth = kLineHalfWidth;
 
 		float m = (y1 - y0) / (x1 - x0);
 		if (swidth < 0.5 && ewidth < 0.5)
@@ -423,206 +896,203 @@ namespace CMU462
 		}
 	}
 
-	bool SoftwareRendererImp::point_in_traingle(float x0, float y0,
-		float x1, float y1,
-		float x2, float y2,
-		float i, float j)
-	{
-		//if (fabs(y0 - y1) < Fzero && y2 < y1)	return true;
-		float step = 0.5 / sample_rate;
-		float p1 = (i + step - x0) * (y1 - y0) - (j + step - y0) * (x1 - x0);
-		float p2 = (i + step - x1) * (y2 - y1) - (j + step - y1) * (x2 - x1);
-		float p3 = (i + step - x2) * (y0 - y2) - (j + step - y2) * (x0 - x2);
-		return (p1 < Fzero && p2 < Fzero && p3 < Fzero) || (p1 > -Fzero && p2 > -Fzero && p3 > -Fzero);
-	}
-
-	void SoftwareRendererImp::filldivision(
-		Color color,
-		int xmin, int ymin,
-		int xmax, int ymax)
+	void SoftwareRendererImp::fill_sample_span(int x0, int x1, int y, Color color)
 	{
-		for (int i = (xmin)*sample_rate; i < (xmax + 1) * sample_rate; i++)
+		INSTRUMENT(frame_stats.samples_written += x1 - x0);
+		if (overdraw)
+			for (int x = x0; x < x1; x++)
+				overdraw[x / sample_rate + y / sample_rate * target_w]++;
+
+		// opaque colors replace the samples with the bytes set_sample_buffer
+		// would blend to
+		uint8_t* samples = sample_buffer + 4 * (x0 + y * target_w * sample_rate);
+		if (color.a == 1)
 		{
-			for (int j = (ymin)*sample_rate; j < (ymax + 1) * sample_rate; j++)
-			{
-				set_sample_buffer(i, j, color);
-				/*sample_buffer[4 * (i + j * target_w * sample_rate)] = (uint8_t)(color.r * 255);
-				sample_buffer[4 * (i + j * target_w * sample_rate) + 1] = (uint8_t)(color.g * 255);
-				sample_buffer[4 * (i + j * target_w * sample_rate) + 2] = (uint8_t)(color.b * 255);
-				sample_buffer[4 * (i + j * target_w * sample_rate) + 3] = (uint8_t)(color.a * 255);*/
-			}
+			uint8_t bytes[4] = { (uint8_t)(color.r * 255), (uint8_t)(color.g * 255),
+				(uint8_t)(color.b * 255), 255 };
+			for (int x = x0; x < x1; x++, samples += 4)
+				memcpy(samples, bytes, 4);
+			return;
+		}
+		for (int x = x0; x < x1; x++, samples += 4)
+		{
+			samples[0] = color.a * (color.r * 255) + (1 - color.a) * samples[0];
+			samples[1] = color.a * (color.g * 255) + (1 - color.a) * samples[1];
+			samples[2] = color.a * (color.b * 255) + (1 - color.a) * samples[2];
+			samples[3] = (color.a * 255) + (1 - color.a) * samples[3];
 		}
 	}
 
-	bool SoftwareRendererImp::TriangleRectFill(float x0, float y0,
-		float x1, float y1,
-		float x2, float y2,
-		float x00, float y00,
-		float x11, float y11)
-	{
-
-		return point_in_traingle(x0, y0, x1, y1, x2, y2, x00 - 0.5 / sample_rate, y00 - 0.5 / sample_rate)
-			&& point_in_traingle(x0, y0, x1, y1, x2, y2, x00 - 0.5 / sample_rate, y11 - 0.5 / sample_rate)
-			&& point_in_traingle(x0, y0, x1, y1, x2, y2, x11 - 0.5 / sample_rate, y00 - 0.5 / sample_rate)
-			&& point_in_traingle(x0, y0, x1, y1, x2, y2, x11 - 0.5 / sample_rate, y11 - 0.5 / sample_rate);
-	}
-
-	bool SoftwareRendererImp::LineIntersectH(float x0, float y0,
+	void SoftwareRendererImp::rasterize_triangle(float x0, float y0,
 		float x1, float y1,
 		float x2, float y2,
-		float x3, float y3)
+		Color color)
 	{
-		if (abs((y0 - y1)) * 200 < abs(x0 - x1))
-			return false;
-		else if (abs((x1 - x0)) * 200 < abs(y1 - y0))
-			return (x2 <= x0 && x0 <= x3);
-
-		float m0 = (y1 - y0) / (x1 - x0);
-		float c0 = y0 - m0 * x0;
-		// m0 x + c0
-		float c2 = y2;
-		// m2 x + c2
-		float x = (c2 - c0) / (m0);
+		INSTRUMENT(frame_stats.triangles++);
 
-		return (min(x0, x1) <= x && x <= max(x0, x1)
-			&& x2 <= x && x <= x3);
-	}
-	bool SoftwareRendererImp::LineIntersectV(float x0, float y0,
-		float x1, float y1,
-		float x2, float y2,
-		float x3, float y3)
-	{
-		if (abs((x1 - x0)) * 200 < abs(y1 - y0))
-			return false;
-		else if (abs((y0 - y1)) * 200 < abs(x0 - x1))
-			return (y2 <= y0 && y0 <= y3);
-		/// YET
-		float m0 = (x1 - x0) / (y1 - y0);
-		float c0 = x0 - m0 * y0;
-		// m0 y + c0
-		float c2 = x2;
-		// c2
-		float y = (c2 - c0) / (m0);
+		double x[3] = { x0 * (double)sample_rate, x1 * (double)sample_rate, x2 * (double)sample_rate };
+		double y[3] = { y0 * (double)sample_rate, y1 * (double)sample_rate, y2 * (double)sample_rate };
+		for (int i = 0; i < 3; i++)
+			if (!isfinite(x[i]) || !isfinite(y[i]))
+				return;
 
-		return (min(y0, y1) <= y && y <= max(y0, y1)
-			&& y2 <= y && y <= y3);
+		// triangles reaching past the guard band are clipped to it and drawn
+		// as a fan, whose triangles share their vertices exactly
+		for (int i = 0; i < 3; i++)
+		{
+			if (fabs(x[i]) < kGuardBand && fabs(y[i]) < kGuardBand)
+				continue;
+			vector<Vector2D> polygon(3);
+			for (int k = 0; k < 3; k++)
+				polygon[k] = Vector2D(x[k], y[k]);
+			clip_to_guard_band(polygon);
+			for (size_t k = 2; k < polygon.size(); k++)
+			{
+				double fx[3] = { polygon[0].x, polygon[k - 1].x, polygon[k].x };
+				double fy[3] = { polygon[0].y, polygon[k - 1].y, polygon[k].y };
+				fill_triangle(fx, fy, color);
+			}
+			return;
+		}
+		fill_triangle(x, y, color);
 	}
 
-
-	bool SoftwareRendererImp::TriangleRectIntersect(float x0, float y0,
-		float x1, float y1,
-		float x2, float y2,
-		float x00, float y00,
-		float x11, float y11)
-	{
-		return LineIntersectV(x0, y0, x1, y1, x00, y00, x00, y11)
-			|| LineIntersectH(x0, y0, x1, y1, x00, y00, x11, y00)
-			|| LineIntersectH(x0, y0, x1, y1, x00, y11, x11, y11)
-			|| LineIntersectV(x0, y0, x1, y1, x11, y00, x11, y11)
-			|| LineIntersectV(x2, y2, x1, y1, x00, y00, x00, y11)
-			|| LineIntersectH(x2, y2, x1, y1, x00, y00, x11, y00)
-			|| LineIntersectH(x2, y2, x1, y1, x00, y11, x11, y11)
-			|| LineIntersectV(x2, y2, x1, y1, x11, y00, x11, y11)
-			|| LineIntersectV(x2, y2, x0, y0, x00, y00, x00, y11)
-			|| LineIntersectH(x2, y2, x0, y0, x00, y00, x11, y00)
-			|| LineIntersectH(x2, y2, x0, y0, x00, y11, x11, y11)
-			|| LineIntersectV(x2, y2, x0, y0, x11, y00, x11, y11)
-			|| (x00 <= x0 && x0 <= x11 && y00 <= y0 && y0 <= y11
-				&& x00 <= x1 && x1 <= x11 && y00 <= y1 && y1 <= y11
-				&& x00 <= x2 && x2 <= x11 && y00 <= y2 && y2 <= y11);
-
-	}
-
-	void SoftwareRendererImp::divide_screen2x2_rasterize_tr(float x0, float y0,
-		float x1, float y1,
-		float x2, float y2,
-		Color color,
-		int xmin, int ymin,
-		int xmax, int ymax, float threshold)
+	void SoftwareRendererImp::fill_triangle(const double* x, const double* y, Color color)
 	{
-		if ((xmax - xmin) * (ymax - ymin) <= threshold * threshold)
+		// snap to fixed point and orient so that the inside is positive
+		int64_t vx[3], vy[3];
+		for (int i = 0; i < 3; i++)
 		{
-			for (int i = (xmin - 1) * sample_rate; i < (xmax)*sample_rate; i++)
-			{
-				for (int j = (ymin - 1) * sample_rate; j < (ymax)*sample_rate; j++)
-				{
-					if (point_in_traingle(x0, y0, x1, y1, x2, y2, (i + sample_rate) / ((float)sample_rate), (j + sample_rate) / ((float)sample_rate)))
-					{
-						set_sample_buffer(i + sample_rate, j + sample_rate, color);
-					}
-				}
-			}
+			vx[i] = (int64_t)floor(x[i] * kSubpixels + 0.5);
+			vy[i] = (int64_t)floor(y[i] * kSubpixels + 0.5);
 		}
-		else
+		int64_t area = (vx[1] - vx[0]) * (vy[2] - vy[0]) - (vy[1] - vy[0]) * (vx[2] - vx[0]);
+		if (area == 0)
+			return;
+		if (area < 0)
 		{
-			if (xmax - xmin > ymax - ymin)
-			{
-				float xmid = (xmax + xmin) / 2;
+			swap(vx[1], vx[2]);
+			swap(vy[1], vy[2]);
+		}
 
-				if (TriangleRectFill(x0, y0, x1, y1, x2, y2, xmin, ymin, xmid, ymax))
-					filldivision(color, xmin, ymin, xmid, ymax);
-				else if (TriangleRectIntersect(x0, y0, x1, y1, x2, y2, xmin, ymin, xmid, ymax))
-					divide_screen2x2_rasterize_tr(x0, y0, x1, y1, x2, y2, color, xmin, ymin, xmid, ymax, threshold);
+		// samples whose centers lie in the bounds, within the clip rectangle
+		const int64_t half = kSubpixels / 2;
+		int64_t sx0 = ceil_div(min(vx[0], min(vx[1], vx[2])) - half, kSubpixels);
+		int64_t sy0 = ceil_div(min(vy[0], min(vy[1], vy[2])) - half, kSubpixels);
+		int64_t sx1 = floor_div(max(vx[0], max(vx[1], vx[2])) - half, kSubpixels);
+		int64_t sy1 = floor_div(max(vy[0], max(vy[1], vy[2])) - half, kSubpixels);
+		sx0 = max(sx0, (int64_t)clip_x0 * (int64_t)sample_rate);
+		sy0 = max(sy0, (int64_t)clip_y0 * (int64_t)sample_rate);
+		sx1 = min(sx1, (int64_t)clip_x1 * (int64_t)sample_rate - 1);
+		sy1 = min(sy1, (int64_t)clip_y1 * (int64_t)sample_rate - 1);
+		if (sx0 > sx1 || sy0 > sy1)
+			return;
 
-				if (TriangleRectFill(x0, y0, x1, y1, x2, y2, xmid  ,ymin, xmax, ymax))
-					filldivision(color, xmid , ymin, xmax, ymax);
-				else if (TriangleRectIntersect(x0, y0, x1, y1, x2, y2, xmid , ymin, xmax, ymax))
-					divide_screen2x2_rasterize_tr(x0, y0, x1, y1, x2, y2, color, xmid , ymin, xmax, ymax, threshold);
+		// edge functions dx * (py - ay) - dy * (px - ax), samples on an edge
+		// belong to the triangle only if it is a top or a left edge
+		int64_t ex[3], ey[3], dx[3], dy[3], bias[3];
+		for (int e = 0; e < 3; e++)
+		{
+			int n = (e + 1) % 3;
+			ex[e] = vx[e];
+			ey[e] = vy[e];
+			dx[e] = vx[n] - vx[e];
+			dy[e] = vy[n] - vy[e];
+			bool top_left = dy[e] < 0 || (dy[e] == 0 && dx[e] > 0);
+			bias[e] = top_left ? 0 : -1;
+		}
 
-			}
-			else
+		// each row is inside all edges along one span, solved per edge
+		for (int64_t sy = sy0; sy <= sy1; sy++)
+		{
+			int64_t py = sy * kSubpixels + half;
+			int64_t first = sx0, last = sx1;
+			for (int e = 0; e < 3 && first <= last; e++)
 			{
-				float ymid = (ymax + ymin) / 2;
-
-				if (TriangleRectFill(x0, y0, x1, y1, x2, y2, xmin, ymin, xmax, ymid))
-					filldivision(color, xmin, ymin, xmax, ymid);
-				else if (TriangleRectIntersect(x0, y0, x1, y1, x2, y2, xmin, ymin, xmax, ymid))
-					divide_screen2x2_rasterize_tr(x0, y0, x1, y1, x2, y2, color, xmin, ymin, xmax, ymid, threshold);
-
-				if (TriangleRectFill(x0, y0, x1, y1, x2, y2, xmin, ymid, xmax, ymax))
-					filldivision(color, xmin, ymid , xmax, ymax);
-				else if (TriangleRectIntersect(x0, y0, x1, y1, x2, y2, xmin, ymid, xmax, ymax))
-					divide_screen2x2_rasterize_tr(x0, y0, x1, y1, x2, y2, color, xmin, ymid, xmax, ymax, threshold);
-
+				// the edge function at sample sx is c + step * sx
+				int64_t c = dx[e] * (py - ey[e]) - dy[e] * (half - ex[e]) + bias[e];
+				int64_t step = -dy[e] * kSubpixels;
+				if (step > 0)
+					first = max(first, ceil_div(-c, step));
+				else if (step < 0)
+					last = min(last, floor_div(c, -step));
+				else if (c < 0)
+					last = first - 1;
 			}
+			if (first > last)
+				continue;
+			INSTRUMENT(frame_stats.samples_tested += last - first + 1);
+			fill_sample_span(first, last + 1, sy, color);
 		}
 	}
 
-
-
-	void SoftwareRendererImp::rasterize_triangle(float x0, float y0,
+	void SoftwareRendererImp::rasterize_rect(float x0, float y0,
 		float x1, float y1,
-		float x2, float y2,
 		Color color)
 	{
-		//cout << x0 << ", " << y0 << "	" << x1 << ", " << y1 << "	" << x2 << ", " << y2 << endl;
-
-		float xmin, ymin, xmax, ymax;
-		xmin = max(min(x0, min(x1, x2)) - 0.5f, 0.01f);
-		ymin = max(min(y0, min(y1, y2)) - 0.5f, 0.01f);
-		xmax = min(max(x0, max(x1, x2)) + 0.5f, target_w + 0.01f);
-		ymax = min(max(y0, max(y1, y2)) + 0.5f, target_h + 0.01f);
+		INSTRUMENT(frame_stats.rects++);
+
+		// the edges in sample space, snapped as the vertices of triangles
+		// are, and clamped to the guard band like clipped triangles
+		double edges[4] = { min(x0, x1) * (double)sample_rate, min(y0, y1) * (double)sample_rate,
+			max(x0, x1) * (double)sample_rate, max(y0, y1) * (double)sample_rate };
+		int64_t snapped[4];
+		for (int i = 0; i < 4; i++)
+		{
+			if (!isfinite(edges[i]))
+				return;
+			double e = max(-kGuardBand, min(kGuardBand, edges[i]));
+			snapped[i] = (int64_t)floor(e * kSubpixels + 0.5);
+		}
 
-		divide_screen2x2_rasterize_tr(x0, y0, x1, y1, x2, y2, color, xmin, ymin, xmax, ymax, 16);
+		// samples whose centers lie in [x0, x1) x [y0, y1), the samples the
+		// two triangles of the rectangle cover by the top-left rule
+		const int64_t half = kSubpixels / 2;
+		int64_t sx0 = max(ceil_div(snapped[0] - half, kSubpixels), (int64_t)clip_x0 * (int64_t)sample_rate);
+		int64_t sy0 = max(ceil_div(snapped[1] - half, kSubpixels), (int64_t)clip_y0 * (int64_t)sample_rate);
+		int64_t sx1 = min(ceil_div(snapped[2] - half, kSubpixels), (int64_t)clip_x1 * (int64_t)sample_rate);
+		int64_t sy1 = min(ceil_div(snapped[3] - half, kSubpixels), (int64_t)clip_y1 * (int64_t)sample_rate);
+		if (sx0 >= sx1 || sy0 >= sy1)
+			return;
 
+		for (int64_t sy = sy0; sy < sy1; sy++)
+			fill_sample_span(sx0, sx1, sy, color);
+	}
 
-		/*for (int i = (xmin); i < (xmax); i++)
+	void SoftwareRendererImp::clip_to_guard_band(vector<Vector2D>& polygon)
+	{
+		// Sutherland-Hodgman against each side, intersections are computed
+		// from the lower endpoint so that neighbors agree on them
+		vector<Vector2D> input;
+		for (int side = 0; side < 4; side++)
 		{
-			for (int j = (ymin); j < (ymax); j++)
+			input.swap(polygon);
+			polygon.clear();
+			int axis = side & 1;
+			double bound = side < 2 ? -kGuardBand : kGuardBand;
+			for (size_t i = 0; i < input.size(); i++)
 			{
-				float p1 = (i + 0.5f - x0) * (y1 - y0) - (j + 0.5f - y0) * (x1 - x0);
-				float p2 = (i + 0.5f - x1) * (y2 - y1) - (j + 0.5f - y1) * (x2 - x1);
-				float p3 = (i + 0.5f - x2) * (y0 - y2) - (j + 0.5f - y2) * (x0 - x2);
-				if ((p1 >= -Fzero && p2 >= -Fzero && p3 >= -Fzero) || (p1 <= Fzero && p2 <= Fzero && p3 <= Fzero))
+				const Vector2D& a = input[i];
+				const Vector2D& b = input[(i + 1) % input.size()];
+				double va = axis ? a.y : a.x, vb = axis ? b.y : b.x;
+				bool in_a = side < 2 ? va >= bound : va <= bound;
+				bool in_b = side < 2 ? vb >= bound : vb <= bound;
+				if (in_a)
+					polygon.push_back(a);
+				if (in_a != in_b)
 				{
-					render_target[4 * (i + j * target_w)] = (uint8_t)(color.r * 255);
-					render_target[4 * (i + j * target_w) + 1] = (uint8_t)(color.g * 255);
-					render_target[4 * (i + j * target_w) + 2] = (uint8_t)(color.b * 255);
-					render_target[4 * (i + j * target_w) + 3] = (uint8_t)(color.a * 255);
+					const Vector2D& p = (a.x < b.x || (a.x == b.x && a.y < b.y)) ? a : b;
+					const Vector2D& q = &p == &a ? b : a;
+					double t = (bound - (axis ? p.y : p.x)) / ((axis ? q.y : q.x) - (axis ? p.y : p.x));
+					Vector2D v = p + t * (q - p);
+					if (axis)
+						v.y = bound;
+					else
+						v.x = bound;
+					polygon.push_back(v);
 				}
 			}
-		}*/
-
+		}
 	}
 
 	void SoftwareRendererImp::rasterize_image(float x0, float y0,
@@ -635,9 +1105,10 @@ namespace CMU462
 		//			rasterize_point(i, j, sampler->sample_bilinear(tex, (i - x0 + 0.5f) / (x1 - x0), (j - y0 + 0.5f) / (y1 - y0), 0));
 		//else if (sampler->get_sample_method() == TRILINEAR)
 		//{
+		INSTRUMENT(frame_stats.images++);
 		float L = sqrt(tex.width * tex.height / (x1 - x0) / (y1 - y0));
-		for (int i = max(x0, .0f); i < min(x1, (float)target_w); i++)
-			for (int j = max(y0, .0f); j < min(y1, (float)target_h); j++)
+		for (int i = max(x0, (float)clip_x0); i < min(x1, (float)clip_x1); i++)
+			for (int j = max(y0, (float)clip_y0); j < min(y1, (float)clip_y1); j++)
 			{
 				if (L > 1)
 					rasterize_point(i, j, sampler->
@@ -650,14 +1121,110 @@ namespace CMU462
 		/*}*/
 	}
 
+	void SoftwareRendererImp::rasterize_contours(const vector<Vector2D>& points,
+		const vector<uint32_t>& ends, bool evenodd, Color color)
+	{
+		// edges in sample space (fills close every contour)
+		float s = sample_rate;
+		fill_edges.clear();
+		size_t first = 0;
+		for (size_t c = 0; c < ends.size(); first = ends[c++])
+		{
+			for (size_t i = first; i < ends[c]; i++)
+			{
+				const Vector2D& a = points[i];
+				const Vector2D& b = points[i + 1 < ends[c] ? i + 1 : first];
+				if (a.y == b.y)
+					continue;
+				const Vector2D& top = a.y < b.y ? a : b;
+				const Vector2D& bottom = a.y < b.y ? b : a;
+				FillEdge e;
+				e.y0 = top.y * s;
+				e.y1 = bottom.y * s;
+				e.x = top.x * s;
+				e.dxdy = (bottom.x - top.x) / (bottom.y - top.y);
+				e.winding = a.y < b.y ? 1 : -1;
+				if (!isfinite(e.y0) || !isfinite(e.y1) || !isfinite(e.x) || !isfinite(e.dxdy))
+					continue;
+				fill_edges.push_back(e);
+			}
+		}
+		if (fill_edges.empty())
+			return;
+		sort(fill_edges.begin(), fill_edges.end(),
+			[](const FillEdge& a, const FillEdge& b) { return a.y0 < b.y0; });
+
+		// sample rows whose centers are covered, within the clip rectangle
+		float ymax = fill_edges[0].y1;
+		for (size_t i = 1; i < fill_edges.size(); i++)
+			ymax = max(ymax, fill_edges[i].y1);
+		int row0 = (int)max(ceil(fill_edges[0].y0 - 0.5f), (float)(clip_y0 * s));
+		int row1 = (int)min(ceil(ymax - 0.5f), (float)(clip_y1 * s));
+		float col0 = clip_x0 * s, col1 = clip_x1 * s;
+
+		// scanlines over the edges crossing each row center
+		size_t next = 0;
+		fill_active.clear();
+		for (int row = row0; row < row1; row++)
+		{
+			float y = row + 0.5f;
+			while (next < fill_edges.size() && fill_edges[next].y0 <= y)
+				fill_active.push_back(next++);
+			size_t n = 0;
+			for (size_t i = 0; i < fill_active.size(); i++)
+				if (fill_edges[fill_active[i]].y1 > y)
+					fill_active[n++] = fill_active[i];
+			fill_active.resize(n);
+
+			fill_crossings.clear();
+			for (size_t i = 0; i < n; i++)
+			{
+				const FillEdge& e = fill_edges[fill_active[i]];
+				fill_crossings.push_back(make_pair(e.x + (y - e.y0) * e.dxdy, e.winding));
+			}
+			sort(fill_crossings.begin(), fill_crossings.end());
+
+			// fill the spans that are inside by the fill rule
+			int winding = 0;
+			for (size_t i = 0; i + 1 < fill_crossings.size(); i++)
+			{
+				winding += fill_crossings[i].second;
+				if (evenodd ? !(winding & 1) : !winding)
+					continue;
+				int x0 = (int)max(ceil(fill_crossings[i].first - 0.5f), col0);
+				int x1 = (int)min(ceil(fill_crossings[i + 1].first - 0.5f), col1);
+				for (int x = x0; x < x1; x++)
+					set_sample_buffer(x, row, color);
+			}
+		}
+	}
+
+	void SoftwareRendererImp::clear_sample(int x0, int y0, int x1, int y1)
+	{
+		INSTRUMENT(StageTimer timer(profiling, frame_stats.time[FrameStats::RESOLVE]));
+		size_t stride = 4 * target_w * sample_rate;
+		size_t length = 4 * (x1 - x0) * sample_rate;
+		for (int y = y0 * sample_rate; y < y1 * (int)sample_rate; y++)
+			memset(sample_buffer + y * stride + 4 * x0 * sample_rate, 255, length);
+	}
+
 	// resolve samples to render target
-	void SoftwareRendererImp::resolve(void)
+	void SoftwareRendererImp::resolve(int y0, int y1)
 	{
+		INSTRUMENT(StageTimer timer(profiling, frame_stats.time[FrameStats::RESOLVE]));
+		INSTRUMENT(TraceSpan span(trace, "resolve"));
 		//clear_target();
 		//cout << target_w << "x" << target_h << ":" << sample_rate << ", " << tricount << endl;
-		for (int x = 0; x < target_w; x++)
-			for (int y = 0; y < target_h; y++)
+		for (int y = y0; y < y1; y++)
+			for (int x = 0; x < target_w; x++)
 			{
+				// opaque pixels without supersampling resolve to their sample
+				if (sample_rate == 1 && sample_buffer[4 * (x + y * target_w) + 3] == 255)
+				{
+					memcpy(render_target + 4 * (x + y * target_w), sample_buffer + 4 * (x + y * target_w), 4);
+					continue;
+				}
+
 				float r = 0, g = 0, b = 0, a = 0;
 				for (int i = 0; i < sample_rate; i++)
 					for (int j = 0; j < sample_rate; j++)
@@ -3,11 +3,14 @@
 
 #include <stdio.h>
 #include <vector>
+#include <cstring>
 #include <bitset>
+#include <utility>
 
 #include "CMU462.h"
 #include "texture.h"
 #include "svg_renderer.h"
+#include "instrument.h"
 
 namespace CMU462 { // CMU462
 
@@ -68,7 +71,10 @@ class SoftwareRenderer : public SVGRenderer {
 class SoftwareRendererImp : public SoftwareRenderer {
  public:
 
-  SoftwareRendererImp( ) : SoftwareRenderer( ) { }
+  SoftwareRendererImp( ) : SoftwareRenderer( ), lod_budget ( 0 ),
+                           frame_stamp ( 0 ), last_svg ( NULL ),
+                           profiling ( false ), trace ( NULL ),
+                           overdraw ( NULL ), occlusion_culling ( false ) { }
 
   // draw an svg input to render target
   void draw_svg( SVG& svg );
@@ -80,6 +86,47 @@ class SoftwareRendererImp : public SoftwareRenderer {
   void set_render_target( unsigned char* target_buffer,
                           size_t width, size_t height );
 
+  // Set level of detail budget: the largest simplification error (in
+  // pixels) allowed when drawing point arrays. 0 (the default) draws full
+  // detail, as the reference renderer does.
+  inline void set_lod_budget( float pixels ) { lod_budget = pixels; invalidate(); }
+  inline float get_lod_budget() const { return lod_budget; }
+
+  // Discard the samples kept from the previous frame so that the next one
+  // is drawn from scratch. Needed when the document itself changes.
+  inline void invalidate() { last_svg = NULL; }
+
+  // Draw the pixel rows [y0, y1) of an svg input to render target, leaving
+  // the other rows untouched. Used to refine a preview band by band.
+  void draw_rows( SVG& svg, int y0, int y1 );
+
+  // Counters and stage times of the frames drawn since the last reset,
+  // all zero in builds without DRAWSVG_INSTRUMENT. Stage times are only
+  // taken while profiling is on, since they read the clock per element.
+  inline void set_profiling( bool enabled ) { profiling = enabled; }
+  inline const FrameStats& get_frame_stats() const { return frame_stats; }
+  inline void reset_frame_stats() { frame_stats = FrameStats(); }
+
+  // Record spans of drawing regions and resolving into a trace (NULL for
+  // none). Spans are only recorded while the trace is recording.
+  inline void set_trace( TraceRecorder* trace ) { this->trace = trace; }
+
+  // Add the number of samples written to each pixel to counts (target_w x
+  // target_h, NULL to stop counting). Frames are drawn from scratch while
+  // counting, so that every pixel is counted.
+  inline void set_overdraw( uint32_t* counts ) { overdraw = counts; }
+
+  // Draw an svg input to render target tile by tile, in squares of
+  // tile_size pixels. The time spent on each tile (in seconds, tiles row
+  // by row) is returned in seconds.
+  void draw_tile_costs( SVG& svg, int tile_size, std::vector<double>& seconds );
+
+  // Skip elements that opaque rectangles drawn after them hide entirely.
+  // Does not change the output, the culled elements are counted in the
+  // frame stats.
+  inline void set_occlusion_culling( bool enabled ) { occlusion_culling = enabled; }
+  inline bool get_occlusion_culling() const { return occlusion_culling; }
+
  private:
 
   // Primitive Drawing //
@@ -111,6 +158,59 @@ class SoftwareRendererImp : public SoftwareRenderer {
   // Draw a group
   void draw_group( Group& group );
 
+  // Draw a path
+  void draw_path( Path& path );
+
+  // Level of Detail //
+
+  // Scale (in pixels per unit) of the current transformation
+  float transform_scale();
+
+  // Coarsest version of a point array within the lod budget
+  // (building the levels of its chain when first needed)
+  const std::vector<Vector2D>& lod_points( const std::vector<Vector2D>& points,
+                                           LODChain& lod );
+
+  // Draws an element smaller than a pixel as a single point weighted by
+  // its fill area or outline length. Returns false for larger elements.
+  bool draw_subpixel( const LODChain& lod, bool fill, Color color );
+
+  float lod_budget;
+
+  // Culling //
+
+  // Draws the elements of a svg that intersect the given box (in svg space)
+  void draw_visible( SVG& svg, const BBox& view );
+
+  // Screen space transformation of a group in the svg bvh
+  const Matrix3x3& group_transform( const BVH& bvh, int group );
+
+  // Marks the visible leaves that opaque rectangles in front of them hide
+  // within the clip rectangle, tracking coverage in tiles
+  void cull_occluded( const BVH& bvh );
+
+  // visible leaves and per frame cache of group transformations
+  std::vector<int> visible;
+  std::vector<Matrix3x3> group_transforms;
+  std::vector<size_t> group_stamps; size_t frame_stamp;
+
+  // Incremental Repaint //
+
+  // Shifts the samples of the previous frame by the offset of a pure
+  // integer translation of the view (panning). Returns false when the
+  // frame has to be drawn from scratch.
+  bool scroll_samples( const SVG& svg, int& dx, int& dy );
+
+  // Clears and redraws the pixels in [x0, x1) x [y0, y1)
+  void draw_region( SVG& svg, int x0, int y0, int x1, int y1 );
+
+  // previous frame
+  const SVG* last_svg; Matrix3x3 last_svg_2_screen;
+  size_t last_w, last_h, last_rate;
+
+  // pixels outside of the clip rectangle are never written
+  int clip_x0, clip_y0, clip_x1, clip_y1;
+
   // Rasterization //
 
   void set_sample_buffer(int x, int y, Color color);
@@ -123,64 +223,68 @@ class SoftwareRendererImp : public SoftwareRenderer {
                        float x1, float y1,
                        Color color);
 
-  void divide_screen2x2_rasterize_tr(float x0, float y0,
-      float x1, float y1,
-      float x2, float y2,
-      Color color,
-      int xmin, int ymin,
-      int xmax, int ymax, float threshold);
-
-  bool point_in_traingle(float x0, float y0,
-      float x1, float y1,
-      float x2, float y2,
-      float i, float j);
-
-  bool TriangleRectIntersect(float x0, float y0,
-      float x1, float y1,
-      float x2, float y2,
-      float x00, float y00,
-      float x11, float y11);
-
-  bool LineIntersectH(float x0, float y0,
-      float x1, float y1,
-      float x2, float y2,
-      float x3, float y3);
-  bool LineIntersectV(float x0, float y0,
-      float x1, float y1,
-      float x2, float y2,
-      float x3, float y3);
-
-  bool TriangleRectFill(float x0, float y0,
-      float x1, float y1,
-      float x2, float y2,
-      float x00, float y00,
-      float x11, float y11);
-
-  void filldivision(
-      Color color,
-      int xmin, int ymin,
-      int xmax, int ymax);
-
   // rasterize a triangle
   void rasterize_triangle( float x0, float y0,
                            float x1, float y1,
                            float x2, float y2,
                            Color color );
 
+  // rasterize an axis aligned rectangle with corners (x0, y0) and (x1, y1),
+  // covering the samples its two triangles would
+  void rasterize_rect( float x0, float y0,
+                       float x1, float y1,
+                       Color color );
+
+  // fill a triangle of sample space vertices within the guard band,
+  // snapped to fixed point and by the top-left rule
+  void fill_triangle( const double* x, const double* y, Color color );
+
+  // clip a sample space polygon to the guard band
+  void clip_to_guard_band( std::vector<Vector2D>& polygon );
+
+  // fill the samples [x0, x1) of sample row y, inside the clip rectangle
+  void fill_sample_span( int x0, int x1, int y, Color color );
 
   // rasterize an image
   void rasterize_image( float x0, float y0,
                         float x1, float y1,
                         Texture& tex );
 
-  // resolve samples to render target
-  void resolve( void );
+  // rasterize the inside of closed contours (screen space points, with
+  // the end of each contour) by the nonzero or evenodd fill rule
+  void rasterize_contours( const std::vector<Vector2D>& points,
+                           const std::vector<uint32_t>& ends,
+                           bool evenodd, Color color );
+
+  // edge of a contour in sample space, from top to bottom
+  struct FillEdge {
+    float y0, y1, x, dxdy;
+    int winding;
+  };
+
+  // scratch buffers of paths, reused across elements
+  std::vector<Vector2D> path_points;
+  std::vector<FillEdge> fill_edges;
+  std::vector<size_t> fill_active;
+  std::vector< std::pair<float, int> > fill_crossings;
+
+  // resolve the samples of the pixel rows [y0, y1) to render target
+  void resolve( int y0, int y1 );
 
   uint8_t sample_buffer[4*16*2000*1000]; int w; int h;
 
-  inline void clear_sample() {
-    memset(sample_buffer, 255, 4 * 16 * 2000 * 1000);
-  }
+  // clear the samples of the pixels in [x0, x1) x [y0, y1)
+  void clear_sample( int x0, int y0, int x1, int y1 );
+
+  // Instrumentation //
+
+  bool profiling; FrameStats frame_stats;
+  TraceRecorder* trace;
+  uint32_t* overdraw;
+
+  // occlusion culling, hidden visible leaves and covered tiles of a region
+  bool occlusion_culling;
+  std::vector<char> occluded, covered_tiles;
 
 }; // class SoftwareRendererImp
 
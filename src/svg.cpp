@@ -1,10 +1,9 @@
 #include "svg.h"
 #include "png.h"
-#include "base64.h"
+#include "number_parser.h"
 
 #include <string>
-#include <fstream>
-#include <sstream>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
 
@@ -12,50 +11,179 @@ using namespace std;
 
 namespace CMU462 {
 
-Group::~Group() {
+// Runs the destructors of arena allocated elements (and the elements
+// nested in groups). The memory itself is released with the arena.
+static void destroyElements( vector<SVGElement*>& elements ) {
   for (size_t i = 0; i < elements.size(); i++) {
-    delete elements[i];
+    if (elements[i]->type == GROUP) {
+      destroyElements(static_cast<Group*>(elements[i])->elements);
+    }
+    elements[i]->~SVGElement();
   } elements.clear();
 }
 
+Image::~Image() {
+  if( !data.empty() ) ImageCache::shared().forget( *this );
+}
+
 SVG::~SVG() {
-  for (size_t i = 0; i < elements.size(); i++) {
-    delete elements[i];
-  } elements.clear();
+  destroyElements( elements );
+  arena.clear();
 }
 
 // Parser //
 
+// Upper bound on the number of points in a points attribute. Coordinate
+// pairs are usually written as whitespace separated "x,y" tokens, so this
+// lets point arrays be sized with a single allocation.
+static size_t countPointTokens( const XMLValue& points ) {
+
+  size_t count = 0; bool in_token = false;
+  for ( const char* p = points.begin; p < points.end; p++ ) {
+    bool space = *p == ' ' || *p == '\t' || *p == '\n' || *p == '\r';
+    if ( !space && !in_token ) count++;
+    in_token = !space;
+  }
+
+  return count;
+}
+
+// Parses a fill or stroke color: "none" (transparent) or a hexadecimal
+// color with an optional leading hashmark, in the #rrggbb or short #rgb
+// form. Anything else is black, as before.
+static Color parseColor( const XMLValue& value ) {
+
+  const char* p = value.begin; const char* end = value.end;
+  while( p < end && isspace( (unsigned char) *p ) ) p++;
+  if( end - p == 4 && !strncmp( p, "none", 4 ) ) return Color( 0, 0, 0, 0 );
+  if( p < end && *p == '#' ) p++;
+
+  unsigned int rgb = 0; int digits = 0;
+  for( ; p < end && isxdigit( (unsigned char) *p ); p++, digits++ ) {
+    rgb = (rgb << 4) | (isdigit( *p ) ? *p - '0' : (tolower( *p ) - 'a' + 10));
+  }
+
+  // #rgb is #rrggbb
+  if( digits == 3 ) {
+    unsigned int r = (rgb >> 8) & 0xF, g = (rgb >> 4) & 0xF, b = rgb & 0xF;
+    rgb = (r << 20) | (r << 16) | (g << 12) | (g << 8) | (b << 4) | b;
+  }
+
+  return Color( ((rgb >> 16) & 0xFF) / 255.0f,
+                ((rgb >>  8) & 0xFF) / 255.0f,
+                ( rgb        & 0xFF) / 255.0f );
+}
+
+// opacity value, 0 if it is not a number
+static float parseOpacity( const XMLValue& value ) {
+  const char* p = value.begin; float a = 0;
+  parseNumber( p, value.end, a );
+  return a;
+}
+
+// Values of base64 characters, -2 for skipped whitespace
+// and -1 for characters that end the data
+struct Base64Table {
+  signed char value[256];
+  Base64Table() {
+    const char* chars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    memset( value, -1, sizeof(value) );
+    for( int i = 0; i < 64; i++ ) value[(unsigned char) chars[i]] = i;
+    value[(unsigned char) ' ' ] = value[(unsigned char) '\t'] = -2;
+    value[(unsigned char) '\n'] = value[(unsigned char) '\r'] = -2;
+  }
+};
+static const Base64Table base64;
+
+// Decodes base64 data in one pass, skipping whitespace, up to the padding or
+// the first invalid character. The output is written in place, into a
+// buffer sized for the whole value.
+static void decodeBase64( const XMLValue& encoded, vector<unsigned char>& decoded ) {
+
+  decoded.resize( encoded.size() / 4 * 3 + 3 );
+  unsigned char* out = decoded.data();
+
+  const unsigned char* p = (const unsigned char*) encoded.begin;
+  const unsigned char* end = (const unsigned char*) encoded.end;
+  unsigned int bits = 0; int count = 0;
+  while( p < end ) {
+
+    // whole groups at once, up to whitespace or the end of the data
+    if( !count ) {
+      for( ; end - p >= 4; p += 4, out += 3 ) {
+        int a = base64.value[p[0]], b = base64.value[p[1]];
+        int c = base64.value[p[2]], d = base64.value[p[3]];
+        if( (a | b | c | d) < 0 ) break;
+        unsigned int group = (a << 18) | (b << 12) | (c << 6) | d;
+        out[0] = group >> 16; out[1] = group >> 8; out[2] = group;
+      }
+      if( p == end ) break;
+    }
+
+    int v = base64.value[*p++];
+    if( v == -2 ) continue;
+    if( v < 0 ) break;
+    bits = (bits << 6) | v;
+    if( ++count == 4 ) {
+      out[0] = bits >> 16; out[1] = bits >> 8; out[2] = bits;
+      out += 3; bits = 0; count = 0;
+    }
+  }
+
+  // partial group
+  if( count > 1 ) {
+    bits <<= 6 * (4 - count);
+    *out++ = bits >> 16;
+    if( count > 2 ) *out++ = bits >> 8;
+  }
+  decoded.resize( out - decoded.data() );
+}
+
 int SVGParser::load( const char* filename, SVG* svg ) {
 
-  ifstream in( filename );
-  if( !in.is_open() ) {
-     return -1;
+  if( isScene( filename ) ) {
+    if( readScene( filename, svg, false, 0, 0 ) < 0 ) {
+      cerr << "Error: damaged scene file!" << endl;
+      return -1;
+    }
+    return 0;
   }
-  in.close();
 
-  XMLDocument doc;
-  doc.LoadFile( filename );
-  if( doc.Error() ) {
-     doc.PrintError();
-     exit( 1 );
+  // elements are parsed as the file is read, without a document tree
+  XMLReader xml;
+  if( !xml.Open( filename ) ) {
+     return -1;
   }
 
-  XMLElement* root = doc.FirstChildElement( "svg" );
+  bool root = false;
+  while( !root && xml.NextChild( 0 ) ) {
+     root = !strcmp( xml.Value(), "svg" );
+  }
+  if( xml.Error() ) {
+     xml.PrintError();
+     return -1;
+  }
   if( !root ) {
      cerr << "Error: not an SVG file!" << endl;
-     exit( 1 );
+     return -1;
   }
 
-  root->QueryFloatAttribute( "width",  &svg->width  );
-  root->QueryFloatAttribute( "height", &svg->height );
+  xml.QueryFloatAttribute( "width",  &svg->width  );
+  xml.QueryFloatAttribute( "height", &svg->height );
 
-  parseSVG( root, svg );
+  parseSVG( &xml, svg );
+  if( xml.Error() ) {
+     xml.PrintError();
+     return -1;
+  }
+
+  // index elements for culling
+  svg->bvh.build( *svg );
 
   return 0;
 }
 
-void SVGParser::parseSVG( XMLElement* xml, SVG* svg ) {
+void SVGParser::parseSVG( XMLReader* xml, SVG* svg ) {
 
   /* NOTE (sky):
    * SVG uses a "painters model" when drawing elements. Elements 
@@ -65,93 +193,97 @@ void SVGParser::parseSVG( XMLElement* xml, SVG* svg ) {
    * order when drawing elements.
    */
 
-  XMLElement* elem = xml->FirstChildElement();
-  while( elem ) {
+  int depth = xml->Depth();
+  while( xml->NextChild( depth ) ) {
 
-    string elementType ( elem->Value() );
+    string elementType ( xml->Value() );
     if( elementType == "line" ) {
 
-      Line* line = new Line();
-      parseElement(elem, line );
-      parseLine( elem, line );
+      Line* line = svg->arena.create<Line>();
+      parseElement(xml, line );
+      parseLine( xml, line );
       svg->elements.push_back( line );
 
     } else if( elementType == "polyline" ) {
 
-      Polyline* polyline = new Polyline();
-      parseElement(elem, polyline );
-      parsePolyline( elem, polyline );
+      Polyline* polyline = svg->arena.create<Polyline>();
+      parseElement(xml, polyline );
+      parsePolyline( xml, polyline );
       svg->elements.push_back( polyline );
 
     } else if( elementType == "rect" ) {
 
-      float w = elem->FloatAttribute("width" );
-      float h = elem->FloatAttribute("height");
+      float w = xml->FloatAttribute("width" );
+      float h = xml->FloatAttribute("height");
 
       // treat zero-size rectangles as points
       if (w == 0 && h == 0) {
-        Point* point = new Point();
-        parseElement(elem, point );
-        parsePoint( elem, point );
+        Point* point = svg->arena.create<Point>();
+        parseElement(xml, point );
+        parsePoint( xml, point );
         svg->elements.push_back( point );
       } else {
-        Rect* rect = new Rect();
-        parseElement( elem, rect );
-        parseRect( elem, rect );
+        Rect* rect = svg->arena.create<Rect>();
+        parseElement( xml, rect );
+        parseRect( xml, rect );
         svg->elements.push_back( rect );
       }
 
     } else if( elementType == "polygon" ) {
 
-      Polygon* polygon = new Polygon();
-      parseElement( elem, polygon);
-      parsePolygon( elem, polygon );
+      Polygon* polygon = svg->arena.create<Polygon>();
+      parseElement( xml, polygon);
+      parsePolygon( xml, polygon );
       svg->elements.push_back( polygon );
 
+    } else if( elementType == "path" ) {
+
+      Path* path = svg->arena.create<Path>();
+      parseElement( xml, path );
+      parsePath( xml, path );
+      svg->elements.push_back( path );
+
     } else if( elementType == "ellipse" ) {
 
-      Ellipse* ellipse = new Ellipse();
-      parseElement( elem, ellipse);
-      parseEllipse( elem, ellipse );
+      Ellipse* ellipse = svg->arena.create<Ellipse>();
+      parseElement( xml, ellipse);
+      parseEllipse( xml, ellipse );
       svg->elements.push_back( ellipse );
 
     } else if ( elementType == "image" ) {
 
-      Image* image = new Image();
-      parseElement( elem, image);
-      parseImage( elem, image);
-      svg->elements.push_back( image ); 
+      Image* image = svg->arena.create<Image>();
+      parseElement( xml, image);
+      if( parseImage( xml, image ) == 0 ) svg->elements.push_back( image );
 
     } else if( elementType == "g" ) {
 
-       Group* group = new Group();
-       parseElement( elem, group);
-       parseGroup( elem, group );
+       Group* group = svg->arena.create<Group>();
+       parseElement( xml, group);
+       parseGroup( xml, group, svg->arena );
        svg->elements.push_back( group );
 
     } else {
        // unknown element type --- include default handler here if desired
     }
-
-    elem = elem->NextSiblingElement();
   }
 }
 
-void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
+void SVGParser::parseElement( XMLReader* xml, SVGElement* element ) {
 
   // parse style
   Style* style = &element->style;
-  const char* fill = xml->Attribute( "fill" );
-  if( fill ) style->fillColor = Color::fromHex( fill );
+  XMLValue fill = xml->Attribute( "fill" );
+  if( fill.begin ) style->fillColor = parseColor( fill );
 
-  const char* fill_opacity = xml->Attribute( "fill-opacity" );
-  if( fill_opacity ) style->fillColor.a = atof( fill_opacity );
+  XMLValue fill_opacity = xml->Attribute( "fill-opacity" );
+  if( fill_opacity.begin ) style->fillColor.a = parseOpacity( fill_opacity );
 
-  const char* stroke = xml->Attribute( "stroke" );
-  const char* stroke_opacity = xml->Attribute( "stroke-opacity" );
-  if( stroke ) {
-    style->strokeColor = Color::fromHex( stroke );
-    if( stroke_opacity ) style->strokeColor.a = atof( stroke_opacity );
+  XMLValue stroke = xml->Attribute( "stroke" );
+  XMLValue stroke_opacity = xml->Attribute( "stroke-opacity" );
+  if( stroke.begin ) {
+    style->strokeColor = parseColor( stroke );
+    if( stroke_opacity.begin ) style->strokeColor.a = parseOpacity( stroke_opacity );
   } else {
     style->strokeColor = Color::Black;
     style->strokeColor.a = 0;
@@ -162,8 +294,8 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
   xml->QueryFloatAttribute( "stroke-miterlimit", &style->miterLimit  );
 
   // parse transformation
-  const char* trans = xml->Attribute( "transform" );
-  if ( trans ) {
+  XMLValue trans = xml->Attribute( "transform" );
+  if ( trans.begin ) {
     
     // NOTE (sky):
     // This implements the SVG transformation specification. All the SVG 
@@ -173,23 +305,36 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
     // consolidate transformation
     Matrix3x3 transform = Matrix3x3::identity();
 
-    string trans_str = trans; size_t paren_l, paren_r;
-    while ( trans_str.find_first_of('(') != string::npos ) {
+    // transformations are separated by whitespace or commas, and their
+    // arguments are any SVG number list
+    const char* p = trans.begin; const char* end = trans.end;
+    while ( true ) {
 
-      paren_l = trans_str.find_first_of('(');
-      paren_r = trans_str.find_first_of(')');
+      while ( p < end && (isspace( (unsigned char) *p ) || *p == ',') ) p++;
+      if ( p == end ) break;
 
-      string type = trans_str.substr(0, paren_l);
-      string data = trans_str.substr(paren_l + 1, paren_r - paren_l - 1);
+      const char* type_begin = p;
+      while ( p < end && isalpha( (unsigned char) *p ) ) p++;
+      string type ( type_begin, p );
 
-      if ( type == "matrix" ) {
-        
-        string matrix_str = data;
-        replace( matrix_str.begin(), matrix_str.end(), ',', ' ');
+      float args[6];
+      while ( p < end && isspace( (unsigned char) *p ) ) p++;
+      if ( p == end || *p != '(' ) {
+        cerr << "malformed transformation: " << trans.str() << endl;
+        break;
+      }
+      p++;
+      size_t n = parseNumbers( p, end, args, 6 );
+      if ( p == end || *p != ')' ) {
+        cerr << "malformed transformation: " << trans.str() << endl;
+        break;
+      }
+      p++;
+
+      if ( type == "matrix" && n == 6 ) {
 
-        stringstream ss (matrix_str);
-        float a; float b; float c; float d; float e; float f;
-        ss >> a; ss >> b; ss >> c; ss >> d; ss >> e; ss >> f;
+        float a = args[0]; float b = args[1]; float c = args[2];
+        float d = args[3]; float e = args[4]; float f = args[5];
 
         Matrix3x3 m;
         m(0,0) = a; m(0,1) = c; m(0,2) = e;
@@ -197,11 +342,10 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
         m(2,0) = 0; m(2,1) = 0; m(2,2) = 1;        
         transform = transform * m;
       
-      } else if ( type == "translate" ) {
+      } else if ( type == "translate" && (n == 1 || n == 2) ) {
         
-        stringstream ss (data);
-        float x; if (!(ss >> x)) x = 0;
-        float y; if (!(ss >> y)) y = 0;
+        float x = args[0];
+        float y = n > 1 ? args[1] : 0;
 
         Matrix3x3 m = Matrix3x3::identity();
         
@@ -210,11 +354,11 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
         
         transform = transform * m;
 
-      } else if (type == "scale" ) {
+      } else if ( type == "scale" && (n == 1 || n == 2) ) {
 
-        stringstream ss (data);
-        float x; if (!(ss >> x)) x = 1;
-        float y; if (!(ss >> y)) y = 1;
+        // a single factor scales both axes
+        float x = args[0];
+        float y = n > 1 ? args[1] : x;
 
         Matrix3x3 m = Matrix3x3::identity();
         
@@ -223,12 +367,11 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
 
         transform = transform * m;
 
-      } else if (type == "rotate") {
+      } else if ( type == "rotate" && (n == 1 || n == 3) ) {
 
-        stringstream ss (data);
-        float a; if (!(ss >> a)) a = 0;
-        float x; if (!(ss >> x)) x = 0;
-        float y; if (!(ss >> y)) y = 0;
+        float a = args[0];
+        float x = n > 1 ? args[1] : 0;
+        float y = n > 1 ? args[2] : 0;
 
         if ( x != 0 || y != 0 ) {
 
@@ -252,10 +395,9 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
           transform = transform * m;
         }
         
-      } else if (type == "skewX" ) {
+      } else if ( type == "skewX" && n == 1 ) {
 
-        stringstream ss (data);
-        float a; ss >> a;
+        float a = args[0];
 
         Matrix3x3 m = Matrix3x3::identity();
         
@@ -263,10 +405,9 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
 
         transform = transform * m;
 
-      } else if (type == "skewY" ) {
+      } else if ( type == "skewY" && n == 1 ) {
 
-        stringstream ss (data);
-        float a; ss >> a;
+        float a = args[0];
 
         Matrix3x3 m = Matrix3x3::identity();
         
@@ -275,11 +416,8 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
         transform = transform * m;
 
       } else {
-        cerr << "unknown transformation type: " << type << endl;
+        cerr << "unknown transformation: " << type << " with " << n << " arguments" << endl;
       }
-
-      size_t end = paren_r + 2;
-      trans_str.erase(0, end);
     }
 
     element->transform = transform;
@@ -287,50 +425,44 @@ void SVGParser::parseElement( XMLElement* xml, SVGElement* element ) {
 }   
 
 
-void SVGParser::parsePoint( XMLElement* xml, Point* point ) {
+void SVGParser::parsePoint( XMLReader* xml, Point* point ) {
   point->position = Vector2D(xml->FloatAttribute( "x" ),
                              xml->FloatAttribute( "y" ));
 }
 
-void SVGParser::parseLine( XMLElement* xml, Line* line ) {
+void SVGParser::parseLine( XMLReader* xml, Line* line ) {
   line->from = Vector2D(xml->FloatAttribute( "x1" ),
                         xml->FloatAttribute( "y1" ));
   line->to   = Vector2D(xml->FloatAttribute( "x2" ),
                         xml->FloatAttribute( "y2" ));
 }
 
-void SVGParser::parsePolyline( XMLElement* xml, Polyline* polyline ) {
+void SVGParser::parsePolyline( XMLReader* xml, Polyline* polyline ) {
 
-  stringstream points (xml->Attribute( "points" ));
+  XMLValue attr = xml->Attribute( "points" );
+  polyline->points.reserve( countPointTokens( attr ) );
+  parsePoints( attr.begin, attr.end, polyline->points );
 
-  float x, y;
-  char c;
-
-  while( points >> x >> c >> y ) {
-     polyline->points.push_back( Vector2D( x, y ) );
-  }
+  polyline->lod.measure( polyline->points, false );
 }
 
-void SVGParser::parseRect( XMLElement* xml, Rect* rect ) {
+void SVGParser::parseRect( XMLReader* xml, Rect* rect ) {
   rect->position  = Vector2D(xml->FloatAttribute( "x" ),
                              xml->FloatAttribute( "y" ));
   rect->dimension = Vector2D(xml->FloatAttribute( "width"  ),
                              xml->FloatAttribute( "height" ));
 }
 
-void SVGParser::parsePolygon( XMLElement* xml, Polygon* polygon ) {
-
-  stringstream points (xml->Attribute( "points" ));
+void SVGParser::parsePolygon( XMLReader* xml, Polygon* polygon ) {
 
-  float x, y;
-  char c;
+  XMLValue attr = xml->Attribute( "points" );
+  polygon->points.reserve( countPointTokens( attr ) );
+  parsePoints( attr.begin, attr.end, polygon->points );
 
-  while( points >> x >> c >> y ) {
-     polygon->points.push_back( Vector2D( x, y ) );
-  }
+  polygon->lod.measure( polygon->points, true );
 }
 
-void SVGParser::parseEllipse( XMLElement* xml, Ellipse* ellipse ) {
+void SVGParser::parseEllipse( XMLReader* xml, Ellipse* ellipse ) {
   ellipse->center = Vector2D(xml->FloatAttribute( "cx" ),
                              xml->FloatAttribute( "cy" ));
 
@@ -338,43 +470,166 @@ void SVGParser::parseEllipse( XMLElement* xml, Ellipse* ellipse ) {
                              xml->FloatAttribute( "ry" ));
 }
 
-void SVGParser::parseImage( XMLElement* xml, Image* image ) {
+// Reads n path arguments, with the separators between them
+static bool parsePathArguments( const char*& p, const char* end, float* values, int n ) {
+  const char* s = p;
+  for( int i = 0; i < n; ++i ) {
+    if( i ) skipSeparator( s, end );
+    if( !parseNumber( s, end, values[i] ) ) return false;
+  }
+  p = s;
+  return true;
+}
+
+// Reads an arc flag, which needs no separator after it ("a1 1 0 00 1 1")
+static bool parseFlag( const char*& p, const char* end, float& flag ) {
+  skipSeparator( p, end );
+  if( p == end || (*p != '0' && *p != '1') ) return false;
+  flag = *p++ - '0';
+  return true;
+}
+
+void SVGParser::parsePath( XMLReader* xml, Path* path ) {
+
+  XMLValue d = xml->Attribute( "d" );
+  PathData& data = path->data;
+
+  // parsing stops at the first error, keeping the commands before it
+  // (as the SVG error handling rules ask)
+  const char* p = d.begin; const char* end = d.end;
+  char command = 0, previous = 0;
+  Vector2D control; // last control point, reflected by smooth curves
+  while( p < end ) {
+
+    // a command letter, or more arguments for the previous command
+    skipSeparator( p, end );
+    if( p == end ) break;
+    if( isalpha( (unsigned char) *p ) ) {
+      command = *p++;
+    } else if( !command ) {
+      break;
+    }
+
+    bool relative = islower( (unsigned char) command ) != 0;
+    char type = toupper( (unsigned char) command );
+    Vector2D current = data.current();
+    Vector2D origin = relative ? current : Vector2D( 0, 0 );
+    if( type != 'M' && data.commands.empty() ) break;
+
+    float a[7]; bool ok = true;
+    switch( type ) {
+      case 'M':
+        if( (ok = parsePathArguments( p, end, a, 2 )) ) {
+          data.move_to( origin + Vector2D( a[0], a[1] ) );
+          command = relative ? 'l' : 'L'; // pairs after a move are lines
+        }
+        break;
+      case 'L':
+        if( (ok = parsePathArguments( p, end, a, 2 )) ) {
+          data.line_to( origin + Vector2D( a[0], a[1] ) );
+        }
+        break;
+      case 'H':
+        if( (ok = parsePathArguments( p, end, a, 1 )) ) {
+          data.line_to( Vector2D( origin.x + a[0], current.y ) );
+        }
+        break;
+      case 'V':
+        if( (ok = parsePathArguments( p, end, a, 1 )) ) {
+          data.line_to( Vector2D( current.x, origin.y + a[0] ) );
+        }
+        break;
+      case 'C':
+        if( (ok = parsePathArguments( p, end, a, 6 )) ) {
+          control = origin + Vector2D( a[2], a[3] );
+          data.cubic_to( origin + Vector2D( a[0], a[1] ), control,
+                         origin + Vector2D( a[4], a[5] ) );
+        }
+        break;
+      case 'S':
+        if( (ok = parsePathArguments( p, end, a, 4 )) ) {
+          Vector2D c1 = previous == 'C' || previous == 'S' ? 2 * current - control : current;
+          control = origin + Vector2D( a[0], a[1] );
+          data.cubic_to( c1, control, origin + Vector2D( a[2], a[3] ) );
+        }
+        break;
+      case 'Q':
+        if( (ok = parsePathArguments( p, end, a, 4 )) ) {
+          control = origin + Vector2D( a[0], a[1] );
+          data.quad_to( control, origin + Vector2D( a[2], a[3] ) );
+        }
+        break;
+      case 'T':
+        if( (ok = parsePathArguments( p, end, a, 2 )) ) {
+          control = previous == 'Q' || previous == 'T' ? 2 * current - control : current;
+          data.quad_to( control, origin + Vector2D( a[0], a[1] ) );
+        }
+        break;
+      case 'A': {
+        const char* s = p;
+        ok = parsePathArguments( s, end, a, 3 ) &&
+             parseFlag( s, end, a[3] ) && parseFlag( s, end, a[4] );
+        if( ok ) {
+          skipSeparator( s, end );
+          ok = parsePathArguments( s, end, a + 5, 2 );
+        }
+        if( ok ) {
+          p = s;
+          data.arc_to( Vector2D( a[0], a[1] ), a[2], a[3] != 0, a[4] != 0,
+                       origin + Vector2D( a[5], a[6] ) );
+        }
+        break;
+      }
+      case 'Z':
+        data.close();
+        command = 0; // takes no arguments
+        break;
+      default:
+        ok = false;
+        break;
+    }
+    if( !ok ) break;
+    previous = type;
+  }
+
+  path->bounds = data.bounds();
+
+  XMLValue rule = xml->Attribute( "fill-rule" );
+  path->evenodd = rule.size() == 7 && !memcmp( rule.begin, "evenodd", 7 );
+}
+
+int SVGParser::parseImage( XMLReader* xml, Image* image ) {
   image->position  = Vector2D ( xml->FloatAttribute( "x" ),
                                 xml->FloatAttribute( "y" ));
   image->dimension = Vector2D ( xml->FloatAttribute( "width"  ),
                                 xml->FloatAttribute( "height" )); 
 
-  // read png data
-  const char* data = xml->Attribute( "xlink:href" );
-  while (*data != ',') data++; data++;
-  
-  // decode base64 encoded data
-  string encoded = data;
-  encoded.erase(remove(encoded.begin(), encoded.end(), ' ' ), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\t'), encoded.end());
-  encoded.erase(remove(encoded.begin(), encoded.end(), '\n'), encoded.end());
-  string decoded = base64_decode(encoded);
-
-  // load decoded data into buffer
-  const unsigned char* buffer = (unsigned char*) decoded.c_str(); 
-  size_t size = decoded.size();
-
-  // load into png
-  PNG png; PNGParser::load(buffer, size, png);
+  // read png data, only embedded data urls are supported
+  XMLValue data = xml->Attribute( "xlink:href" );
+  const char* comma = find( data.begin, data.end, ',' );
+  if( !data.begin ) {
+    cerr << "skipping image without xlink:href" << endl;
+    return -1;
+  }
+  if( comma == data.end ) {
+    cerr << "skipping image that is not embedded: " << data.str() << endl;
+    return -1;
+  }
+  data.begin = comma + 1;
   
-  // create bitmap texture from png (mip level 0)
-  MipLevel mip_start;
-  mip_start.width  = png.width;
-  mip_start.height = png.height;
-  mip_start.texels = png.pixels;
-
-  // add to svg
-  image->tex.width  = mip_start.width;
-  image->tex.height = mip_start.height;
-  image->tex.mipmap.push_back(mip_start);
+  // keep the png, it is decoded by the image cache when it is drawn
+  decodeBase64( data, image->data );
+  int width = 0, height = 0;
+  if( PNGParser::info( image->data.data(), image->data.size(), width, height ) ) {
+    cerr << "skipping image that is not a png" << endl;
+    vector<unsigned char>().swap( image->data );
+    return -1;
+  }
+  ImageCache::init_texture( image->tex, width, height );
+  return 0;
 }
 
-void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
+void SVGParser::parseGroup( XMLReader* xml, Group* group, Arena& arena ) {
 
   /* NOTE (sky):
    * A group contains a list of elements, and optionally a transformation
@@ -386,74 +641,79 @@ void SVGParser::parseGroup( XMLElement* xml, Group* group ) {
    * transformation, and keep in mind that transformation is accumulative.
    * Groups can also be nested.  
    */
-  XMLElement* elem = xml->FirstChildElement();
-  while( elem ) {
+  int depth = xml->Depth();
+  while( xml->NextChild( depth ) ) {
 
-    string elementType ( elem->Value() );
+    string elementType ( xml->Value() );
     if( elementType == "line" ) {
 
-      Line* line = new Line();
-      parseElement( elem, line );
-      parseLine( elem, line );
+      Line* line = arena.create<Line>();
+      parseElement( xml, line );
+      parseLine( xml, line );
       group->elements.push_back( line );
     
     } else if( elementType == "polyline" ) {
 
-      Polyline* polyline = new Polyline();
-      parseElement( elem, polyline );
-      parsePolyline( elem, polyline );
+      Polyline* polyline = arena.create<Polyline>();
+      parseElement( xml, polyline );
+      parsePolyline( xml, polyline );
       group->elements.push_back( polyline );
 
     } else if( elementType == "rect" ) {
 
-      float w = elem->FloatAttribute("width" );
-      float h = elem->FloatAttribute("height");
+      float w = xml->FloatAttribute("width" );
+      float h = xml->FloatAttribute("height");
 
       // treat zero-size rectangles as points
       if (w == 0 && h == 0) {
-        Point* point = new Point();
-        parseElement( elem, point );
-        parsePoint( elem, point );
+        Point* point = arena.create<Point>();
+        parseElement( xml, point );
+        parsePoint( xml, point );
         group->elements.push_back( point );
       } else {
-        Rect* rect = new Rect();
-        parseElement( elem, rect );
-        parseRect( elem, rect );
+        Rect* rect = arena.create<Rect>();
+        parseElement( xml, rect );
+        parseRect( xml, rect );
         group->elements.push_back( rect );
       }
 
     } else if( elementType == "polygon" ) {
     
-      Polygon* polygon = new Polygon();
-      parseElement( elem, polygon );
-      parsePolygon( elem, polygon );
+      Polygon* polygon = arena.create<Polygon>();
+      parseElement( xml, polygon );
+      parsePolygon( xml, polygon );
       group->elements.push_back( polygon );
     
+    } else if( elementType == "path" ) {
+    
+      Path* path = arena.create<Path>();
+      parseElement( xml, path );
+      parsePath( xml, path );
+      group->elements.push_back( path );
+    
     } else if( elementType == "ellipse" ) {
     
-      Ellipse* ellipse = new Ellipse();
-      parseElement( elem, ellipse );
-      parseEllipse( elem, ellipse );
+      Ellipse* ellipse = arena.create<Ellipse>();
+      parseElement( xml, ellipse );
+      parseEllipse( xml, ellipse );
       group->elements.push_back( ellipse );
 
     } else if ( elementType == "image" ) {
     
-      Image* image = new Image();
-      parseElement( elem, image );
-      parseImage( elem, image);
-      group->elements.push_back( image ); 
+      Image* image = arena.create<Image>();
+      parseElement( xml, image );
+      if( parseImage( xml, image ) == 0 ) group->elements.push_back( image );
     
     } else if( elementType == "g" ) {
     
-       Group* sub_group = new Group();
-       parseElement( elem, sub_group );
-       parseGroup( elem, sub_group );
+       Group* sub_group = arena.create<Group>();
+       parseElement( xml, sub_group );
+       parseGroup( xml, sub_group, arena );
        group->elements.push_back( sub_group );
     
     } else {
        // unknown element type --- include default handler here if desired
     }    
-    elem = elem->NextSiblingElement();
   }
 }
 
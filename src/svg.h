@@ -3,14 +3,18 @@
 
 #include <map>
 #include <vector>
+#include <stdint.h>
 
 #include "color.h"
 #include "texture.h"
 #include "vector2D.h"
 #include "matrix3x3.h"
-
-#include "tinyxml2.h"
-using namespace tinyxml2;
+#include "arena.h"
+#include "bvh.h"
+#include "lod.h"
+#include "path.h"
+#include "xml_reader.h"
+#include "image_cache.h"
 
 namespace CMU462 {
 
@@ -23,7 +27,8 @@ typedef enum e_SVGElementType {
   POLYGON,
   ELLIPSE,
   IMAGE,
-  GROUP
+  GROUP,
+  PATH
 } SVGElementType;
 
 struct Style {
@@ -56,8 +61,6 @@ struct Group : SVGElement {
   Group() : SVGElement  ( GROUP ) { }
   std::vector<SVGElement*> elements;
 
-  ~Group();
-
 };
 
 struct Point : SVGElement {
@@ -80,6 +83,9 @@ struct Polyline : SVGElement {
   Polyline() : SVGElement  ( POLYLINE ) { }
   std::vector<Vector2D> points;
 
+  // simplified versions of points for zoomed out views
+  LODChain lod;
+
 };
 
 struct Rect : SVGElement {
@@ -95,6 +101,9 @@ struct Polygon : SVGElement {
   Polygon() : SVGElement  ( POLYGON ) { }
   std::vector<Vector2D> points;
 
+  // simplified versions of points for zoomed out views
+  LODChain lod;
+
 };
 
 struct Ellipse : SVGElement {
@@ -108,43 +117,97 @@ struct Ellipse : SVGElement {
 struct Image : SVGElement {
 
   Image() : SVGElement  ( IMAGE ) { }
+  ~Image();
   Vector2D position;
   Vector2D dimension;
   Texture tex;
+
+  // compressed (png) image, decoded into the levels of tex that are
+  // sampled by the image cache. Empty for images that are fully decoded.
+  std::vector<unsigned char> data;
   
 };
 
+struct Path : SVGElement {
+
+  Path() : SVGElement ( PATH ), evenodd ( false ) { }
+  PathData data;
+
+  // bounds of data
+  BBox bounds;
+
+  // fill rule, nonzero unless set
+  bool evenodd;
+
+  // flattened outlines for the zoom levels the path is drawn at
+  PathCache flattened;
+
+};
+
 struct SVG {
 
   ~SVG();
   float width, height;
   std::vector<SVGElement*> elements;
 
+  // storage for all the elements of the document (including the ones
+  // nested in groups). Elements are released together with the svg.
+  Arena arena;
+
+  // spatial index over the elements, built once the svg is loaded
+  BVH bvh;
+
 };
 
 class SVGParser {
  public:
 
+  // load a svg file, or a scene written by save
   static int load( const char* filename, SVG* svg );
+
+  // write a loaded svg as a binary scene that loads without parsing
   static int save( const char* filename, const SVG* svg );
+
+  // load a svg file through its scene cached in cache_dir, which is
+  // rebuilt when missing or when the svg file has changed
+  static int loadCached( const char* filename, SVG* svg, const std::string& cache_dir );
+
+  // the file the scene of a svg file is cached in: its name and a hash of
+  // its absolute path, so that files of different folders do not collide
+  static std::string cachePath( const char* filename, const std::string& cache_dir );
+
+  // create a cache directory if it does not exist yet
+  static int makeCacheDir( const std::string& cache_dir );
  
  private:
-  
+
+  // binary scenes, tagged with the size and hash of their svg file.
+  // Reading fails on damaged scenes and, when checking the source, on
+  // scenes tagged differently.
+  static bool isScene    ( const char* filename );
+  static int  writeScene ( const char* filename, const SVG* svg,
+                           uint64_t source_size, uint64_t source_hash );
+  static int  readScene  ( const char* filename, SVG* svg, bool check_source,
+                           uint64_t source_size, uint64_t source_hash );
+
   // parse a svg file
-  static void parseSVG       ( XMLElement* xml, SVG* svg );
+  static void parseSVG       ( XMLReader*  xml, SVG* svg );
 
   // parse shared properties of svg elements
-  static void parseElement   ( XMLElement* xml, SVGElement* element );
+  static void parseElement   ( XMLReader*  xml, SVGElement* element );
   
-  // parse type specific properties
-  static void parsePoint     ( XMLElement* xml, Point*    point       );
-  static void parseLine      ( XMLElement* xml, Line*     line        );
-  static void parsePolyline  ( XMLElement* xml, Polyline* polyline    );
-  static void parseRect      ( XMLElement* xml, Rect*     rect        );
-  static void parsePolygon   ( XMLElement* xml, Polygon*  polygon     );
-  static void parseEllipse   ( XMLElement* xml, Ellipse*  ellipse     );
-  static void parseImage     ( XMLElement* xml, Image*    image       );
-  static void parseGroup     ( XMLElement* xml, Group*    group       );
+  // parse type specific properties (parseImage returns -1 for images
+  // that are skipped)
+  static void parsePoint     ( XMLReader*  xml, Point*    point       );
+  static void parseLine      ( XMLReader*  xml, Line*     line        );
+  static void parsePolyline  ( XMLReader*  xml, Polyline* polyline    );
+  static void parseRect      ( XMLReader*  xml, Rect*     rect        );
+  static void parsePolygon   ( XMLReader*  xml, Polygon*  polygon     );
+  static void parseEllipse   ( XMLReader*  xml, Ellipse*  ellipse     );
+  static int  parseImage     ( XMLReader*  xml, Image*    image       );
+  static void parsePath      ( XMLReader*  xml, Path*     path        );
+  static void parseGroup     ( XMLReader*  xml, Group*    group,
+                               Arena&      arena                        );
 
 
 }; // class SVGParser
@@ -71,18 +71,16 @@ namespace CMU462 {
 			MipLevel& mipCurr = tex.mipmap[i];
 			MipLevel& mipPrev = tex.mipmap[i - 1];
 
-			int j = 0;
-			int w = 0;
 			for (size_t i = 0; i < 4 * mipCurr.width * mipCurr.height; i += 4) {
-				j = i * 2;
-				w = mipCurr.width * 2;
-				int x = (j / 4) % w;
-				int y = (j / 4) / w;
-				unsigned char* src00 = &mipPrev.texels[(x + y * 2* w) * 4];
-				unsigned char* src01 = &mipPrev.texels[(x + (y + 1) * 2 * w) * 4];
-				unsigned char* src10 = &mipPrev.texels[(x + 1 + y * 2 * w) * 4];
-				unsigned char* src11 = &mipPrev.texels[(x + 1 + (y + 1) * 2 * w) * 4];
-				//cout << i << " " << (x + y * 2 * w) * 4 << endl;
+				// 2x2 block of the previous level, clamped to its edge when
+				// its size is odd (or 1)
+				size_t pw = mipPrev.width;
+				size_t x0 = 2 * ((i / 4) % mipCurr.width), x1 = min(x0 + 1, pw - 1);
+				size_t y0 = 2 * ((i / 4) / mipCurr.width), y1 = min(y0 + 1, mipPrev.height - 1);
+				unsigned char* src00 = &mipPrev.texels[(x0 + y0 * pw) * 4];
+				unsigned char* src01 = &mipPrev.texels[(x0 + y1 * pw) * 4];
+				unsigned char* src10 = &mipPrev.texels[(x1 + y0 * pw) * 4];
+				unsigned char* src11 = &mipPrev.texels[(x1 + y1 * pw) * 4];
 				float src_avg[4] = {
 				 (src00[0] * (0.25f / 255) + src10[0] * (0.25f/255)) + (src01[0] * (0.25f/255) + src11[0] * (0.25f/255)),
 				 (src00[1] * (0.25f / 255) + src10[1] * (0.25f/255)) + (src01[1] * (0.25f/255) + src11[1] * (0.25f/255)),
@@ -121,7 +119,8 @@ namespace CMU462 {
 		float u, float v,
 		int level) {
 
-		if (level < tex.mipmap.size() && level >= 0)
+		// (levels that are not decoded have no texels)
+		if (level < tex.mipmap.size() && level >= 0 && !tex.mipmap[level].texels.empty())
 		{
 			MipLevel& mip = tex.mipmap[level];
 			int x0 = floor(u * mip.width);
@@ -0,0 +1,140 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace CMU462 {
+
+ThreadPool::ThreadPool( size_t threads ) : quit ( false ) {
+
+  if( !threads ) threads = max( 1u, thread::hardware_concurrency() );
+  for( size_t i = 1; i < threads; ++i ) {
+    workers.push_back( thread( &ThreadPool::worker, this ) );
+  }
+}
+
+ThreadPool::~ThreadPool() {
+
+  {
+    lock_guard<std::mutex> lock( mutex );
+    quit = true;
+  }
+  work_added.notify_all();
+  for( size_t i = 0; i < workers.size(); ++i ) workers[i].join();
+}
+
+ThreadPool& ThreadPool::shared() {
+  static ThreadPool pool;
+  return pool;
+}
+
+void ThreadPool::parallel_for( size_t n, const function<void(size_t)>& f ) {
+
+  if( !n ) return;
+
+  // nothing to share
+  if( workers.empty() || n == 1 ) {
+    for( size_t i = 0; i < n; ++i ) f( i );
+    return;
+  }
+
+  shared_ptr<Loop> loop ( new Loop( n, f ) );
+  {
+    lock_guard<std::mutex> lock( mutex );
+    loops.push_back( loop );
+  }
+  work_added.notify_all();
+
+  work( *loop );
+
+  // wait for the iterations taken by the workers
+  unique_lock<std::mutex> lock( mutex );
+  work_done.wait( lock, [&loop] { return loop->done == loop->n; } );
+}
+
+void ThreadPool::run( TaskGroup& group, const function<void()>& f ) {
+
+  Task task = { f, &group };
+  group.pending++;
+  {
+    lock_guard<std::mutex> lock( mutex );
+    tasks.push_back( task );
+  }
+  work_added.notify_one();
+}
+
+void ThreadPool::wait( TaskGroup& group ) {
+
+  unique_lock<std::mutex> lock( mutex );
+  while( group.pending ) {
+
+    // help with queued tasks (of any group) rather than block
+    if( !tasks.empty() ) {
+      Task task = tasks.front();
+      tasks.pop_front();
+      lock.unlock();
+      work( task );
+      lock.lock();
+      continue;
+    }
+
+    work_done.wait( lock );
+  }
+}
+
+void ThreadPool::work( Task& task ) {
+  task.f();
+  if( !--task.group->pending ) {
+    lock_guard<std::mutex> lock( mutex );
+    work_done.notify_all();
+  }
+}
+
+void ThreadPool::work( Loop& loop ) {
+
+  size_t i;
+  while( (i = loop.next++) < loop.n ) {
+    loop.f( i );
+    if( ++loop.done == loop.n ) {
+      lock_guard<std::mutex> lock( mutex );
+      work_done.notify_all();
+    }
+  }
+
+  // all iterations are handed out
+  lock_guard<std::mutex> lock( mutex );
+  for( size_t j = 0; j < loops.size(); ++j ) {
+    if( loops[j].get() == &loop ) {
+      loops.erase( loops.begin() + j );
+      break;
+    }
+  }
+}
+
+void ThreadPool::worker() {
+
+  while( true ) {
+
+    // loops first, their callers are waiting for them
+    shared_ptr<Loop> loop; Task task;
+    {
+      unique_lock<std::mutex> lock( mutex );
+      work_added.wait( lock, [this] {
+        return quit || !loops.empty() || !tasks.empty();
+      });
+      if( quit ) return;
+      if( !loops.empty() ) {
+        loop = loops.front();
+      } else {
+        task = tasks.front();
+        tasks.pop_front();
+      }
+    }
+
+    if( loop ) work( *loop );
+    else work( task );
+  }
+}
+
+} // namespace CMU462
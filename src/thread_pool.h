@@ -0,0 +1,93 @@
+#ifndef CMU462_THREAD_POOL_H
+#define CMU462_THREAD_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+#include <functional>
+#include <condition_variable>
+
+namespace CMU462 {
+
+/**
+ * Fixed set of worker threads for data parallel loops and background tasks.
+ * A loop is split into its iterations, which the workers and the calling
+ * thread take in order until none are left. Since the caller always works
+ * on its own loop, loops can be started from several threads at once and
+ * from inside other loops without deadlocking. Tasks are queued in groups,
+ * and a thread waiting for a group runs queued tasks itself until the
+ * group is done, so tasks also complete on a pool without workers.
+ */
+class ThreadPool {
+ public:
+
+  // tasks that are waited for together
+  class TaskGroup {
+   public:
+    TaskGroup() : pending ( 0 ) { }
+   private:
+    friend class ThreadPool;
+    std::atomic<size_t> pending;
+  };
+
+  // number of threads working on a loop, including the caller
+  // (0 uses one per hardware thread)
+  ThreadPool( size_t threads = 0 );
+  ~ThreadPool();
+
+  // call f(i) for i in [0, n), returns when all calls are done
+  void parallel_for( size_t n, const std::function<void(size_t)>& f );
+
+  // queue f to run on a worker
+  void run( TaskGroup& group, const std::function<void()>& f );
+
+  // wait for all tasks of a group, running queued tasks meanwhile
+  void wait( TaskGroup& group );
+
+  // threads working on a loop, including the caller
+  inline size_t size() const { return workers.size() + 1; }
+
+  // pool shared by the application
+  static ThreadPool& shared();
+
+ private:
+
+  struct Loop {
+    Loop( size_t n, const std::function<void(size_t)>& f )
+      : n ( n ), f ( f ), next ( 0 ), done ( 0 ) { }
+    size_t n;
+    const std::function<void(size_t)>& f;
+    std::atomic<size_t> next, done;
+  };
+
+  struct Task {
+    std::function<void()> f;
+    TaskGroup* group;
+  };
+
+  // run iterations of a loop until there are none left
+  void work( Loop& loop );
+
+  // run a task taken from the queue
+  void work( Task& task );
+
+  void worker();
+
+  std::vector<std::thread> workers;
+
+  // loops that still have iterations to hand out, and queued tasks
+  std::deque< std::shared_ptr<Loop> > loops;
+  std::deque<Task> tasks;
+  std::mutex mutex;
+  std::condition_variable work_added, work_done;
+  bool quit;
+
+}; // class ThreadPool
+
+} // namespace CMU462
+
+#endif // CMU462_THREAD_POOL_H
@@ -0,0 +1,63 @@
+#include "tile_cache.h"
+
+using namespace std;
+
+namespace CMU462 {
+
+const unsigned char* TileCache::find( const Key& key ) {
+
+  unordered_map<Key, list<Tile>::iterator, KeyHash>::iterator it = index.find( key );
+  if( it == index.end() ) {
+    misses++;
+    return NULL;
+  }
+
+  // move to the front of the recently used list
+  tiles.splice( tiles.begin(), tiles, it->second );
+  hits++;
+  return &it->second->pixels[0];
+}
+
+unsigned char* TileCache::insert( const Key& key ) {
+
+  unordered_map<Key, list<Tile>::iterator, KeyHash>::iterator it = index.find( key );
+  if( it != index.end() ) {
+    tiles.splice( tiles.begin(), tiles, it->second );
+    return &it->second->pixels[0];
+  }
+
+  // reuse the storage of an evicted tile when the cache is full
+  evict( 1 );
+  if( !tiles.empty() && size() + kTileBytes > budget ) {
+    tiles.splice( tiles.begin(), tiles, --tiles.end() );
+    index.erase( tiles.front().key );
+  } else {
+    tiles.push_front( Tile() );
+    tiles.front().pixels.resize( kTileBytes );
+  }
+
+  tiles.front().key = key;
+  index[key] = tiles.begin();
+  return &tiles.front().pixels[0];
+}
+
+void TileCache::clear() {
+  tiles.clear();
+  index.clear();
+}
+
+void TileCache::set_budget( size_t bytes ) {
+  budget = bytes;
+  evict( 0 );
+}
+
+void TileCache::evict( size_t n ) {
+
+  // always keep one tile so that the caller can render into it
+  while( tiles.size() > 1 && size() + n * kTileBytes > budget ) {
+    index.erase( tiles.back().key );
+    tiles.pop_back();
+  }
+}
+
+} // namespace CMU462
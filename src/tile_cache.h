@@ -0,0 +1,94 @@
+#ifndef CMU462_TILE_CACHE_H
+#define CMU462_TILE_CACHE_H
+
+#include <list>
+#include <vector>
+#include <cstddef>
+#include <unordered_map>
+
+namespace CMU462 {
+
+/**
+ * Least recently used cache of rendered tiles.
+ * A tile is a kTileSize x kTileSize block of RGBA pixels of a document
+ * rendered at one of the discrete zoom levels of the viewer. Tiles are
+ * addressed by their position in the pixel grid of that zoom level, so
+ * they stay valid while the view is panned and when it returns to a
+ * level it has been at before.
+ */
+class TileCache {
+ public:
+
+  static const int kTileSize = 256;
+
+  // bytes of pixel data held by one tile
+  static const size_t kTileBytes = 4 * kTileSize * kTileSize;
+
+  struct Key {
+    size_t tab;
+    int level;        // zoom level
+    int x, y;         // tile position in the grid of the zoom level
+    size_t sample_rate;
+
+    bool operator==( const Key& k ) const {
+      return tab == k.tab && level == k.level && x == k.x && y == k.y &&
+             sample_rate == k.sample_rate;
+    }
+  };
+
+  TileCache( size_t budget ) : budget ( budget ), hits ( 0 ), misses ( 0 ) { }
+
+  // pixels of a cached tile, NULL on a miss
+  const unsigned char* find( const Key& key );
+
+  // add a tile, evicting the least recently used ones to stay within the
+  // budget, and return its pixels to render into
+  unsigned char* insert( const Key& key );
+
+  // drop all tiles (after changes that affect rendering)
+  void clear();
+
+  // memory budget in bytes (at least one tile is always kept)
+  void set_budget( size_t bytes );
+  inline size_t get_budget() const { return budget; }
+
+  // bytes used by cached tiles
+  inline size_t size() const { return tiles.size() * kTileBytes; }
+
+  // lookup statistics
+  inline size_t get_hits() const { return hits; }
+  inline size_t get_misses() const { return misses; }
+
+ private:
+
+  struct Tile {
+    Key key;
+    std::vector<unsigned char> pixels;
+  };
+
+  struct KeyHash {
+    size_t operator()( const Key& k ) const {
+      size_t h = k.tab;
+      h = h * 31 + k.level;
+      h = h * 31 + k.x;
+      h = h * 31 + k.y;
+      h = h * 31 + k.sample_rate;
+      return h;
+    }
+  };
+
+  // drop least recently used tiles until n more fit in the budget
+  void evict( size_t n );
+
+  size_t budget;
+  size_t hits, misses;
+
+  // most recently used first
+  std::list<Tile> tiles;
+  std::unordered_map<Key, std::list<Tile>::iterator, KeyHash> index;
+
+}; // class TileCache
+
+} // namespace CMU462
+
+#endif // CMU462_TILE_CACHE_H
@@ -8,6 +8,9 @@ namespace CMU462 {
 // triangulates a polygon and save the result as a triangle list
 void triangulate(const Polygon& polygon, std::vector<Vector2D>& triangles );
 
+// triangulates a contour given as a point list
+void triangulate(const std::vector<Vector2D>& contour, std::vector<Vector2D>& triangles );
+
 } // namespace CMU462
 
 #endif // CMU462_TRIANGULATION_H
@@ -19,6 +19,11 @@ class Viewport {
     svg_2_norm = m;
   }
 
+  // current viewbox center and vertical view radius
+  inline float get_center_x() const { return centerX; }
+  inline float get_center_y() const { return centerY; }
+  inline float get_vspan() const { return vspan; }
+
   // set viewbox to look at (centerX, centerY) in normalized svg coordinate space. vspan defines 
   // the vertical view radius of the viewbox (ie. vspan>=0.5 means the entire svg canvas is in view)
   virtual void set_viewbox( float centerX, float centerY, float vspan ) = 0;
@@ -0,0 +1,374 @@
+#include "xml_reader.h"
+#include "number_parser.h"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+namespace CMU462 {
+
+// parsed bytes are released from the mapping in steps of this size
+static const size_t kReleaseSize = 1 << 22;
+
+static bool isSpace( char c ) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// same name rules as tinyxml2
+static bool isNameStartChar( unsigned char c ) {
+  return c >= 128 || isalpha( c ) || c == ':' || c == '_';
+}
+
+static bool isNameChar( unsigned char c ) {
+  return isNameStartChar( c ) || isdigit( c ) || c == '.' || c == '-';
+}
+
+// write a code point as utf-8, returns the number of bytes
+static int encodeUTF8( unsigned long c, char* out ) {
+  if( c < 0x80 ) {
+    out[0] = (char) c;
+    return 1;
+  }
+  if( c < 0x800 ) {
+    out[0] = (char) (0xC0 | (c >> 6));
+    out[1] = (char) (0x80 | (c & 0x3F));
+    return 2;
+  }
+  if( c < 0x10000 ) {
+    out[0] = (char) (0xE0 | (c >> 12));
+    out[1] = (char) (0x80 | ((c >> 6) & 0x3F));
+    out[2] = (char) (0x80 | (c & 0x3F));
+    return 3;
+  }
+  if( c < 0x200000 ) {
+    out[0] = (char) (0xF0 | (c >> 18));
+    out[1] = (char) (0x80 | ((c >> 12) & 0x3F));
+    out[2] = (char) (0x80 | ((c >> 6) & 0x3F));
+    out[3] = (char) (0x80 | (c & 0x3F));
+    return 4;
+  }
+  return 0;
+}
+
+// Decodes entities and normalizes newlines of an attribute value the
+// same way tinyxml2 does.
+static void unescape( const char* p, const char* end, string& out ) {
+
+  static const struct { const char* pattern; size_t length; char value; } entities[] = {
+    { "quot", 4, '\"' }, { "amp", 3, '&' }, { "apos", 4, '\'' },
+    { "lt", 2, '<' }, { "gt", 2, '>' }
+  };
+
+  out.clear();
+  out.reserve( end - p );
+  while( p < end ) {
+
+    // CR LF, LF CR and CR alone become LF
+    if( *p == '\r' || *p == '\n' ) {
+      p += (p + 1 < end && p[1] == (*p == '\r' ? '\n' : '\r')) ? 2 : 1;
+      out += '\n';
+      continue;
+    }
+
+    if( *p != '&' ) {
+      out += *p++;
+      continue;
+    }
+
+    // numeric character reference
+    const char* semicolon = find( p, end, ';' );
+    if( p + 1 < end && p[1] == '#' && semicolon != end ) {
+      bool hex = p + 2 < end && p[2] == 'x';
+      string digits( p + (hex ? 3 : 2), semicolon ); char* stop;
+      unsigned long c = strtoul( digits.c_str(), &stop, hex ? 16 : 10 );
+      char utf8[4]; int length = 0;
+      if( !digits.empty() && !*stop && (length = encodeUTF8( c, utf8 )) ) {
+        out.append( utf8, length );
+        p = semicolon + 1;
+      } else {
+        out += *p++;
+      }
+      continue;
+    }
+
+    // named entity
+    size_t i = 0, n = sizeof(entities) / sizeof(entities[0]);
+    for( ; i < n; ++i ) {
+      if( semicolon - p == (ptrdiff_t) entities[i].length + 1 &&
+          !strncmp( p + 1, entities[i].pattern, entities[i].length ) ) break;
+    }
+    if( i < n ) {
+      out += entities[i].value;
+      p += entities[i].length + 2;
+    } else {
+      out += *p++;
+    }
+  }
+}
+
+XMLReader::~XMLReader() {
+#ifndef _WIN32
+  if( data ) munmap( (void*) data, size );
+#endif
+}
+
+bool XMLReader::Open( const char* filename ) {
+
+  this->filename = filename;
+  pos = released = 0;
+
+#ifndef _WIN32
+  int fd = ::open( filename, O_RDONLY );
+  if( fd < 0 ) return false;
+
+  struct stat st;
+  if( fstat( fd, &st ) < 0 || !S_ISREG( st.st_mode ) ) {
+    ::close( fd );
+    return false;
+  }
+
+  size = st.st_size;
+  if( size ) {
+    void* map = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if( map == MAP_FAILED ) {
+      ::close( fd );
+      return false;
+    }
+    madvise( map, size, MADV_SEQUENTIAL );
+    data = (const char*) map;
+  }
+  ::close( fd );
+#else
+  // no mapping, read the file in one go
+  FILE* file = fopen( filename, "rb" );
+  if( !file ) return false;
+  fseek( file, 0, SEEK_END );
+  contents.resize( max( 0L, ftell( file ) ) );
+  fseek( file, 0, SEEK_SET );
+  contents.resize( fread( contents.data(), 1, contents.size(), file ) );
+  fclose( file );
+  data = contents.data(); size = contents.size();
+#endif
+
+  return true;
+}
+
+bool XMLReader::NextChild( int depth ) {
+
+  // the element at the given depth is open as long as there are that
+  // many open elements (empty elements are never opened)
+  while( (int) open.size() >= depth ) {
+    bool start;
+    if( !next( start ) ) return false;
+    if( start && this->depth == depth + 1 ) return true;
+  }
+
+  return false;
+}
+
+XMLValue XMLReader::Attribute( const char* name ) const {
+
+  size_t length = strlen( name );
+  for( size_t i = 0; i < attributes.size(); ++i ) {
+
+    Attr& a = attributes[i];
+    if( a.key.size() != length || memcmp( a.key.begin, name, length ) ) continue;
+
+    // values with entities or carriage returns are decoded into a copy
+    if( !a.decoded ) {
+      a.decoded = true;
+      const char* p = a.value.begin;
+      while( p < a.value.end && *p != '&' && *p != '\r' ) p++;
+      if( p < a.value.end ) {
+        decoded.push_back( string() );
+        unescape( a.value.begin, a.value.end, decoded.back() );
+        a.value = XMLValue( decoded.back().data(),
+                            decoded.back().data() + decoded.back().size() );
+      }
+    }
+    return a.value;
+  }
+
+  return XMLValue();
+}
+
+float XMLReader::FloatAttribute( const char* name ) const {
+  float value = 0;
+  QueryFloatAttribute( name, &value );
+  return value;
+}
+
+bool XMLReader::QueryFloatAttribute( const char* name, float* value ) const {
+
+  XMLValue attribute = Attribute( name );
+  if( !attribute.begin ) return false;
+
+  const char* p = attribute.begin;
+  return parseNumber( p, attribute.end, *value );
+}
+
+void XMLReader::PrintError() const {
+  cerr << "Error: " << error << " at byte " << error_offset
+       << " of " << filename << endl;
+}
+
+void XMLReader::set_error( const char* message ) {
+  if( Error() ) return;
+  error = message;
+  error_offset = pos;
+}
+
+bool XMLReader::skip( const char* terminator ) {
+  const char* found = search( data + pos, data + size, terminator, terminator + strlen( terminator ) );
+  if( found == data + size ) return false;
+  pos = found - data + strlen( terminator );
+  return true;
+}
+
+bool XMLReader::next( bool& start ) {
+
+  attributes.clear();
+  decoded.clear();
+
+#ifndef _WIN32
+  // the input before the current position is never read again
+  if( pos - released >= kReleaseSize ) {
+    size_t page = sysconf( _SC_PAGESIZE );
+    size_t until = pos / page * page;
+    madvise( (void*) (data + released), until - released, MADV_DONTNEED );
+    released = until;
+  }
+#endif
+
+  while( true ) {
+
+    // skip text up to the next tag
+    const char* lt = (const char*) memchr( data + pos, '<', size - pos );
+    if( !lt ) {
+      pos = size;
+      if( !open.empty() ) set_error( "unexpected end of file" );
+      return false;
+    }
+    pos = lt - data;
+
+    const char* p = data + pos; size_t available = size - pos;
+    if( available >= 4 && !strncmp( p, "<!--", 4 ) ) {
+      if( skip( "-->" ) ) continue;
+      set_error( "unterminated comment" );
+      return false;
+    }
+    if( available >= 9 && !strncmp( p, "<![CDATA[", 9 ) ) {
+      if( skip( "]]>" ) ) continue;
+      set_error( "unterminated CDATA section" );
+      return false;
+    }
+    if( available >= 2 && !strncmp( p, "<?", 2 ) ) {
+      if( skip( "?>" ) ) continue;
+      set_error( "unterminated declaration" );
+      return false;
+    }
+    if( available >= 2 && !strncmp( p, "<!", 2 ) ) {
+      if( skip( ">" ) ) continue;
+      set_error( "unterminated declaration" );
+      return false;
+    }
+
+    // find the end of the tag, which may appear in attribute values
+    size_t close = pos + 1;
+    while( close < size && data[close] != '>' ) {
+      char c = data[close++];
+      if( c == '\"' || c == '\'' ) {
+        const char* quote = (const char*) memchr( data + close, c, size - close );
+        close = quote ? quote - data + 1 : size;
+      }
+    }
+    if( close >= size ) {
+      set_error( "unterminated tag" );
+      return false;
+    }
+
+    // end tag
+    if( data[pos + 1] == '/' ) {
+      const char* first = data + pos + 2; const char* last = data + close;
+      while( last > first && isSpace( last[-1] ) ) last--;
+      if( open.empty() || open.back().compare( 0, string::npos, first, last - first ) ) {
+        set_error( "mismatched element" );
+        return false;
+      }
+      open.pop_back();
+      pos = close + 1;
+      start = false;
+      return true;
+    }
+
+    // start tag
+    bool empty;
+    if( !parse_start( close, empty ) ) {
+      set_error( "malformed element" );
+      return false;
+    }
+    depth = open.size() + 1;
+    if( !empty ) open.push_back( name );
+    pos = close + 1;
+    start = true;
+    return true;
+  }
+}
+
+bool XMLReader::parse_start( size_t close, bool& empty ) {
+
+  const char* p = data + pos + 1;
+  const char* last = data + close;
+
+  // element name
+  if( !isNameStartChar( *p ) ) return false;
+  const char* name_begin = p;
+  while( p < last && isNameChar( *p ) ) p++;
+  name.assign( name_begin, p );
+
+  // attributes
+  empty = false;
+  while( true ) {
+
+    while( p < last && isSpace( *p ) ) p++;
+    if( p == last ) break;
+    if( *p == '/' && p + 1 == last ) {
+      empty = true;
+      break;
+    }
+    if( !isNameStartChar( *p ) ) return false;
+
+    Attr a;
+    a.key.begin = p;
+    while( p < last && isNameChar( *p ) ) p++;
+    a.key.end = p;
+    while( p < last && isSpace( *p ) ) p++;
+    if( p == last || *p != '=' ) return false;
+    p++;
+    while( p < last && isSpace( *p ) ) p++;
+    if( p == last || (*p != '\"' && *p != '\'') ) return false;
+
+    char quote = *p++;
+    a.value.begin = p;
+    p = (const char*) memchr( p, quote, last - p );
+    if( !p ) return false;
+    a.value.end = p++;
+    a.decoded = false;
+    attributes.push_back( a );
+  }
+
+  return true;
+}
+
+} // namespace CMU462
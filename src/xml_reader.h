@@ -0,0 +1,124 @@
+#ifndef CMU462_XML_READER_H
+#define CMU462_XML_READER_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+namespace CMU462 {
+
+/**
+ * Attribute value.
+ * Points into the input, where it is followed by its closing quote rather
+ * than a null terminator. Number parsers that stop at the first invalid
+ * character (strtof, streams) can read it in place, anything else has to
+ * use the [begin, end) range.
+ */
+struct XMLValue {
+
+  XMLValue() : begin ( NULL ), end ( NULL ) { }
+  XMLValue( const char* begin, const char* end ) : begin ( begin ), end ( end ) { }
+
+  // NULL for attributes that are not set
+  const char* begin;
+  const char* end;
+
+  inline bool empty() const { return begin == end; }
+  inline size_t size() const { return end - begin; }
+  inline std::string str() const { return std::string( begin, end ); }
+
+}; // struct XMLValue
+
+/**
+ * Streaming reader of XML elements.
+ * Maps a file into memory and visits its elements in document order without
+ * building a document tree or copying the input: names and attribute values
+ * are handed out as ranges of the mapping (only values that contain
+ * entities or carriage returns are decoded into a copy). Pages that have
+ * been parsed are released from the mapping as the reader moves on. Text,
+ * comments, CDATA sections, processing instructions and doctype
+ * declarations are skipped.
+ * The attribute accessors mirror the ones of tinyxml2::XMLElement, with
+ * entities decoded and newlines normalized the same way. Values are valid
+ * until the reader moves to the next element.
+ */
+class XMLReader {
+ public:
+
+  XMLReader() : data ( NULL ), size ( 0 ), pos ( 0 ), released ( 0 ),
+                depth ( 0 ) { }
+  ~XMLReader();
+
+  // open a file, false if it can not be read
+  bool Open( const char* filename );
+
+  // Move to the next child of the element at the given depth, skipping the
+  // contents of the previous child. Returns false once that element ends
+  // (or on errors). Depth 0 visits the top level elements:
+  //   int depth = xml->Depth();
+  //   while( xml->NextChild( depth ) ) { ... }
+  bool NextChild( int depth );
+
+  // depth of the current element (top level elements are at depth 1)
+  inline int Depth() const { return depth; }
+
+  // name of the current element
+  inline const char* Value() const { return name.c_str(); }
+
+  // attribute of the current element (begin is NULL if it is not set)
+  XMLValue Attribute( const char* name ) const;
+
+  // attribute of the current element as a float (0 if not set), and
+  // a version that leaves the value unchanged if it is not set
+  float FloatAttribute( const char* name ) const;
+  bool QueryFloatAttribute( const char* name, float* value ) const;
+
+  // malformed input
+  inline bool Error() const { return !error.empty(); }
+  void PrintError() const;
+
+ private:
+
+  // read the next start or end tag, false at the end of the input
+  bool next( bool& start );
+
+  // move past the next occurrence of a terminator
+  bool skip( const char* terminator );
+
+  // parse the start tag in data[pos, close)
+  bool parse_start( size_t close, bool& empty );
+
+  void set_error( const char* message );
+
+  std::string filename;
+
+  // mapped file, parsed up to pos. Pages before released have been
+  // dropped from the mapping.
+  const char* data; size_t size;
+  size_t pos, released;
+#ifdef _WIN32
+  std::vector<char> contents;
+#endif
+
+  // current element. Values that need decoding are decoded on first use.
+  struct Attr {
+    XMLValue key;
+    XMLValue value;
+    bool decoded;
+  };
+  std::string name;
+  mutable std::vector<Attr> attributes;
+  mutable std::deque<std::string> decoded;
+  int depth;
+
+  // names of the open elements
+  std::vector<std::string> open;
+
+  std::string error; size_t error_offset;
+
+}; // class XMLReader
+
+} // namespace CMU462
+
+#endif // CMU462_XML_READER_H